@@ -0,0 +1,20 @@
+#include "bench.h"
+#include "stdio.h"
+
+/*
+ * 内核库代码的主机端微基准测试, 由 make bench 编译为 32 位 Linux 程序并运行,
+ * 被测代码与内核使用同一份源文件和同样的编译选项
+ */
+int32_t bench_main(void) {
+    printf("bitmap:\n");
+    bench_bitmap();
+    printf("string:\n");
+    bench_string();
+    printf("list:\n");
+    bench_list();
+    printf("slab:\n");
+    bench_slab();
+    printf("malloc:\n");
+    bench_malloc();
+    return 0;
+}
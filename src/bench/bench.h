@@ -0,0 +1,19 @@
+#ifndef __BENCH_BENCH_H
+#define __BENCH_BENCH_H
+#include "stdint.h"
+
+/* 一个基准测试: 每次调用 fn(arg) 算作一次操作, 共调用 iters 次 */
+typedef void (bench_fn) (uint32_t arg);
+
+void bench_run(const char* name, bench_fn fn, uint32_t arg, uint32_t iters);
+uint32_t bench_rand(void);
+void bench_exit(int32_t code);
+int32_t bench_main(void);
+
+/* 各组基准测试, 分别位于 bench_<组名>.c */
+void bench_bitmap(void);
+void bench_string(void);
+void bench_list(void);
+void bench_slab(void);
+void bench_malloc(void);
+#endif
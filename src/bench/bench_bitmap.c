@@ -0,0 +1,101 @@
+#include "bench.h"
+#include "bitmap.h"
+#include "string.h"
+#include "stdio.h"
+#include "debug.h"
+
+/* 32768 字节的位图, 对应 1GB 物理内存的页位图 */
+#define BM_BYTES 32768
+#define BM_BITS (BM_BYTES * 8)
+
+static uint8_t bm_bits[BM_BYTES];
+static uint32_t bm_summary[BITMAP_SUMMARY_BYTES(BM_BYTES) / 4];
+static struct bitmap bm;
+
+/* 按内存池的分配方式从低位起占用 fill 百分比的位, holes 为真时再随机释放其中 1/64 形成零散空洞,
+ * 否则占用的前缀是满的, 空闲位都在尾部 */
+static void bm_fill(uint32_t fill, uint8_t use_summary, uint8_t holes) {
+    bm.btmp_bytes_len = BM_BYTES;
+    bm.bits = bm_bits;
+    bm.summary = use_summary ? bm_summary : NULL;
+    bitmap_init(&bm);
+    uint32_t used = BM_BITS / 100 * fill;
+    uint32_t bit_idx;
+    for (bit_idx = 0; bit_idx < used; bit_idx++) {
+        bitmap_set(&bm, bit_idx, 1);
+    }
+    for (bit_idx = 0; holes && used > 0 && bit_idx < used / 64; bit_idx++) {
+        bitmap_set(&bm, bench_rand() % used, 0);
+    }
+}
+
+/* 申请 cnt 个连续位后立即释放, 位图的占用率保持不变 */
+static void bm_alloc_free(uint32_t cnt) {
+    int bit_idx_start = bitmap_scan(&bm, cnt);
+    if (bit_idx_start == -1) {
+        return;
+    }
+    uint32_t i;
+    for (i = 0; i < cnt; i++) {
+        bitmap_set(&bm, bit_idx_start + i, 1);
+    }
+    for (i = 0; i < cnt; i++) {
+        bitmap_set(&bm, bit_idx_start + i, 0);
+    }
+}
+
+/* 在随机起点的 4096 位窗口中查找空闲位, 文件系统按扇区查找位图时就是这种方式 */
+static void bm_scan_window(uint32_t arg) {
+    uint32_t start = bench_rand() % (BM_BITS - 4096);
+    bitmap_scan_from(&bm, start, start + 4096);
+}
+
+/* 逐位找出 [start, end) 中第一段连续 cnt 个空闲位, 用来核对被测函数的结果 */
+static int bm_first_fit(uint32_t start, uint32_t end, uint32_t cnt) {
+    uint32_t run_len = 0;
+    uint32_t bit_idx;
+    for (bit_idx = start; bit_idx < end; bit_idx++) {
+        run_len = bitmap_scan_test(&bm, bit_idx) ? 0 : run_len + 1;
+        if (run_len == cnt) {
+            return bit_idx + 1 - cnt;
+        }
+    }
+    return -1;
+}
+
+/* 计时之后核对一次结果, 查找结果不对时测得的耗时也没有意义 */
+static void bm_check(uint32_t cnt) {
+    ASSERT(bitmap_scan(&bm, cnt) == bm_first_fit(0, BM_BITS, cnt));
+    uint32_t start = bench_rand() % (BM_BITS - 4096);
+    ASSERT(bitmap_scan_from(&bm, start, start + 4096) == bm_first_fit(start, start + 4096, 1));
+}
+
+/* 在各占用率下分别测试无汇总层和有汇总层的位图, pattern 是 bm_fill 的空闲位分布, 用于输出 */
+static void bm_run_fills(uint8_t holes, const char* pattern) {
+    static const uint32_t fills[] = {0, 50, 90, 99};
+    char name[80];
+    uint32_t i;
+    for (i = 0; i < sizeof(fills) / sizeof(fills[0]); i++) {
+        uint8_t use_summary;
+        for (use_summary = 0; use_summary <= 1; use_summary++) {
+            const char* mode = use_summary ? "summary" : "plain";
+            bm_fill(fills[i], use_summary, holes);
+            memset(name, 0, sizeof(name));
+            sprintf(name, "scan 1 bit, %d pct full, %s, %s", fills[i], pattern, mode);
+            bench_run(name, bm_alloc_free, 1, 2000);
+            bm_check(1);
+            memset(name, 0, sizeof(name));
+            sprintf(name, "scan 16 bits, %d pct full, %s, %s", fills[i], pattern, mode);
+            bench_run(name, bm_alloc_free, 16, 2000);
+            bm_check(16);
+            memset(name, 0, sizeof(name));
+            sprintf(name, "scan_from 4096-bit window, %d pct full, %s, %s", fills[i], pattern, mode);
+            bench_run(name, bm_scan_window, 0, 2000);
+        }
+    }
+}
+
+void bench_bitmap(void) {
+    bm_run_fills(true, "holes");
+    bm_run_fills(false, "tail free");
+}
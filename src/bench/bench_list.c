@@ -0,0 +1,40 @@
+#include "bench.h"
+#include "list.h"
+
+#define LIST_ELEMS 64
+
+static struct list blist;
+static struct list_elem elems[LIST_ELEMS];
+
+/* 就绪队列式的操作: 队尾加入, 队首取出 */
+static void run_append_pop(uint32_t arg) {
+    list_append(&blist, &elems[0]);
+    list_pop(&blist);
+}
+
+/* 阻塞队列式的操作: 队首加入, 再从中间摘除 */
+static void run_push_remove(uint32_t arg) {
+    list_push(&blist, &elems[0]);
+    list_remove(&elems[0]);
+}
+
+static void run_elem_find(uint32_t arg) {
+    elem_find(&blist, &elems[arg]);
+}
+
+static void run_list_len(uint32_t arg) {
+    list_len(&blist);
+}
+
+void bench_list(void) {
+    uint32_t i;
+    list_init(&blist);
+    bench_run("append + pop", run_append_pop, 0, 200000);
+    bench_run("push + remove", run_push_remove, 0, 200000);
+
+    for (i = 1; i < LIST_ELEMS; i++) {
+        list_append(&blist, &elems[i]);
+    }
+    bench_run("elem_find last of 63", run_elem_find, LIST_ELEMS - 1, 200000);
+    bench_run("list_len of 63", run_list_len, 0, 200000);
+}
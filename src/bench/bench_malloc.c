@@ -0,0 +1,116 @@
+#include "bench.h"
+#include "arena.h"
+#include "debug.h"
+
+/*
+ * sys_malloc 小内存块路径的基准测试: 直接调用 kernel/arena.c 中的弹匣和 arena 代码,
+ * 页框由下面的 malloc_page 和 mfree_page 从静态数组中提供, 内存池的锁是 bench_rt.c 中的空桩
+ */
+
+#define MALLOC_PG_CNT 128 // 供 arena 申请的页数
+#define CHURN_SLOTS 256   // 随机申请释放时同时存活的内存块数
+#define MALLOC_BATCH 64
+
+static uint8_t malloc_pages[MALLOC_PG_CNT * PG_SIZE] __attribute__((aligned(PG_SIZE)));
+static void* free_pages[MALLOC_PG_CNT];
+static uint32_t free_page_cnt;
+
+static struct mem_block_desc descs[DESC_CNT];
+static struct mem_magazine mags[DESC_CNT];
+static struct lock pool_lock;
+static void* batch[MALLOC_BATCH];
+static void* slots[CHURN_SLOTS];
+
+/* arena 只按页申请, 用空闲页栈代替内存池, 归还的页可以再次分配 */
+void* malloc_page(enum pool_flags pf, uint32_t pg_cnt) {
+    ASSERT(pg_cnt == 1);
+    if (free_page_cnt == 0) {
+        return NULL;
+    }
+    return free_pages[--free_page_cnt];
+}
+
+void mfree_page(enum pool_flags pf, void* _vaddr, uint32_t pg_cnt) {
+    ASSERT(pg_cnt == 1 && free_page_cnt < MALLOC_PG_CNT);
+    free_pages[free_page_cnt++] = _vaddr;
+}
+
+/* 按 sys_malloc 的方式申请 size 字节, 块的头 4 字节记下 tag 供释放时核对 */
+static void* bm_malloc(uint32_t size, uint32_t tag) {
+    uint8_t desc_idx = 0;
+    while (size > descs[desc_idx].block_size) {
+        desc_idx++;
+    }
+    uint32_t* b = magazine_alloc(PF_KERNEL, &pool_lock, &descs[desc_idx], &mags[desc_idx]);
+    ASSERT(b != NULL && b[0] == 0 && b[size / 4 - 1] == 0);
+    b[0] = tag;
+    return b;
+}
+
+/* 按 sys_free 的方式由块大小得出规格后释放 */
+static void bm_free(void* ptr, uint32_t tag) {
+    ASSERT(*(uint32_t*)ptr == tag);
+    struct arena* a = block2arena(ptr);
+    uint8_t desc_idx = 0;
+    while ((16u << desc_idx) < a->desc->block_size) {
+        desc_idx++;
+    }
+    magazine_free(PF_KERNEL, &pool_lock, &mags[desc_idx], ptr);
+}
+
+/* 申请后立即释放同一规格, 只在弹匣中进出 */
+static void run_alloc_free(uint32_t size) {
+    bm_free(bm_malloc(size, size), size);
+}
+
+/* 连续申请一批再全部释放, 弹匣反复空满, 与 arena 成批交换 */
+static void run_batch(uint32_t size) {
+    uint32_t i;
+    for (i = 0; i < MALLOC_BATCH; i++) {
+        batch[i] = bm_malloc(size, i);
+    }
+    for (i = 0; i < MALLOC_BATCH; i++) {
+        bm_free(batch[i], i);
+    }
+}
+
+/* 随机释放一个存活的内存块, 再申请一个随机规格的内存块放回原处, arena 不断新建和归还 */
+static void run_churn(uint32_t arg) {
+    uint32_t slot = bench_rand() % CHURN_SLOTS;
+    if (slots[slot] != NULL) {
+        bm_free(slots[slot], slot);
+    }
+    uint32_t size = 16u << (bench_rand() % DESC_CNT);
+    slots[slot] = bm_malloc(size - bench_rand() % (size / 2), slot);
+}
+
+/* 释放全部存活的内存块并清空弹匣, 所有 arena 都应已归还 */
+static void bm_release_all(void) {
+    uint32_t i;
+    for (i = 0; i < CHURN_SLOTS; i++) {
+        if (slots[i] != NULL) {
+            bm_free(slots[i], i);
+            slots[i] = NULL;
+        }
+    }
+    for (i = 0; i < DESC_CNT; i++) {
+        magazine_drain(PF_KERNEL, &pool_lock, &mags[i]);
+    }
+    ASSERT(free_page_cnt == MALLOC_PG_CNT);
+}
+
+void bench_malloc(void) {
+    uint32_t i;
+    for (i = 0; i < MALLOC_PG_CNT; i++) {
+        free_pages[free_page_cnt++] = malloc_pages + i * PG_SIZE;
+    }
+    block_desc_init(descs);
+
+    bench_run("alloc + free 32", run_alloc_free, 32, 200000);
+    bench_run("alloc + free 512", run_alloc_free, 512, 200000);
+    bench_run("batch of 64, 32", run_batch, 32, 5000);
+    bench_run("batch of 64, 256", run_batch, 256, 5000);
+    bm_release_all();
+    bench_run("churn, 256 live blocks of 9..1024 bytes", run_churn, 0, 200000);
+    bm_release_all();
+}
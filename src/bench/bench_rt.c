@@ -0,0 +1,133 @@
+#include "bench.h"
+#include "stdio.h"
+#include "syscall.h"
+#include "interrupt.h"
+#include "debug.h"
+#include "assert.h"
+#include "memory.h"
+#include "stdio-kernel.h"
+#include "string.h"
+#include "sync.h"
+
+/*
+ * 基准测试的运行时: 在 32 位 Linux 用户态下直接以 int 0x80 发起系统调用,
+ * 不依赖主机 C 库, 并替内核库代码提供中断、断言等桩函数
+ */
+
+#define LINUX_SYS_EXIT           1
+#define LINUX_SYS_WRITE          4
+#define LINUX_SYS_CLOCK_GETTIME  265
+#define LINUX_CLOCK_MONOTONIC    1
+#define NSEC_PER_SEC             1000000000u
+#define BENCH_PG_CNT             64 // 供 slab 申请的页数
+
+struct linux_timespec {
+    int32_t tv_sec;
+    int32_t tv_nsec;
+};
+
+static int32_t linux_syscall3(uint32_t nr, uint32_t arg1, uint32_t arg2, uint32_t arg3) {
+    int32_t retval;
+    asm volatile ("int $0x80" : "=a" (retval) : "a" (nr), "b" (arg1), "c" (arg2), "d" (arg3) : "memory");
+    return retval;
+}
+
+// lib/stdio.c 中的 printf 经由 write 输出, 这里将其接到 Linux 的 write 上
+uint32_t write(int32_t fd, const void* buf, uint32_t count) {
+    return linux_syscall3(LINUX_SYS_WRITE, fd, (uint32_t)buf, count);
+}
+
+void bench_exit(int32_t code) {
+    linux_syscall3(LINUX_SYS_EXIT, code, 0, 0);
+    while (1);
+}
+
+static void bench_clock(struct linux_timespec* ts) {
+    linux_syscall3(LINUX_SYS_CLOCK_GETTIME, LINUX_CLOCK_MONOTONIC, (uint32_t)ts, 0);
+}
+
+/* 线性同余伪随机数, 固定种子使每次运行的数据相同 */
+uint32_t bench_rand(void) {
+    static uint32_t seed = 20240601;
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+/* 运行 iters 次 fn(arg), 输出每次操作的平均纳秒数
+ * 没有 64 位除法可用, 所以把耗时拆成秒和纳秒两部分分别除以 iters */
+void bench_run(const char* name, bench_fn fn, uint32_t arg, uint32_t iters) {
+    struct linux_timespec start, end;
+    uint32_t i;
+    bench_clock(&start);
+    for (i = 0; i < iters; i++) {
+        fn(arg);
+    }
+    bench_clock(&end);
+
+    uint32_t sec = end.tv_sec - start.tv_sec;
+    int32_t nsec = end.tv_nsec - start.tv_nsec;
+    if (nsec < 0) {
+        sec--;
+        nsec += NSEC_PER_SEC;
+    }
+    uint32_t ns_per_op = sec * (NSEC_PER_SEC / iters) + (sec * (NSEC_PER_SEC % iters) + nsec) / iters;
+    printf("  %s: %d ns/op\n", name, ns_per_op);
+}
+
+/* slab 从这里申请页, 只分配不回收, 与内核中一样返回清零的整页 */
+static uint8_t bench_pages[BENCH_PG_CNT * PG_SIZE] __attribute__((aligned(PG_SIZE)));
+static uint32_t bench_pages_used;
+
+void* get_kernel_pages(uint32_t pg_cnt) {
+    if (bench_pages_used + pg_cnt > BENCH_PG_CNT) {
+        return NULL;
+    }
+    void* vaddr = bench_pages + bench_pages_used * PG_SIZE;
+    bench_pages_used += pg_cnt;
+    return vaddr;
+}
+
+void printk(const char* format, ...) {
+    va_list args = (va_list)&format;
+    char buf[1024];
+    memset(buf, 0, sizeof(buf));
+    vsprintf(buf, format, args);
+    write(1, buf, strlen(buf));
+}
+
+/* 内核库代码依赖的桩函数, 基准测试是单线程的, 开关中断无事可做 */
+enum intr_status intr_disable(void) {
+    return INTR_ON;
+}
+
+enum intr_status intr_enable(void) {
+    return INTR_ON;
+}
+
+enum intr_status intr_set_status(enum intr_status status) {
+    return status;
+}
+
+enum intr_status intr_get_status(void) {
+    return INTR_ON;
+}
+
+/* 内存池的锁, 单线程下同样无事可做 */
+void lock_acquire(struct lock* plock) {
+}
+
+void lock_release(struct lock* plock) {
+}
+
+void panic_spin(char* filename, int line, const char* func, const char* condition) {
+    printf("\nPANIC %s:%d %s(): %s\n", filename, line, func, condition);
+    bench_exit(1);
+}
+
+void user_spin(char* filename, int line, const char* func, const char* condition) {
+    panic_spin(filename, line, func, condition);
+}
+
+void _start(void) {
+    bench_exit(bench_main());
+}
@@ -0,0 +1,38 @@
+#include "bench.h"
+#include "slab.h"
+#include "fs.h"
+
+#define SLAB_BATCH 64
+
+static struct slab_cache sector_cache;
+static struct slab_cache small_cache;
+static void* objs[SLAB_BATCH];
+
+/* 单个对象的申请和释放, 文件系统读写一个扇区时就是这种方式 */
+static void run_alloc_free(uint32_t arg) {
+    struct slab_cache* cache = (struct slab_cache*)arg;
+    slab_free(cache, slab_alloc(cache));
+}
+
+/* 连续申请一批对象再全部释放, 对应打开再关闭一批 inode */
+static void run_batch(uint32_t arg) {
+    struct slab_cache* cache = (struct slab_cache*)arg;
+    uint32_t i;
+    for (i = 0; i < SLAB_BATCH; i++) {
+        objs[i] = slab_alloc(cache);
+    }
+    for (i = 0; i < SLAB_BATCH; i++) {
+        slab_free(cache, objs[i]);
+    }
+}
+
+void bench_slab(void) {
+    slab_init();
+    slab_cache_init(&sector_cache, "sector_buf", SECTOR_SIZE, NULL);
+    slab_cache_init(&small_cache, "small", 96, NULL);
+    bench_run("alloc + free 512", run_alloc_free, (uint32_t)&sector_cache, 200000);
+    bench_run("alloc + free 96", run_alloc_free, (uint32_t)&small_cache, 200000);
+    bench_run("batch of 64, 512", run_batch, (uint32_t)&sector_cache, 5000);
+    bench_run("batch of 64, 96", run_batch, (uint32_t)&small_cache, 5000);
+    slab_stats_print();
+}
@@ -0,0 +1,125 @@
+#include "bench.h"
+#include "string.h"
+#include "stdio.h"
+#include "debug.h"
+#include "global.h"
+
+#define DST_FILL 0xa5 // 计时前 dst_buf 的填充值
+
+static uint8_t src_buf[4096 + 8] __attribute__((aligned(4)));
+static uint8_t dst_buf[4096 + 8] __attribute__((aligned(4)));
+static char str_buf[1024 + 4] __attribute__((aligned(4)));
+
+/* 逐字节实现的对照组, 与优化前的 lib/string.c 相同 */
+static void byte_memcpy(void* dst_, const void* src_, uint32_t size) {
+    uint8_t* dst = dst_;
+    const uint8_t* src = src_;
+    while (size-- > 0) {
+        *dst++ = *src++;
+    }
+}
+
+static void byte_memset(void* dst_, uint8_t value, uint32_t size) {
+    uint8_t* dst = dst_;
+    while (size-- > 0) {
+        *dst++ = value;
+    }
+}
+
+static uint32_t byte_strlen(const char* str) {
+    const char* p = str;
+    while (*p++);
+    return (p - str - 1);
+}
+
+/* 计时之后核对一次结果: dst 的 size 字节与 src 相同, 前后各一个字节保持 fill 不变.
+ * dst_buf 在每次计时前填成 fill, 用来发现越界的写 */
+static void check_copy(const uint8_t* dst, const uint8_t* src, uint32_t size, uint8_t fill) {
+    uint32_t i;
+    for (i = 0; i < size; i++) {
+        ASSERT(dst[i] == (src == NULL ? 0 : src[i]));
+    }
+    ASSERT(dst[size] == fill && (dst == dst_buf || dst[-1] == fill));
+}
+
+static void run_memcpy(uint32_t size) {
+    memcpy(dst_buf, src_buf, size);
+}
+
+static void run_byte_memcpy(uint32_t size) {
+    byte_memcpy(dst_buf, src_buf, size);
+}
+
+/* 源和目的都不按 4 字节对齐, 覆盖头尾的逐字节处理 */
+static void run_memcpy_unaligned(uint32_t size) {
+    memcpy(dst_buf + 1, src_buf + 3, size);
+}
+
+static void run_memset(uint32_t size) {
+    memset(dst_buf, 0, size);
+}
+
+static void run_byte_memset(uint32_t size) {
+    byte_memset(dst_buf, 0, size);
+}
+
+static void run_memcmp(uint32_t size) {
+    memcmp(dst_buf, src_buf, size);
+}
+
+static void run_strlen(uint32_t len) {
+    strlen(str_buf + 1);
+}
+
+static void run_byte_strlen(uint32_t len) {
+    byte_strlen(str_buf + 1);
+}
+
+void bench_string(void) {
+    static const uint32_t sizes[] = {16, 64, 512, 4096};
+    char name[64];
+    uint32_t i;
+    for (i = 0; i < sizeof(src_buf); i++) {
+        src_buf[i] = bench_rand();
+    }
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        // 短操作只有十几纳秒, 多跑几轮才能盖过计时的抖动
+        uint32_t iters = sizes[i] <= 64 ? 200000 : 20000;
+        memset(name, 0, sizeof(name));
+        sprintf(name, "memcpy %d", sizes[i]);
+        byte_memset(dst_buf, DST_FILL, sizeof(dst_buf));
+        bench_run(name, run_memcpy, sizes[i], iters);
+        check_copy(dst_buf, src_buf, sizes[i], DST_FILL);
+        memset(name, 0, sizeof(name));
+        sprintf(name, "memcpy %d unaligned", sizes[i]);
+        byte_memset(dst_buf, DST_FILL, sizeof(dst_buf));
+        bench_run(name, run_memcpy_unaligned, sizes[i], iters);
+        check_copy(dst_buf + 1, src_buf + 3, sizes[i], DST_FILL);
+        memset(name, 0, sizeof(name));
+        sprintf(name, "byte loop memcpy %d", sizes[i]);
+        bench_run(name, run_byte_memcpy, sizes[i], iters);
+        memset(name, 0, sizeof(name));
+        sprintf(name, "memset %d", sizes[i]);
+        byte_memset(dst_buf, DST_FILL, sizeof(dst_buf));
+        bench_run(name, run_memset, sizes[i], iters);
+        check_copy(dst_buf, NULL, sizes[i], DST_FILL);
+        memset(name, 0, sizeof(name));
+        sprintf(name, "byte loop memset %d", sizes[i]);
+        bench_run(name, run_byte_memset, sizes[i], iters);
+    }
+
+    // 两个缓冲区内容相同, memcmp 要比较完整个长度
+    memcpy(dst_buf, src_buf, 4096);
+    bench_run("memcmp 512 equal", run_memcmp, 512, 20000);
+    bench_run("memcmp 4096 equal", run_memcmp, 4096, 20000);
+    ASSERT(memcmp(dst_buf, src_buf, 4096) == 0);
+    dst_buf[4095] ^= 1;
+    ASSERT(memcmp(dst_buf, src_buf, 4096) != 0);
+    dst_buf[4095] ^= 1;
+
+    memset(str_buf, 'a', 1024);
+    str_buf[1024] = 0;
+    bench_run("strlen 1023", run_strlen, 1023, 20000);
+    ASSERT(strlen(str_buf + 1) == 1023);
+    bench_run("byte loop strlen 1023", run_byte_strlen, 1023, 20000);
+}
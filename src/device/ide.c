@@ -10,6 +10,9 @@
 #include "timer.h"
 #include "string.h"
 #include "list.h"
+#include "pci.h"
+#include "thread.h"
+#include "process.h"
 
 // 定义硬盘各寄存器的端口号
 #define reg_data(channel)	 (channel->port_base + 0)
@@ -24,10 +27,23 @@
 #define reg_alt_status(channel)  (channel->port_base + 0x206)
 #define reg_ctl(channel)	 reg_alt_status(channel)
 
+// 总线主控(bus master)各寄存器的端口号
+#define reg_bm_cmd(channel)	 (channel->bm_base + 0)
+#define reg_bm_status(channel)	 (channel->bm_base + 2)
+#define reg_bm_prdt(channel)	 (channel->bm_base + 4)
+
 // reg_alt_status寄存器的一些关键位
 #define BIT_STAT_BSY	 0x80	      // 硬盘忙
 #define BIT_STAT_DRDY	 0x40	      // 驱动器准备好	 
 #define BIT_STAT_DRQ	 0x8	      // 数据传输准备好了
+#define BIT_STAT_ERR	 0x1	      // 上一条命令出错
+
+// 总线主控命令寄存器和状态寄存器的一些关键位
+#define BIT_BM_START	 0x1	      // 启动 DMA 传输
+#define BIT_BM_READ	 0x8	      // 传输方向为从硬盘到内存
+#define BIT_BM_ACTIVE	 0x1	      // DMA 传输进行中
+#define BIT_BM_ERR	 0x2	      // DMA 传输出错, 写 1 清 0
+#define BIT_BM_INTR	 0x4	      // 硬盘已发出中断, 写 1 清 0
 
 // device寄存器的一些关键位
 #define BIT_DEV_MBS	0xa0	    // 第7位和第5位固定为1
@@ -38,10 +54,15 @@
 #define CMD_IDENTIFY	   0xec	    // identify指令
 #define CMD_READ_SECTOR	   0x20     // 读扇区指令
 #define CMD_WRITE_SECTOR   0x30	    // 写扇区指令
+#define CMD_READ_DMA	   0xc8	    // 以 DMA 方式读扇区指令
+#define CMD_WRITE_DMA	   0xca	    // 以 DMA 方式写扇区指令
 
 // 定义可读写的最大扇区数,调试用的
 #define max_lba ((80*1024*1024/512) - 1)	// 只支持80MB硬盘
 
+// 请求等待超过此 ticks 数(约 0.5 秒)后优先处理, 防止被电梯算法饿死
+#define BIO_DEADLINE_TICKS 50
+
 uint8_t channel_cnt;	   // 按硬盘数计算的通道数
 struct ide_channel channels[2];	 // 有两个ide通道
 
@@ -69,6 +90,16 @@ struct partition_table_entry {
     uint32_t sec_cnt;		 // 本分区的扇区数目
 } __attribute__ ((packed)); // 保证此结构是 16 字节大小
 
+// 物理区域描述符, 描述一块物理地址连续且不跨越 64KB 边界的内存
+struct prd {
+    uint32_t phy_addr;	 // 内存块的物理地址
+    uint16_t byte_cnt;	 // 内存块的字节数, 0 表示 64KB
+    uint16_t flags;	 // 最高位为 1 表示是 PRD 表中的最后一项
+} __attribute__ ((packed));
+
+#define PRD_EOT	 0x8000
+#define PRD_MAX	 (PG_SIZE / sizeof(struct prd)) // PRD 表占一页
+
 // 引导扇区, mbr 或 ebr 所在的扇区
 struct boot_sector {
     uint8_t other[446]; // 引导代码
@@ -143,52 +174,313 @@ static bool busy_wait(struct disk* hd) {
     return false;
 }
 
+// PRD 表项 prd 所描述的字节数
+static uint32_t prd_len(struct prd* prd) {
+    return prd->byte_cnt == 0 ? 0x10000 : prd->byte_cnt;
+}
 
-// 从硬盘读取 sec_cnt 个扇区到 buf
-void ide_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
-    ASSERT(lba <= max_lba);
-    ASSERT(sec_cnt > 0);
-    lock_acquire(&hd->my_channel->lock);
-
-    // 1. 先选择操作的硬盘
-    select_disk(hd);
+// 将从 buf 开始的 byte_cnt 字节按物理页拆分后追加到 channel 的 PRD 表中,
+// 表中已有 prd_cnt 项, 物理地址相连的页合并为一项, 返回追加后的项数
+static uint32_t prdt_fill(struct ide_channel* channel, uint32_t prd_cnt, void* buf, uint32_t byte_cnt) {
+    struct prd* prdt = channel->prdt;
+    uint32_t vaddr = (uint32_t)buf;
+    while (byte_cnt > 0) {
+        uint32_t phy_addr = addr_v2p(vaddr);
+        uint32_t chunk = PG_SIZE - (vaddr & 0x00000fff); // 到本页结束的字节数
+        if (chunk > byte_cnt) {
+            chunk = byte_cnt;
+        }
 
-    uint32_t secs_op; // 每次操作的扇区数
-    uint32_t secs_done = 0; // 已完成的扇区数
-    while (secs_done < sec_cnt) {
-        if ((secs_done + 256) <= sec_cnt) {
-            secs_op = 256;
+        struct prd* last = &prdt[prd_cnt == 0 ? 0 : prd_cnt - 1];
+        // 与上一项物理地址相连, 合并后又不跨越 64KB 边界, 就并入上一项
+        if (prd_cnt > 0 && last->phy_addr + prd_len(last) == phy_addr && \
+            (last->phy_addr >> 16) == ((phy_addr + chunk - 1) >> 16)) {
+            last->byte_cnt += chunk; // 恰好凑满 64KB 时回绕为 0, 正是硬件的约定
         } else {
-            secs_op = sec_cnt - secs_done;
+            ASSERT(prd_cnt < PRD_MAX);
+            prdt[prd_cnt].phy_addr = phy_addr;
+            prdt[prd_cnt].byte_cnt = chunk;
+            prdt[prd_cnt].flags = 0;
+            prd_cnt++;
         }
-        // 2. 写入待读入的扇区数和起始扇区号
-        select_sector(hd, lba+secs_done, secs_op);
-        // 3. 执行的命令写入 reg_cmd 寄存器
+        vaddr += chunk;
+        byte_cnt -= chunk;
+    }
+    return prd_cnt;
+}
+
+// 以 DMA 方式完成合并链 bio 的读写, 数据由控制器直接在各请求的缓冲区
+// 与硬盘间搬运, 传输期间 cpu 可以去运行其它线程
+static void dma_transfer(struct bio* bio) {
+    struct disk* hd = bio->hd;
+    struct ide_channel* channel = hd->my_channel;
+    uint8_t bm_dir = bio->is_write ? 0 : BIT_BM_READ;
+
+    // 1. 依次将合并链中各请求的缓冲区填入 PRD 表, 并将表的物理地址告知总线主控
+    uint32_t prd_cnt = 0;
+    struct bio* cur = bio;
+    while (cur != NULL) {
+        prd_cnt = prdt_fill(channel, prd_cnt, cur->buf, cur->sec_cnt * 512);
+        cur = cur->merge_next;
+    }
+    channel->prdt[prd_cnt - 1].flags = PRD_EOT;
+    outl(reg_bm_prdt(channel), addr_v2p((uint32_t)channel->prdt));
+    // 2. 设置传输方向, 并清除上一次残留的中断和出错标志
+    outb(reg_bm_cmd(channel), bm_dir);
+    outb(reg_bm_status(channel), inb(reg_bm_status(channel)) | BIT_BM_INTR | BIT_BM_ERR);
+    // 3. 写入扇区数和起始扇区号, 发出命令后启动总线主控
+    select_sector(hd, bio->lba, bio->merge_sec_cnt);
+    channel->dma_busy = true;
+    cmd_out(channel, bio->is_write ? CMD_WRITE_DMA : CMD_READ_DMA);
+    outb(reg_bm_cmd(channel), bm_dir | BIT_BM_START);
+    // 4. 阻塞自己, 传输结束后由硬盘中断唤醒
+    sema_down(&channel->disk_done);
+    channel->dma_busy = false;
+    // 5. 检查传输结果
+    if ((channel->bm_status & BIT_BM_ERR) || \
+        (inb(reg_status(channel)) & (BIT_STAT_BSY | BIT_STAT_ERR))) {
+        char error[64];
+        sprintf(error, "%s dma %s sector %d failed!!!!!\n", hd->name, bio->is_write ? "write" : "read", bio->lba);
+        PANIC(error);
+    }
+}
+
+// 以 PIO 方式完成合并链 bio 的读写, 一条命令读写整条链的扇区,
+// 数据按顺序分别搬运到各请求的缓冲区
+static void pio_transfer(struct bio* bio) {
+    struct disk* hd = bio->hd;
+    struct bio* cur;
+
+    // 1. 写入待读写的扇区数和起始扇区号
+    select_sector(hd, bio->lba, bio->merge_sec_cnt);
+    if (!bio->is_write) {
+        // 2. 执行的命令写入 reg_cmd 寄存器
         cmd_out(hd->my_channel, CMD_READ_SECTOR); // 准备开始读数据
         // 阻塞自己
         sema_down(&hd->my_channel->disk_done);
-        // 4. 检测硬盘状态是否可读
+        // 3. 检测硬盘状态是否可读
         if (!busy_wait(hd)) { // 若失败
             char error[64];
-            sprintf(error, "%s read sector %d failed!!!!!\n", hd->name, lba);
+            sprintf(error, "%s read sector %d failed!!!!!\n", hd->name, bio->lba);
             PANIC(error);
         }
-        // 5. 把数据从硬盘的缓冲区中读出
-        read_from_sector(hd, (void*)((uint32_t)buf+secs_done*512), secs_op);
-        secs_done += secs_op;
+        // 4. 把数据从硬盘的缓冲区中读出
+        for (cur = bio; cur != NULL; cur = cur->merge_next) {
+            read_from_sector(hd, cur->buf, cur->sec_cnt);
+        }
+    } else {
+        // 2. 执行的命令写入 reg_cmd 寄存器
+        cmd_out(hd->my_channel, CMD_WRITE_SECTOR);
+        // 3. 检测硬盘状态是否可写
+        if (!busy_wait(hd)) { // 若失败
+            char error[64];
+            sprintf(error, "%s write sector %d failed!!!!!\n", hd->name, bio->lba);
+            PANIC(error);
+        }
+        // 4. 将数据写入硬盘
+        for (cur = bio; cur != NULL; cur = cur->merge_next) {
+            write2sector(hd, cur->buf, cur->sec_cnt);
+        }
+        // 在硬盘响应期间阻塞自己
+        sema_down(&hd->my_channel->disk_done);
     }
-    lock_release(&hd->my_channel->lock);
 }
 
-// 将 buf 中 sec_cnt 扇区数据写入硬盘
-void ide_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
-    ASSERT(lba <= max_lba);
-    ASSERT(sec_cnt > 0);
-    lock_acquire(&hd->my_channel->lock);
+// 初始化请求 bio
+void bio_init(struct bio* bio, struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt, bool is_write) {
+    bio->hd = hd;
+    bio->lba = lba;
+    bio->sec_cnt = sec_cnt;
+    bio->buf = buf;
+    bio->is_write = is_write;
+    bio->pgdir = NULL;
+    bio->submit_ticks = 0;
+    bio->done = false;
+    sema_init(&bio->finish, 0);
+    bio->end_io = NULL;
+    bio->private_data = NULL;
+    bio->merge_next = NULL;
+    bio->merge_sec_cnt = sec_cnt;
+}
 
-    // 1. 先选择操作的硬盘
-    select_disk(hd);
+// 合并链 bio 的最后一个请求
+static struct bio* bio_chain_tail(struct bio* bio) {
+    while (bio->merge_next != NULL) {
+        bio = bio->merge_next;
+    }
+    return bio;
+}
 
+// 合并链 bio 中各请求的缓冲区是否都按字对齐, DMA 要求 PRD 中的地址为偶数
+static bool bio_chain_aligned(struct bio* bio) {
+    while (bio != NULL) {
+        if ((uint32_t)bio->buf & 0x1) {
+            return false;
+        }
+        bio = bio->merge_next;
+    }
+    return true;
+}
+
+// 两个请求的缓冲区能否在同一个地址空间中访问, 内核缓冲区在所有进程中都可见
+static bool pgdir_compatible(uint32_t* a, uint32_t* b) {
+    return a == NULL || b == NULL || a == b;
+}
+
+// 尝试将新请求 bio 与队列中扇区相邻的请求合并为一次传输, 成功返回 true
+static bool bio_merge(struct disk* hd, struct bio* bio) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    struct list_elem* elem = hd->bio_queue.head.next;
+    while (elem != &hd->bio_queue.tail) {
+        struct bio* queued = elem2entry(struct bio, queue_tag, elem);
+        if (queued->is_write != bio->is_write || \
+            !pgdir_compatible(queued->pgdir, bio->pgdir) || \
+            queued->merge_sec_cnt + bio->sec_cnt > 256) {
+            elem = elem->next;
+            continue;
+        }
+        if (queued->lba + queued->merge_sec_cnt == bio->lba) { // 向后合并, 接到链尾
+            bio_chain_tail(queued)->merge_next = bio;
+            queued->merge_sec_cnt += bio->sec_cnt;
+            if (queued->pgdir == NULL) {
+                queued->pgdir = bio->pgdir;
+            }
+            return true;
+        }
+        if (bio->lba + bio->sec_cnt == queued->lba) { // 向前合并, 成为新的链首
+            bio->merge_next = queued;
+            bio->merge_sec_cnt = bio->sec_cnt + queued->merge_sec_cnt;
+            if (bio->pgdir == NULL) {
+                bio->pgdir = queued->pgdir;
+            }
+            bio->submit_ticks = queued->submit_ticks; // 沿用原链首的期限
+            list_insert_before(&queued->queue_tag, &bio->queue_tag);
+            list_remove(&queued->queue_tag);
+            return true;
+        }
+        elem = elem->next;
+    }
+    return false;
+}
+
+// 提交请求 bio, 立即返回, 请求完成后唤醒 bio_wait 的等待者或回调 end_io
+void bio_submit(struct bio* bio) {
+    ASSERT(bio->sec_cnt > 0 && bio->sec_cnt <= 256);
+    ASSERT(bio->lba + bio->sec_cnt - 1 <= max_lba);
+    struct disk* hd = bio->hd;
+    struct ide_channel* channel = hd->my_channel;
+    // 只有用户缓冲区才需要借用提交者的页表. 预读等内核缓冲区的请求不等待完成,
+    // 提交者可能先于请求退出, 记下它的页目录表会让工作线程切换到已回收的页表上
+    bio->pgdir = (uint32_t)bio->buf < 0xc0000000 ? running_thread()->pgdir : NULL;
+    bio->submit_ticks = ticks;
+
+    enum intr_status old_status = intr_disable();
+    if (!bio_merge(hd, bio)) {
+        list_append(&hd->bio_queue, &bio->queue_tag);
+    }
+    if (channel->worker_idle) {
+        channel->worker_idle = false;
+        thread_unblock(channel->worker);
+    }
+    intr_set_status(old_status);
+}
+
+// 等待请求 bio 完成, 带 end_io 的请求须由回调 sema_up(&bio->finish)
+void bio_wait(struct bio* bio) {
+    sema_down(&bio->finish);
+}
+
+// 按 C-LOOK 算法从硬盘 hd 的队列中选出下一个请求:
+// 若有请求等待超过期限就先处理最老的, 否则选 head_lba 之后最近的,
+// 之后没有请求时回绕到最小的 lba
+static struct bio* elevator_pick(struct disk* hd) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    if (list_empty(&hd->bio_queue)) {
+        return NULL;
+    }
+    // 队首是最早提交的请求
+    struct bio* oldest = elem2entry(struct bio, queue_tag, hd->bio_queue.head.next);
+    if (ticks - oldest->submit_ticks >= BIO_DEADLINE_TICKS) {
+        return oldest;
+    }
+
+    struct bio* ahead = NULL;  // head_lba 之后最近的请求
+    struct bio* lowest = NULL; // lba 最小的请求
+    struct list_elem* elem = hd->bio_queue.head.next;
+    while (elem != &hd->bio_queue.tail) {
+        struct bio* bio = elem2entry(struct bio, queue_tag, elem);
+        if (bio->lba >= hd->head_lba && (ahead == NULL || bio->lba < ahead->lba)) {
+            ahead = bio;
+        }
+        if (lowest == NULL || bio->lba < lowest->lba) {
+            lowest = bio;
+        }
+        elem = elem->next;
+    }
+    return ahead != NULL ? ahead : lowest;
+}
+
+// 从通道 channel 上的两块硬盘中轮流取出下一个要处理的请求, 没有请求时返回 NULL
+static struct bio* elevator_next(struct ide_channel* channel) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    uint8_t try_cnt = 0;
+    while (try_cnt++ < 2) {
+        struct disk* hd = &channel->devices[channel->next_dev];
+        channel->next_dev ^= 1;
+        struct bio* bio = elevator_pick(hd);
+        if (bio != NULL) {
+            list_remove(&bio->queue_tag);
+            hd->head_lba = bio->lba + bio->merge_sec_cnt;
+            return bio;
+        }
+    }
+    return NULL;
+}
+
+// 通道的工作线程, 不断从请求队列中取出请求并交给硬盘处理
+static void ide_worker(void* arg) {
+    struct ide_channel* channel = arg;
+    struct task_struct* cur = running_thread();
+    while (1) {
+        enum intr_status old_status = intr_disable();
+        struct bio* bio = elevator_next(channel);
+        while (bio == NULL) {
+            channel->worker_idle = true;
+            thread_block(TASK_BLOCKED);
+            bio = elevator_next(channel);
+        }
+        intr_set_status(old_status);
+
+        // 缓冲区可能在用户进程中, 借用该进程的页表才能访问
+        cur->pgdir = bio->pgdir;
+        page_dir_activate(cur);
+        if (bio->hd->dma && bio_chain_aligned(bio)) {
+            dma_transfer(bio);
+        } else {
+            pio_transfer(bio);
+        }
+        cur->pgdir = NULL;
+        page_dir_activate(cur);
+
+        // 逐个通知合并链上的请求已完成, 回调中可能释放 bio, 故先取出后继
+        while (bio != NULL) {
+            struct bio* next = bio->merge_next;
+            bio->done = true;
+            if (bio->end_io != NULL) {
+                bio->end_io(bio);
+            } else {
+                sema_up(&bio->finish);
+            }
+            bio = next;
+        }
+    }
+}
+
+// 以请求的方式读写硬盘, 每个请求最多 256 个扇区, 同步等待其完成
+static void ide_rw(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt, bool is_write) {
+    ASSERT(lba <= max_lba);
+    ASSERT(sec_cnt > 0);
+    struct bio bio;
     uint32_t secs_op; // 每次操作的扇区数
     uint32_t secs_done = 0; // 已完成的扇区数
     while (secs_done < sec_cnt) {
@@ -197,26 +489,22 @@ void ide_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
         } else {
             secs_op = sec_cnt - secs_done;
         }
-        // 2. 写入待写入的扇区数和起始扇区号
-        select_sector(hd, lba+secs_done, secs_op);
-        // 3. 执行的命令写入 reg_cmd 寄存器
-        cmd_out(hd->my_channel, CMD_WRITE_SECTOR);
-        // 4. 检测硬盘状态是否可读
-        if (!busy_wait(hd)) { // 若失败
-            char error[64];
-            sprintf(error, "%s write sector %d failed!!!!!\n", hd->name, lba);
-            PANIC(error);
-        }
-        // 5. 将数据写入硬盘
-        write2sector(hd, (void*)((uint32_t)buf+secs_done*512), secs_op);
-        // 在硬盘响应期间阻塞自己
-        sema_down(&hd->my_channel->disk_done);
+        bio_init(&bio, hd, lba + secs_done, (void*)((uint32_t)buf + secs_done * 512), secs_op, is_write);
+        bio_submit(&bio);
+        bio_wait(&bio);
         secs_done += secs_op;
-    } 
-    // 醒来后开始释放锁
-    lock_release(&hd->my_channel->lock);
+    }
 }
 
+// 从硬盘读取 sec_cnt 个扇区到 buf
+void ide_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    ide_rw(hd, lba, buf, sec_cnt, false);
+}
+
+// 将 buf 中 sec_cnt 扇区数据写入硬盘
+void ide_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    ide_rw(hd, lba, buf, sec_cnt, true);
+}
 
 // 将 dst 中 len 个相邻字节交换位置后存入 buf
 static void swap_pairs_bytes(const char* dst, char* buf, uint32_t len) {
@@ -255,6 +543,11 @@ static void identify_disk(struct disk* hd) {
     uint32_t sectors = *(uint32_t*)&id_info[60 * 2];
     printk("    SECTORS: %d\n", sectors);
     printk("    CAPACITY: %dMB\n", sectors*512/1024/1024);
+
+    // 第 49 字的第 8 位表示硬盘是否支持 DMA
+    uint16_t capabilities = *(uint16_t*)&id_info[49 * 2];
+    hd->dma = (hd->my_channel->bm_base != 0) && (capabilities & 0x100);
+    printk("    DMA: %s\n", hd->dma ? "yes" : "no");
 }
 
 
@@ -317,6 +610,12 @@ void intr_hd_handler(uint8_t irq_no) {
     ASSERT(channel->irq_no == irq_no);
     if (channel->expecting_intr) {
         channel->expecting_intr = false;
+        if (channel->dma_busy) {
+            // 停止总线主控, 保存其状态后清除中断和出错标志
+            channel->bm_status = inb(reg_bm_status(channel));
+            outb(reg_bm_cmd(channel), 0);
+            outb(reg_bm_status(channel), channel->bm_status | BIT_BM_INTR | BIT_BM_ERR);
+        }
         sema_up(&channel->disk_done);
         inb(reg_status(channel));
     }
@@ -334,6 +633,19 @@ void ide_init() {
     struct ide_channel* channel;
     uint8_t channel_no = 0, dev_no = 0;
 
+    // 在 pci 总线上查找 ide 控制器(类代码 0x01, 子类 0x01), BAR4 是总线主控寄存器的起始端口
+    struct pci_device ide_pci;
+    uint16_t bm_base = 0;
+    if (pci_find_class(0x01, 0x01, &ide_pci)) {
+        uint32_t bar4 = pci_config_read(&ide_pci, PCI_REG_BAR4);
+        if (bar4 & 0x1) { // 最低位为 1 表示是 io 端口
+            bm_base = bar4 & 0xfffc;
+            // 允许控制器响应 io 访问并充当总线主控
+            uint32_t command = pci_config_read(&ide_pci, PCI_REG_COMMAND);
+            pci_config_write(&ide_pci, PCI_REG_COMMAND, command | PCI_CMD_IO | PCI_CMD_BUS_MASTER);
+        }
+    }
+
     // 处理每个通道上的硬盘
     while (channel_no < channel_cnt) {
         channel = &channels[channel_no];
@@ -352,7 +664,24 @@ void ide_init() {
         }
 
         channel->expecting_intr = false; // 未向硬盘写入指令时不期待硬盘的中断
-        lock_init(&channel->lock);
+
+        // 第二个通道的总线主控寄存器在第一个之后 8 个端口处
+        channel->bm_base = bm_base == 0 ? 0 : bm_base + channel_no * 8;
+        channel->dma_busy = false;
+        channel->prdt = NULL;
+        if (channel->bm_base != 0) {
+            channel->prdt = get_kernel_pages(1);
+            if (channel->prdt == NULL) { // 申请不到内存就退回 PIO 方式
+                channel->bm_base = 0;
+            }
+        }
+        channel->next_dev = 0;
+        list_init(&channel->devices[0].bio_queue);
+        list_init(&channel->devices[1].bio_queue);
+        channel->devices[0].head_lba = channel->devices[1].head_lba = 0;
+        // 工作线程创建后立即因无请求而阻塞, 下面扫描分区时的读请求由它处理
+        channel->worker_idle = false;
+        channel->worker = thread_start(channel->name, 31, ide_worker, channel);
 
         sema_init(&channel->disk_done, 0);
 
@@ -4,6 +4,13 @@
 #include "sync.h"
 #include "bitmap.h"
 
+// 硬盘上的位图, 不整体读入内存, 各扇区按需经扇区缓存读写
+struct disk_bitmap {
+    uint32_t bits_lba;          // 位图的起始扇区
+    uint32_t sects;             // 位图占用的扇区数
+    uint32_t summary_lba;       // 汇总表的起始扇区, 每个位图扇区在其中占 2 字节, 记录该扇区的空闲位数
+};
+
 // 分区结构
 struct partition {
     uint32_t start_lba;         // 起始扇区
@@ -12,9 +19,29 @@ struct partition {
     struct list_elem part_tag;  // 用于队列中的标记
     char name[8];               // 分区名称
     struct super_block* sb;     // 本分区的超级块
-    struct bitmap block_bitmap; // 块位图
-    struct bitmap inode_bitmap; // inode 位图
-    struct list open_inodes;    // 本分区打开的 i 结点队列
+    struct disk_bitmap block_bitmap; // 块位图
+    struct disk_bitmap inode_bitmap; // inode 位图
+    uint32_t block_cursor;      // 下次分配块时从块位图的这一位开始查找
+    uint32_t inode_cursor;      // 下次分配 inode 时从 inode 位图的这一位开始查找
+    struct lock alloc_lock;     // 位图的查找与置位、汇总表的读改写都经过可能阻塞的扇区缓存, 须整体互斥
+};
+
+// 块设备请求, 描述一次对硬盘上连续扇区的读写
+struct bio {
+    struct disk* hd;            // 读写的硬盘
+    uint32_t lba;               // 起始扇区号
+    uint32_t sec_cnt;           // 扇区数, 最多 256 个
+    void* buf;                  // 数据缓冲区
+    bool is_write;              // 是写请求还是读请求
+    uint32_t* pgdir;            // 缓冲区所在进程的页目录表, 内核缓冲区为 NULL
+    uint32_t submit_ticks;      // 提交时的 ticks, 用于计算请求的期限
+    bool done;                  // 请求是否已完成
+    struct semaphore finish;    // 用于等待请求完成
+    void (*end_io)(struct bio* bio); // 若不为 NULL, 完成后在工作线程中回调它, 由它决定是否 sema_up(&finish)
+    void* private_data;         // 供 end_io 使用
+    struct bio* merge_next;     // 合并到本请求之后的请求, 按 lba 升序排列
+    uint32_t merge_sec_cnt;     // 以本请求为首的合并链的总扇区数
+    struct list_elem queue_tag; // 用于硬盘请求队列中的结点
 };
 
 // 硬盘结构
@@ -24,6 +51,9 @@ struct disk {
     uint8_t dev_no;                 // 本硬盘是主 0, 还是从 1
     struct partition prim_parts[4]; // 主分区顶多是 4 个
     struct partition logic_parts[8]; // 逻辑分区数量无限, 本内核支持 8 个
+    bool dma;                       // 是否以 DMA 方式读写本硬盘
+    struct list bio_queue;          // 等待处理的请求, 按提交的先后排列
+    uint32_t head_lba;              // 上一个请求结束的位置, 电梯算法从这里继续向前
 };
 
 // ata 通道结构
@@ -31,10 +61,16 @@ struct ide_channel {
     char name[8];               // 本 ata 通道名称
     uint16_t port_base;         // 本通道的起始端口号
     uint8_t irq_no;             // 本通道所用的中断号
-    struct lock lock;           // 通道锁
     bool expecting_intr;        // 表示等待硬盘的中断
     struct semaphore disk_done; // 用于阻塞、唤醒驱动程序
     struct disk devices[2];     // 一个通道上连接两个硬盘, 一主一从
+    uint16_t bm_base;           // 总线主控寄存器的起始端口号, 为 0 表示不支持 DMA
+    struct prd* prdt;           // 本通道的物理区域描述符表(PRD 表)
+    bool dma_busy;              // 当前正在进行的是否是 DMA 传输
+    uint8_t bm_status;          // 中断到来时总线主控的状态
+    struct task_struct* worker; // 处理本通道请求的内核线程
+    bool worker_idle;           // 工作线程是否因无请求而阻塞
+    uint8_t next_dev;           // 下次优先处理哪块硬盘的请求
 };
 
 void intr_hd_handler(uint8_t irq_no);
@@ -44,4 +80,7 @@ extern struct ide_channel channels[];
 extern struct list partition_list;
 void ide_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
 void ide_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
+void bio_init(struct bio* bio, struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt, bool is_write);
+void bio_submit(struct bio* bio);
+void bio_wait(struct bio* bio);
 #endif
@@ -0,0 +1,54 @@
+#include "pci.h"
+#include "io.h"
+#include "global.h"
+
+// 配置空间的地址端口和数据端口
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+// 构造写入地址端口的值, 第 31 位为使能位, reg 须 4 字节对齐
+#define pci_config_addr(bus, dev, func, reg) \
+    (0x80000000 | ((uint32_t)(bus) << 16) | ((uint32_t)(dev) << 11) | \
+     ((uint32_t)(func) << 8) | ((reg) & 0xfc))
+
+// 读取设备 pdev 配置空间中偏移为 reg 的双字
+uint32_t pci_config_read(struct pci_device* pdev, uint8_t reg) {
+    outl(PCI_CONFIG_ADDR, pci_config_addr(pdev->bus, pdev->dev, pdev->func, reg));
+    return inl(PCI_CONFIG_DATA);
+}
+
+// 向设备 pdev 配置空间中偏移为 reg 的双字写入 value
+void pci_config_write(struct pci_device* pdev, uint8_t reg, uint32_t value) {
+    outl(PCI_CONFIG_ADDR, pci_config_addr(pdev->bus, pdev->dev, pdev->func, reg));
+    outl(PCI_CONFIG_DATA, value);
+}
+
+// 在所有总线上查找类别码为 class_code, 子类别码为 subclass 的第一个设备
+// 找到后将其位置存入 pdev 并返回 true, 否则返回 false
+bool pci_find_class(uint8_t class_code, uint8_t subclass, struct pci_device* pdev) {
+    uint32_t bus, dev, func, func_cnt;
+    for (bus = 0; bus < 256; bus++) {
+        for (dev = 0; dev < 32; dev++) {
+            pdev->bus = bus;
+            pdev->dev = dev;
+            pdev->func = 0;
+            // 厂商号为 0xffff 表示此插槽上没有设备
+            if ((pci_config_read(pdev, PCI_REG_ID) & 0xffff) == 0xffff) {
+                continue;
+            }
+            // 头部类型第 7 位为 1 表示多功能设备, 否则只有功能 0
+            func_cnt = (pci_config_read(pdev, PCI_REG_HEADER) & 0x800000) ? 8 : 1;
+            for (func = 0; func < func_cnt; func++) {
+                pdev->func = func;
+                if ((pci_config_read(pdev, PCI_REG_ID) & 0xffff) == 0xffff) {
+                    continue;
+                }
+                uint32_t class_reg = pci_config_read(pdev, PCI_REG_CLASS);
+                if ((class_reg >> 24) == class_code && ((class_reg >> 16) & 0xff) == subclass) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
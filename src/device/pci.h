@@ -0,0 +1,26 @@
+#ifndef __DEVICE_PCI_H
+#define __DEVICE_PCI_H
+#include "stdint.h"
+#include "global.h"
+
+// 配置空间中常用寄存器的偏移
+#define PCI_REG_ID         0x00 // 低 16 位厂商号, 高 16 位设备号
+#define PCI_REG_COMMAND    0x04 // 低 16 位命令寄存器, 高 16 位状态寄存器
+#define PCI_REG_CLASS      0x08 // 高 24 位依次为类别码、子类别码、编程接口
+#define PCI_REG_HEADER     0x0c // 第 16~23 位为头部类型
+#define PCI_REG_BAR4       0x20 // 第 4 个基址寄存器, IDE 控制器用它存放总线主控端口基址
+
+#define PCI_CMD_IO         0x1  // 允许响应 I/O 空间访问
+#define PCI_CMD_BUS_MASTER 0x4  // 允许设备作为总线主控发起 DMA
+
+// PCI 设备位置
+struct pci_device {
+    uint8_t bus;
+    uint8_t dev;
+    uint8_t func;
+};
+
+uint32_t pci_config_read(struct pci_device* pdev, uint8_t reg);
+void pci_config_write(struct pci_device* pdev, uint8_t reg, uint32_t value);
+bool pci_find_class(uint8_t class_code, uint8_t subclass, struct pci_device* pdev);
+#endif
@@ -0,0 +1,381 @@
+#include "bcache.h"
+#include "fs.h"
+#include "global.h"
+#include "memory.h"
+#include "string.h"
+#include "debug.h"
+#include "thread.h"
+#include "timer.h"
+
+static struct buffer_head* bufs;                  // 所有的缓冲区
+static struct list hash_table[BCACHE_HASH_SIZE];  // 按 (hd, lba) 散列的缓冲区
+static struct list lru_list;                      // 队首是最久未使用的缓冲区
+static struct lock bcache_lock;                   // 保护哈希表、lru 队列和 ref_cnt
+
+// 计算 (hd, lba) 所在的哈希桶
+static uint32_t bcache_hash(struct disk* hd, uint32_t lba) {
+    return (lba ^ ((uint32_t)hd >> 4)) % BCACHE_HASH_SIZE;
+}
+
+// 在哈希表中查找缓存 hd 上 lba 扇区的缓冲区, 找不到返回 NULL
+static struct buffer_head* bcache_lookup(struct disk* hd, uint32_t lba) {
+    struct list* bucket = &hash_table[bcache_hash(hd, lba)];
+    struct list_elem* elem = bucket->head.next;
+    while (elem != &bucket->tail) {
+        struct buffer_head* bh = elem2entry(struct buffer_head, hash_tag, elem);
+        if (bh->hd == hd && bh->lba == lba) {
+            return bh;
+        }
+        elem = elem->next;
+    }
+    return NULL;
+}
+
+// 从 lru 队首开始找一个无人使用的干净缓冲区淘汰, 调用者须持有 bcache_lock.
+// 只剩脏的时占住其中最久未使用的一个, 放开 bcache_lock 将其写回后返回 NULL, 并置 *retry 为 true,
+// 期间其它线程可能已缓存了调用者要的扇区, 调用者须重新查找. 都在使用中则返回 NULL, *retry 为 false
+static struct buffer_head* bcache_evict(bool* retry) {
+    *retry = false;
+    struct buffer_head* victim = NULL;
+    struct list_elem* elem = lru_list.head.next;
+    while (elem != &lru_list.tail) {
+        struct buffer_head* bh = elem2entry(struct buffer_head, lru_tag, elem);
+        if (bh->ref_cnt == 0 && !bh->reading) {
+            if (!bh->dirty) {
+                victim = bh;
+                break;
+            }
+            if (victim == NULL) {
+                victim = bh;
+            }
+        }
+        elem = elem->next;
+    }
+    if (victim == NULL) {
+        return NULL;
+    }
+    if (victim->dirty) {
+        // 写回要等硬盘, 不能一直持有 bcache_lock 挡住其它线程命中缓存
+        victim->ref_cnt++;
+        lock_release(&bcache_lock);
+        lock_acquire(&victim->lock);
+        if (victim->dirty) { // 等锁期间可能已被刷盘线程写回
+            ide_write(victim->hd, victim->lba, victim->data, 1);
+            victim->dirty = false;
+        }
+        lock_release(&victim->lock);
+        lock_acquire(&bcache_lock);
+        victim->ref_cnt--;
+        *retry = true;
+        return NULL;
+    }
+    if (victim->hd != NULL) { // 从未用过的缓冲区不在哈希表中
+        list_remove(&victim->hash_tag);
+    }
+    return victim;
+}
+
+// 等待缓冲区 bh 上的预读完成, 调用者须持有 bh->lock, 所以同一时刻至多一个等待者.
+// 预读完成的回调会 sema_up(&bh->bio.finish), 无人等待时留下的信号量在下次 bio_init 时复位
+static void bwait_reading(struct buffer_head* bh) {
+    if (bh->reading) {
+        bio_wait(&bh->bio);
+    }
+}
+
+// 获取缓存 hd 上 lba 扇区的缓冲区, 返回时已持有其锁, 但内容不一定有效
+static struct buffer_head* bget(struct disk* hd, uint32_t lba) {
+    struct buffer_head* bh;
+    lock_acquire(&bcache_lock);
+    while ((bh = bcache_lookup(hd, lba)) == NULL) {
+        bool retry;
+        bh = bcache_evict(&retry);
+        if (bh != NULL) {
+            bh->hd = hd;
+            bh->lba = lba;
+            bh->valid = false;
+            list_append(&hash_table[bcache_hash(hd, lba)], &bh->hash_tag);
+            break;
+        }
+        if (retry) { // 刚写回了一个脏缓冲区, 重新查找
+            continue;
+        }
+        // 缓冲区都在使用中, 让出 cpu 等其它线程释放
+        lock_release(&bcache_lock);
+        thread_yield();
+        lock_acquire(&bcache_lock);
+    }
+    bh->ref_cnt++;
+    // 移到 lru 队尾, 表示最近使用过
+    list_remove(&bh->lru_tag);
+    list_append(&lru_list, &bh->lru_tag);
+    lock_release(&bcache_lock);
+
+    lock_acquire(&bh->lock);
+    bwait_reading(bh);
+    return bh;
+}
+
+// 获取内容有效的 hd 上 lba 扇区的缓冲区, 未命中时从硬盘读入
+static struct buffer_head* bread(struct disk* hd, uint32_t lba) {
+    struct buffer_head* bh = bget(hd, lba);
+    if (!bh->valid) {
+        ide_read(hd, lba, bh->data, 1);
+        bh->valid = true;
+    }
+    return bh;
+}
+
+// 用完缓冲区 bh 后释放它
+static void brelse(struct buffer_head* bh) {
+    lock_release(&bh->lock);
+    lock_acquire(&bcache_lock);
+    ASSERT(bh->ref_cnt > 0);
+    bh->ref_cnt--;
+    lock_release(&bcache_lock);
+}
+
+// 从硬盘 hd 的 lba 扇区起读入 sec_cnt 个扇区到 buf
+void bcache_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    uint32_t sec_idx = 0;
+    while (sec_idx < sec_cnt) {
+        struct buffer_head* bh = bread(hd, lba + sec_idx);
+        memcpy((uint8_t*)buf + sec_idx * SECTOR_SIZE, bh->data, SECTOR_SIZE);
+        brelse(bh);
+        sec_idx++;
+    }
+}
+
+// 将 buf 中 sec_cnt 个扇区的数据写入硬盘 hd 的 lba 扇区起,
+// 数据只写入缓存并标记为脏, 由刷盘线程或 bcache_sync 写回硬盘
+void bcache_write(struct disk* hd, uint32_t lba, const void* buf, uint32_t sec_cnt) {
+    uint32_t sec_idx = 0;
+    while (sec_idx < sec_cnt) {
+        // 整个扇区都会被覆盖, 不必先从硬盘读入
+        struct buffer_head* bh = bget(hd, lba + sec_idx);
+        memcpy(bh->data, (const uint8_t*)buf + sec_idx * SECTOR_SIZE, SECTOR_SIZE);
+        bh->valid = true;
+        bh->dirty = true;
+        brelse(bh);
+        sec_idx++;
+    }
+}
+
+// 从硬盘 hd 的 lba 扇区中偏移 off 处读出 len 字节到 buf, 用于只需扇区中少量数据的场合
+void bcache_read_bytes(struct disk* hd, uint32_t lba, uint32_t off, void* buf, uint32_t len) {
+    ASSERT(off + len <= SECTOR_SIZE);
+    struct buffer_head* bh = bread(hd, lba);
+    memcpy(buf, bh->data + off, len);
+    brelse(bh);
+}
+
+// 将 buf 中的 len 字节写入硬盘 hd 的 lba 扇区中偏移 off 处, 扇区其余内容不变
+void bcache_write_bytes(struct disk* hd, uint32_t lba, uint32_t off, const void* buf, uint32_t len) {
+    ASSERT(off + len <= SECTOR_SIZE);
+    struct buffer_head* bh = bread(hd, lba);
+    memcpy(bh->data + off, buf, len);
+    bh->dirty = true;
+    brelse(bh);
+}
+
+// 若缓存中有 hd 上 lba 扇区的缓冲区就持有并返回它, 否则返回 NULL
+static struct buffer_head* bget_cached(struct disk* hd, uint32_t lba) {
+    lock_acquire(&bcache_lock);
+    struct buffer_head* bh = bcache_lookup(hd, lba);
+    if (bh != NULL) {
+        bh->ref_cnt++;
+    }
+    lock_release(&bcache_lock);
+    if (bh != NULL) {
+        lock_acquire(&bh->lock);
+        bwait_reading(bh);
+    }
+    return bh;
+}
+
+// 缓存中是否有 hd 上 lba 扇区
+static bool bcache_cached(struct disk* hd, uint32_t lba) {
+    lock_acquire(&bcache_lock);
+    bool cached = bcache_lookup(hd, lba) != NULL;
+    lock_release(&bcache_lock);
+    return cached;
+}
+
+// 从硬盘 hd 的 lba 扇区起读入 sec_cnt 个整扇区到 buf, 用于大块的文件数据.
+// 未缓存的连续扇区不经缓存, 用一条命令直接读入 buf;
+// 已缓存的扇区可能比硬盘上的新, 仍从缓存中复制.
+// 读未缓存的扇区时没有占住它们, 读完再查一遍, 期间被缓存的扇区以缓存为准.
+// buf 可能是 fork 后写时复制共享的用户页, DMA 写物理页不触发缺页, 须先把共享拆开
+void bcache_read_direct(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    user_buf_prefault(buf, sec_cnt * SECTOR_SIZE, true);
+    uint32_t sec_idx = 0;
+    while (sec_idx < sec_cnt) {
+        if (bcache_cached(hd, lba + sec_idx)) {
+            bcache_read(hd, lba + sec_idx, (uint8_t*)buf + sec_idx * SECTOR_SIZE, 1);
+            sec_idx++;
+            continue;
+        }
+        uint32_t run_start = sec_idx++;
+        while (sec_idx < sec_cnt && !bcache_cached(hd, lba + sec_idx)) {
+            sec_idx++;
+        }
+        ide_read(hd, lba + run_start, (uint8_t*)buf + run_start * SECTOR_SIZE, sec_idx - run_start);
+        uint32_t run_idx = run_start;
+        while (run_idx < sec_idx) {
+            struct buffer_head* bh = bget_cached(hd, lba + run_idx);
+            if (bh != NULL) {
+                if (bh->valid) {
+                    memcpy((uint8_t*)buf + run_idx * SECTOR_SIZE, bh->data, SECTOR_SIZE);
+                }
+                brelse(bh);
+            }
+            run_idx++;
+        }
+    }
+}
+
+// 将 buf 中 sec_cnt 个整扇区用一条命令直接写入硬盘 hd 的 lba 扇区起, 不占用缓存.
+// 之后再更新缓存中已有的副本, 并标记为脏, 以免刷盘线程在这期间用旧数据覆盖硬盘.
+// buf 中尚未载入的用户页要先经缺页处理映射上, DMA 才能读到
+void bcache_write_direct(struct disk* hd, uint32_t lba, const void* buf, uint32_t sec_cnt) {
+    user_buf_prefault(buf, sec_cnt * SECTOR_SIZE, false);
+    ide_write(hd, lba, (void*)buf, sec_cnt);
+    uint32_t sec_idx = 0;
+    while (sec_idx < sec_cnt) {
+        struct buffer_head* bh = bget_cached(hd, lba + sec_idx);
+        if (bh != NULL) {
+            memcpy(bh->data, (const uint8_t*)buf + sec_idx * SECTOR_SIZE, SECTOR_SIZE);
+            bh->valid = true;
+            bh->dirty = true;
+            brelse(bh);
+        }
+        sec_idx++;
+    }
+}
+
+// 预读完成后在工作线程中回调, 此时不可再申请锁, 但可以 sema_up 唤醒 bwait_reading 中的等待者
+static void bcache_readahead_done(struct bio* bio) {
+    struct buffer_head* bh = bio->private_data;
+    bh->valid = true;
+    bh->reading = false;
+    sema_up(&bio->finish);
+}
+
+// 将硬盘 hd 的 lba 扇区起的 sec_cnt 个扇区异步读入缓存, 立即返回.
+// 已在缓存中的扇区跳过, 其余每扇区提交一个请求, 由电梯合并为一条命令
+void bcache_readahead(struct disk* hd, uint32_t lba, uint32_t sec_cnt) {
+    uint32_t sec_idx = 0;
+    while (sec_idx < sec_cnt) {
+        lock_acquire(&bcache_lock);
+        struct buffer_head* bh = NULL;
+        bool retry = true;
+        while (bh == NULL && retry && bcache_lookup(hd, lba + sec_idx) == NULL) {
+            bh = bcache_evict(&retry);
+        }
+        if (bh != NULL) {
+            bh->hd = hd;
+            bh->lba = lba + sec_idx;
+            bh->valid = false;
+            bh->reading = true;
+            // 放开 bcache_lock 后别的线程就能查到 bh 并在 bh->bio 上等待, 须先初始化好
+            bio_init(&bh->bio, hd, bh->lba, bh->data, 1, false);
+            bh->bio.end_io = bcache_readahead_done;
+            bh->bio.private_data = bh;
+            list_append(&hash_table[bcache_hash(hd, bh->lba)], &bh->hash_tag);
+            list_remove(&bh->lru_tag);
+            list_append(&lru_list, &bh->lru_tag);
+        }
+        lock_release(&bcache_lock);
+
+        // 已缓存的扇区不必预读, 缓冲区都在使用中时就放弃本扇区
+        if (bh != NULL) {
+            bio_submit(&bh->bio);
+        }
+        sec_idx++;
+    }
+}
+
+// 将缓存中所有的脏扇区写回硬盘
+void bcache_sync(void) {
+    struct buffer_head* batch[BCACHE_FLUSH_BATCH];
+    uint32_t buf_idx = 0;
+    while (buf_idx < BCACHE_BUFS) {
+        // 1. 收集一批脏缓冲区, 并持有它们的锁
+        uint32_t batch_cnt = 0;
+        while (buf_idx < BCACHE_BUFS && batch_cnt < BCACHE_FLUSH_BATCH) {
+            struct buffer_head* bh = &bufs[buf_idx++];
+            if (!bh->dirty) {
+                continue;
+            }
+            lock_acquire(&bcache_lock);
+            bh->ref_cnt++;
+            lock_release(&bcache_lock);
+            lock_acquire(&bh->lock);
+            if (!bh->dirty) { // 等锁期间已被别人写回
+                brelse(bh);
+                continue;
+            }
+            // 按 (hd, lba) 插入排序, 使提交的请求有序, 便于电梯合并相邻扇区
+            uint32_t pos = batch_cnt++;
+            while (pos > 0 && (batch[pos - 1]->hd > bh->hd || \
+                   (batch[pos - 1]->hd == bh->hd && batch[pos - 1]->lba > bh->lba))) {
+                batch[pos] = batch[pos - 1];
+                pos--;
+            }
+            batch[pos] = bh;
+        }
+
+        // 2. 逐个异步提交写请求, 再统一等待它们完成
+        uint32_t idx = 0;
+        while (idx < batch_cnt) {
+            struct buffer_head* bh = batch[idx++];
+            bio_init(&bh->bio, bh->hd, bh->lba, bh->data, 1, true);
+            bio_submit(&bh->bio);
+        }
+        idx = 0;
+        while (idx < batch_cnt) {
+            struct buffer_head* bh = batch[idx++];
+            bio_wait(&bh->bio);
+            bh->dirty = false;
+            brelse(bh);
+        }
+    }
+}
+
+// 刷盘线程, 定期将脏扇区写回硬盘
+static void bcache_flusher(void* arg /*UNUSED*/) {
+    while (1) {
+        mtime_sleep(BCACHE_FLUSH_INTERVAL);
+        bcache_sync();
+    }
+}
+
+// 初始化扇区缓存
+void bcache_init(void) {
+    bufs = (struct buffer_head*)sys_malloc(sizeof(struct buffer_head) * BCACHE_BUFS);
+    uint8_t* data = (uint8_t*)get_kernel_pages(BCACHE_BUFS * SECTOR_SIZE / PG_SIZE);
+    if (bufs == NULL || data == NULL) {
+        PANIC("bcache_init: alloc memory failed!");
+    }
+    lock_init(&bcache_lock);
+    list_init(&lru_list);
+    uint32_t idx = 0;
+    while (idx < BCACHE_HASH_SIZE) {
+        list_init(&hash_table[idx++]);
+    }
+    idx = 0;
+    while (idx < BCACHE_BUFS) {
+        struct buffer_head* bh = &bufs[idx];
+        bh->hd = NULL;
+        bh->lba = 0;
+        bh->valid = false;
+        bh->dirty = false;
+        bh->reading = false;
+        bh->ref_cnt = 0;
+        lock_init(&bh->lock);
+        bh->data = data + idx * SECTOR_SIZE;
+        list_append(&lru_list, &bh->lru_tag);
+        idx++;
+    }
+    thread_start("bcache_flusher", 10, bcache_flusher, NULL);
+}
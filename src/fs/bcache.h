@@ -0,0 +1,37 @@
+#ifndef __FS_BCACHE_H
+#define __FS_BCACHE_H
+#include "stdint.h"
+#include "list.h"
+#include "sync.h"
+#include "ide.h"
+
+#define BCACHE_BUFS 256           // 缓存的扇区数, 共 128KB
+#define BCACHE_HASH_SIZE 64       // 哈希桶数
+#define BCACHE_FLUSH_INTERVAL 1000 // 刷盘线程每隔多少毫秒将脏扇区写回硬盘
+#define BCACHE_FLUSH_BATCH 32     // 刷盘时一批最多同时提交的扇区数
+
+// 扇区缓冲区
+struct buffer_head {
+    struct disk* hd;            // 缓存的是哪块硬盘
+    uint32_t lba;               // 缓存的扇区号
+    bool valid;                 // data 中是否已是扇区的内容
+    bool dirty;                 // data 是否被修改过而尚未写回硬盘
+    bool reading;               // 正在被预读, 读完之前不可使用也不可淘汰
+    uint32_t ref_cnt;           // 正在使用此缓冲区的线程数, 为 0 时才可被淘汰
+    struct lock lock;           // 读写 data 前须持有此锁
+    uint8_t* data;              // 扇区数据, 512 字节
+    struct bio bio;             // 用于异步写回或预读
+    struct list_elem hash_tag;  // 用于哈希桶中的结点
+    struct list_elem lru_tag;   // 用于 lru 队列中的结点
+};
+
+void bcache_init(void);
+void bcache_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
+void bcache_write(struct disk* hd, uint32_t lba, const void* buf, uint32_t sec_cnt);
+void bcache_read_bytes(struct disk* hd, uint32_t lba, uint32_t off, void* buf, uint32_t len);
+void bcache_write_bytes(struct disk* hd, uint32_t lba, uint32_t off, const void* buf, uint32_t len);
+void bcache_read_direct(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
+void bcache_write_direct(struct disk* hd, uint32_t lba, const void* buf, uint32_t sec_cnt);
+void bcache_readahead(struct disk* hd, uint32_t lba, uint32_t sec_cnt);
+void bcache_sync(void);
+#endif
@@ -0,0 +1,146 @@
+#include "dcache.h"
+#include "global.h"
+#include "memory.h"
+#include "string.h"
+#include "debug.h"
+#include "interrupt.h"
+
+static struct dentry* dentries;                   // 所有的缓存项
+static struct list dentry_hash[DCACHE_HASH_SIZE]; // 按 (分区, 目录, 文件名) 散列的缓存项
+static struct list dentry_lru;                    // 队首是最久未用的缓存项
+
+// 比较 name 与缓存项中的文件名是否相同, 最多比较 MAX_FILE_NAME_LEN 字节
+static bool dentry_name_eq(struct dentry* de, const char* name) {
+    uint32_t idx = 0;
+    while (idx < MAX_FILE_NAME_LEN) {
+        if (de->name[idx] != name[idx]) {
+            return false;
+        }
+        if (name[idx] == 0) {
+            return true;
+        }
+        idx++;
+    }
+    return true;
+}
+
+// 计算 (part, parent_ino, name) 所在的哈希桶
+static struct list* dentry_bucket(struct partition* part, uint32_t parent_ino, const char* name) {
+    uint32_t hash = parent_ino ^ ((uint32_t)part >> 4);
+    uint32_t idx = 0;
+    while (idx < MAX_FILE_NAME_LEN && name[idx]) {
+        hash = hash * 31 + (uint8_t)name[idx++];
+    }
+    return &dentry_hash[hash % DCACHE_HASH_SIZE];
+}
+
+// 在缓存中查找目录项, 找不到返回 NULL
+static struct dentry* dentry_find(struct partition* part, uint32_t parent_ino, const char* name) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    struct list* bucket = dentry_bucket(part, parent_ino, name);
+    struct list_elem* elem = bucket->head.next;
+    while (elem != &bucket->tail) {
+        struct dentry* de = elem2entry(struct dentry, hash_tag, elem);
+        if (de->part == part && de->parent_ino == parent_ino && dentry_name_eq(de, name)) {
+            return de;
+        }
+        elem = elem->next;
+    }
+    return NULL;
+}
+
+// 将缓存项 de 作废, 放到 lru 队首优先复用
+static void dentry_drop(struct dentry* de) {
+    list_remove(&de->hash_tag);
+    de->part = NULL;
+    list_remove(&de->lru_tag);
+    list_push(&dentry_lru, &de->lru_tag);
+}
+
+// 在目录项缓存中查找目录 parent_ino 中名为 name 的文件, 命中返回 true.
+// 命中时文件的 inode 号和类型存入 dir_e, 类型为 FT_UNKNOWN 表示文件不存在
+bool dcache_lookup(struct partition* part, uint32_t parent_ino, const char* name, struct dir_entry* dir_e) {
+    enum intr_status old_status = intr_disable();
+    struct dentry* de = dentry_find(part, parent_ino, name);
+    if (de != NULL) {
+        memset(dir_e, 0, sizeof(struct dir_entry));
+        memcpy(dir_e->filename, de->name, MAX_FILE_NAME_LEN);
+        dir_e->i_no = de->i_no;
+        dir_e->f_type = de->f_type;
+        // 移到 lru 队尾, 表示最近使用过
+        list_remove(&de->lru_tag);
+        list_append(&dentry_lru, &de->lru_tag);
+    }
+    intr_set_status(old_status);
+    return de != NULL;
+}
+
+// 记录目录 parent_ino 中名为 name 的文件是类型为 f_type 的 i_no 号 inode,
+// f_type 为 FT_UNKNOWN 时记录的是该文件不存在
+void dcache_add(struct partition* part, uint32_t parent_ino, const char* name, uint32_t i_no, enum file_types f_type) {
+    enum intr_status old_status = intr_disable();
+    struct dentry* de = dentry_find(part, parent_ino, name);
+    if (de == NULL) {
+        // 复用最久未用的缓存项
+        de = elem2entry(struct dentry, lru_tag, dentry_lru.head.next);
+        if (de->part != NULL) {
+            list_remove(&de->hash_tag);
+        }
+        de->part = part;
+        de->parent_ino = parent_ino;
+        memset(de->name, 0, MAX_FILE_NAME_LEN);
+        uint32_t idx = 0;
+        while (idx < MAX_FILE_NAME_LEN && name[idx]) {
+            de->name[idx] = name[idx];
+            idx++;
+        }
+        list_append(dentry_bucket(part, parent_ino, name), &de->hash_tag);
+    }
+    de->i_no = i_no;
+    de->f_type = f_type;
+    list_remove(&de->lru_tag);
+    list_append(&dentry_lru, &de->lru_tag);
+    intr_set_status(old_status);
+}
+
+// 作废目录 parent_ino 中名为 name 的缓存项
+void dcache_invalidate(struct partition* part, uint32_t parent_ino, const char* name) {
+    enum intr_status old_status = intr_disable();
+    struct dentry* de = dentry_find(part, parent_ino, name);
+    if (de != NULL) {
+        dentry_drop(de);
+    }
+    intr_set_status(old_status);
+}
+
+// 目录 dir_ino 被删除后作废其中所有的缓存项, 以免其 inode 号被重用时查到旧内容
+void dcache_purge_dir(struct partition* part, uint32_t dir_ino) {
+    enum intr_status old_status = intr_disable();
+    uint32_t idx = 0;
+    while (idx < DCACHE_SIZE) {
+        struct dentry* de = &dentries[idx++];
+        if (de->part == part && de->parent_ino == dir_ino) {
+            dentry_drop(de);
+        }
+    }
+    intr_set_status(old_status);
+}
+
+// 初始化目录项缓存
+void dcache_init(void) {
+    dentries = (struct dentry*)sys_malloc(sizeof(struct dentry) * DCACHE_SIZE);
+    if (dentries == NULL) {
+        PANIC("dcache_init: alloc memory failed!");
+    }
+    uint32_t idx = 0;
+    while (idx < DCACHE_HASH_SIZE) {
+        list_init(&dentry_hash[idx++]);
+    }
+    list_init(&dentry_lru);
+    idx = 0;
+    while (idx < DCACHE_SIZE) {
+        dentries[idx].part = NULL;
+        list_append(&dentry_lru, &dentries[idx].lru_tag);
+        idx++;
+    }
+}
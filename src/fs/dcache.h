@@ -0,0 +1,28 @@
+#ifndef __FS_DCACHE_H
+#define __FS_DCACHE_H
+#include "stdint.h"
+#include "list.h"
+#include "ide.h"
+#include "dir.h"
+
+#define DCACHE_SIZE 128      // 最多缓存的目录项数
+#define DCACHE_HASH_SIZE 64  // 哈希桶数
+
+// 目录项缓存, 记录目录 parent_ino 中名为 name 的文件是哪个 inode,
+// f_type 为 FT_UNKNOWN 时表示该目录中没有此文件
+struct dentry {
+    struct partition* part;        // 所在分区, 为 NULL 表示此项未使用
+    uint32_t parent_ino;           // 所在目录的 inode 号
+    char name[MAX_FILE_NAME_LEN];  // 文件名, 最长 16 字节, 可能没有结尾的 0
+    uint32_t i_no;                 // 文件的 inode 号
+    enum file_types f_type;        // 文件类型
+    struct list_elem hash_tag;     // 用于哈希桶中的结点
+    struct list_elem lru_tag;      // 用于 lru 队列中的结点
+};
+
+void dcache_init(void);
+bool dcache_lookup(struct partition* part, uint32_t parent_ino, const char* name, struct dir_entry* dir_e);
+void dcache_add(struct partition* part, uint32_t parent_ino, const char* name, uint32_t i_no, enum file_types f_type);
+void dcache_invalidate(struct partition* part, uint32_t parent_ino, const char* name);
+void dcache_purge_dir(struct partition* part, uint32_t dir_ino);
+#endif
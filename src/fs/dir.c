@@ -10,8 +10,18 @@
 #include "string.h"
 #include "interrupt.h"
 #include "super_block.h"
+#include "bcache.h"
+#include "dcache.h"
 
 struct dir root_dir; // 根目录
+static struct slab_cache dir_slab;        // 打开的目录
+static struct slab_cache all_blocks_slab; // 目录的全部块地址, 12 个直接块 + 128 个间接块
+
+// 创建目录用到的对象缓存
+void dir_cache_init(void) {
+    slab_cache_init(&dir_slab, "dir", sizeof(struct dir), NULL);
+    slab_cache_init(&all_blocks_slab, "all_blocks", 140 * sizeof(uint32_t), NULL);
+}
 
 // 打开根目录
 void open_root_dir(struct partition* part) {
@@ -21,71 +31,139 @@ void open_root_dir(struct partition* part) {
 
 // 在分区 part 上打开 inode 为 inode_no 的目录并返回目录指针
 struct dir* dir_open(struct partition* part, uint32_t inode_no) {
-    struct dir* pdir = (struct dir*)sys_malloc(sizeof(struct dir));
+    struct dir* pdir = (struct dir*)slab_alloc(&dir_slab);
     pdir->inode = inode_open(part, inode_no);
     pdir->dir_pos = 0;
     return pdir;
 }
 
-// 在 part 分区内的 pdir 目录内寻找名为 name 的文件或目录
-// 找到后返回 true 并将其目录项存入 dir_e, 否则返回 false
-bool search_dir_entry(struct partition* part, struct dir* pdir, const char* name, struct dir_entry* dir_e) {
-    uint32_t block_cnt = 140; // 12 个直接块 + 128 个一级间接块 = 140 块
-    // 12 个直接块大小 + 128 个间接块, 共 560 字节
-    uint32_t* all_blocks = (uint32_t*)sys_malloc(48+512);
-    if (all_blocks == NULL) {
-        printk("search_dir_entry: sys_malloc for all_blocks failed");
-        return false;
+// 目录项文件名的散列值 (FNV-1a), 散列目录按此值在磁盘上存放目录项, 不可更改
+static uint32_t dir_name_hash(const char* name) {
+    uint32_t hash = 2166136261u;
+    uint32_t idx = 0;
+    while (idx < MAX_FILE_NAME_LEN && name[idx]) {
+        hash = (hash ^ (uint8_t)name[idx++]) * 16777619u;
     }
+    return hash;
+}
 
+// 返回散列值 hash 所在桶对应的目录块下标
+static uint32_t dir_bucket_block(struct dir_index* dx, uint32_t hash) {
+    uint32_t bucket = hash & ((1 << dx->level) - 1);
+    if (bucket < dx->split) { // 该桶本轮已分裂, 多用 1 位散列值
+        bucket = hash & ((1 << (dx->level + 1)) - 1);
+    }
+    return bucket + 1;
+}
+
+// 返回目录第 0 块 block0 中的索引头, 目录未按散列组织时返回 NULL
+static struct dir_index* dir_index_get(void* block0) {
+    struct dir_entry* dot = (struct dir_entry*)block0;
+    struct dir_index* dx = (struct dir_index*)(dot->filename + DIR_INDEX_OFFSET);
+    if (strcmp(dot->filename, ".") || dx->magic != DIR_INDEX_MAGIC) {
+        return NULL;
+    }
+    return dx;
+}
+
+// 将目录 dir_inode 的所有块地址 (12 个直接块 + 128 个间接块) 存入 all_blocks.
+// 不论块多大, 目录都只用到一级间接块表的前 128 项, 即其第 1 个扇区
+static void dir_collect_blocks(struct partition* part, struct inode* dir_inode, uint32_t* all_blocks) {
     uint32_t block_idx = 0;
     while (block_idx < 12) {
-        all_blocks[block_idx] = pdir->inode->i_sectors[block_idx];
+        all_blocks[block_idx] = dir_inode->i_sectors[block_idx];
         block_idx++;
     }
-    block_idx = 0;
+    if (dir_inode->i_sectors[12] != 0) { // 若含有一级间接块表
+        bcache_read(part->my_disk, dir_inode->i_sectors[12], all_blocks+12, 1);
+    } else {
+        memset(all_blocks+12, 0, 512);
+    }
+}
+
+// 在有 cnt 个目录项的块缓冲 de 中查找名为 name 的目录项, 找不到返回 NULL
+static struct dir_entry* dir_block_find(struct dir_entry* de, uint32_t cnt, const char* name) {
+    uint32_t idx = 0;
+    while (idx < cnt) {
+        if (de[idx].f_type != FT_UNKNOWN && !strcmp(de[idx].filename, name)) {
+            return &de[idx];
+        }
+        idx++;
+    }
+    return NULL;
+}
+
+// 在有 cnt 个目录项的块缓冲 de 中查找空目录项, 找不到返回 NULL
+static struct dir_entry* dir_block_free_slot(struct dir_entry* de, uint32_t cnt) {
+    uint32_t idx = 0;
+    while (idx < cnt) {
+        if (de[idx].f_type == FT_UNKNOWN) {
+            return &de[idx];
+        }
+        idx++;
+    }
+    return NULL;
+}
+
+// 在 part 分区内的 pdir 目录内寻找名为 name 的文件或目录
+// 找到后返回 true 并将其目录项存入 dir_e, 否则返回 false
+bool search_dir_entry(struct partition* part, struct dir* pdir, const char* name, struct dir_entry* dir_e) {
+    // 先查目录项缓存, 命中时无需读盘
+    if (dcache_lookup(part, pdir->inode->i_no, name, dir_e)) {
+        return dir_e->f_type != FT_UNKNOWN;
+    }
 
-    if (pdir->inode->i_sectors[12] != 0) { // 若含有一级间接块表
-        ide_read(part->my_disk, pdir->inode->i_sectors[12], all_blocks+12, 1);
+    // 12 个直接块大小 + 128 个间接块, 共 560 字节
+    uint32_t* all_blocks = (uint32_t*)slab_alloc(&all_blocks_slab);
+    if (all_blocks == NULL) {
+        printk("search_dir_entry: slab_alloc for all_blocks failed");
+        return false;
     }
+    dir_collect_blocks(part, pdir->inode, all_blocks);
     // 至此, all_blocks 存储的是该文件或目录的所有扇区地址
 
-    uint8_t* buf = (uint8_t*)sys_malloc(SECTOR_SIZE);
-    // p_de 为指向目录项的指针, 值为 buf 起始地址
-    struct dir_entry* p_de = (struct dir_entry*)buf;
+    uint8_t* buf = (uint8_t*)sys_malloc(part->sb->block_size);
+    uint32_t block_secs = BLOCK_SECS(part->sb);
     uint32_t dir_entry_size = part->sb->dir_entry_size;
-    // 1 扇区内可容纳的目录项个数
-    uint32_t dir_entry_cnt = SECTOR_SIZE / dir_entry_size;
-
-    // 开始在所有块中查找目录项
-    while (block_idx < block_cnt) {
-        // 块地址为 0 时表示该块中无数据, 继续在其它块中找
-        if (all_blocks[block_idx] == 0) {
-            block_idx++;
-            continue;
+    // 1 块内可容纳的目录项个数
+    uint32_t dir_entry_cnt = part->sb->block_size / dir_entry_size;
+
+    // 第 0 块存有 "." ".." 和索引头, 对散列目录而言还是溢出块, 总是先查找它
+    bcache_read(part->my_disk, all_blocks[0], buf, block_secs);
+    struct dir_entry* p_de = dir_block_find((struct dir_entry*)buf, dir_entry_cnt, name);
+    struct dir_index* dx = dir_index_get(buf);
+    if (p_de == NULL && dx != NULL) {
+        // 散列目录只需再查找 name 所在的桶
+        uint32_t block_idx = dir_bucket_block(dx, dir_name_hash(name));
+        if (all_blocks[block_idx] != 0) {
+            bcache_read(part->my_disk, all_blocks[block_idx], buf, block_secs);
+            p_de = dir_block_find((struct dir_entry*)buf, dir_entry_cnt, name);
         }
-        ide_read(part->my_disk, all_blocks[block_idx], buf, 1);
-
-        uint32_t dir_entry_idx = 0;
-        // 遍历扇区中所有目录项
-        while (dir_entry_idx < dir_entry_cnt) {
-            // 若找到了, 就直接复制整个目录项
-            if (!strcmp(p_de->filename, name)) {
-                memcpy(dir_e, p_de, dir_entry_size);
-                sys_free(buf);
-                sys_free(all_blocks);
-                return true;
+    } else if (p_de == NULL) {
+        // 未按散列组织的目录需要在所有块中查找
+        uint32_t block_idx = 1;
+        while (p_de == NULL && block_idx < 140) {
+            // 块地址为 0 时表示该块中无数据, 继续在其它块中找
+            if (all_blocks[block_idx] != 0) {
+                bcache_read(part->my_disk, all_blocks[block_idx], buf, block_secs);
+                p_de = dir_block_find((struct dir_entry*)buf, dir_entry_cnt, name);
             }
-            dir_entry_idx++;
-            p_de++;
+            block_idx++;
         }
-        block_idx++;
-        p_de = (struct dir_entry*)buf;
-        memset(buf, 0, SECTOR_SIZE);
+    }
+
+    bool found = p_de != NULL;
+    if (found) {
+        // 若找到了, 就直接复制整个目录项
+        memcpy(dir_e, p_de, dir_entry_size);
+        dcache_add(part, pdir->inode->i_no, name, dir_e->i_no, dir_e->f_type);
+    } else {
+        // 记录该文件不存在, 下次查找同名文件时无需再遍历目录
+        dcache_add(part, pdir->inode->i_no, name, 0, FT_UNKNOWN);
     }
     sys_free(buf);
-    sys_free(all_blocks);
-    return false;
+    slab_free(&all_blocks_slab, all_blocks);
+    return found;
 }
 
 // 关闭目录
@@ -95,7 +173,7 @@ void dir_close(struct dir* dir) {
         return;
     }
     inode_close(dir->inode);
-    sys_free(dir);
+    slab_free(&dir_slab, dir);
 }
 
 // 在内存中初始化目录项
@@ -111,7 +189,155 @@ void create_dir_entry(char* filename,
     p_de->f_type = file_type;
 }
 
-// 将目录项 p_de 写入父目录 parent_dir 中, io_buf 由主调函数提供
+// 为目录 dir_inode 分配第 block_idx 块, 需要时一并分配一级间接块表, 成功返回 true
+// 新块的内容由调用者写入
+static bool dir_block_alloc(struct inode* dir_inode, uint32_t* all_blocks, uint32_t block_idx) {
+    int32_t block_lba = block_bitmap_alloc(cur_part);
+    if (block_lba == -1) {
+        printk("alloc block bitmap for sync_dir_entry failed\n");
+        return false;
+    }
+
+    // 登记到块索引中, 新分配的一级间接块表由 inode_bmap_set 整块清零
+    if (!inode_bmap_set(cur_part, dir_inode, block_idx, block_lba)) {
+        block_bitmap_free(cur_part, block_lba);
+        printk("alloc block bitmap for sync_dir_entry failed\n");
+        return false;
+    }
+    all_blocks[block_idx] = block_lba;
+    return true;
+}
+
+// 回收目录 dir_inode 的第 block_idx 块, 若它是最后一个间接块, 连同一级间接块表一并回收
+static void dir_block_free(struct partition* part, struct inode* dir_inode, uint32_t* all_blocks, uint32_t block_idx) {
+    // 在块位图中回收该块
+    block_bitmap_free(part, all_blocks[block_idx]);
+    all_blocks[block_idx] = 0;
+
+    // 将块地址从数组 i_sectors 或索引表中去掉
+    if (block_idx < 12) {
+        dir_inode->i_sectors[block_idx] = 0;
+        return;
+    }
+    // 统计一级间接索引表中剩余间接块的数量
+    uint32_t indirect_blocks = 0;
+    uint32_t indirect_block_idx = 12;
+    while (indirect_block_idx < 140) {
+        if (all_blocks[indirect_block_idx] != 0) {
+            indirect_blocks++;
+        }
+        indirect_block_idx++;
+    }
+
+    if (indirect_blocks > 0) {
+        // 间接索引表中还包括其它间接块, 仅在索引表中擦除当前这个间接块地址
+        inode_bmap_set(part, dir_inode, block_idx, 0);
+    } else {
+        // 已没有间接块, 回收间接索引表所在的块并擦除其地址
+        block_bitmap_free(part, dir_inode->i_sectors[12]);
+        dir_inode->i_sectors[12] = 0;
+    }
+}
+
+// 将目录项 p_de 写入目录的第 block_idx 块, 该块不存在时先分配
+// 写入成功返回 1, 该块已满返回 0, 分配块失败返回 -1
+static int32_t dir_block_insert(struct inode* dir_inode, uint32_t* all_blocks, uint32_t block_idx, 
+                                struct dir_entry* p_de, void* io_buf) {
+    uint32_t dir_entry_size = cur_part->sb->dir_entry_size;
+    uint32_t block_size = cur_part->sb->block_size;
+    if (all_blocks[block_idx] == 0) {
+        if (!dir_block_alloc(dir_inode, all_blocks, block_idx)) {
+            return -1;
+        }
+        memset(io_buf, 0, block_size);
+    } else {
+        bcache_read(cur_part->my_disk, all_blocks[block_idx], io_buf, BLOCK_SECS(cur_part->sb));
+    }
+    struct dir_entry* slot = dir_block_free_slot((struct dir_entry*)io_buf, block_size / dir_entry_size);
+    if (slot == NULL) {
+        return 0;
+    }
+    memcpy(slot, p_de, dir_entry_size);
+    bcache_write(cur_part->my_disk, all_blocks[block_idx], io_buf, BLOCK_SECS(cur_part->sb));
+    return 1;
+}
+
+// 分裂散列目录中下一个该分裂的桶, 把按新规则属于新桶的目录项移过去, io_buf 至少 2 个块
+// 成功返回 1, 桶数已达上限返回 0, 分配块失败返回 -1
+static int32_t dir_bucket_split(struct inode* dir_inode, uint32_t* all_blocks, struct dir_index* dx, void* io_buf) {
+    uint32_t src_idx = dx->split + 1;
+    uint32_t dst_idx = src_idx + (1 << dx->level);
+    if (dst_idx >= 140) {
+        return 0;
+    }
+    // 新桶总在所有已有桶之后, 必然还没有块
+    ASSERT(all_blocks[dst_idx] == 0);
+
+    // 先推进分裂进度, 使 dir_bucket_block 按分裂后的规则计算
+    struct dir_index old_dx = *dx;
+    if (++dx->split == (1 << dx->level)) {
+        dx->level++;
+        dx->split = 0;
+    }
+    if (all_blocks[src_idx] == 0) { // 空桶不必移动目录项
+        return 1;
+    }
+
+    uint32_t dir_entry_size = cur_part->sb->dir_entry_size;
+    uint32_t block_size = cur_part->sb->block_size;
+    uint32_t block_secs = BLOCK_SECS(cur_part->sb);
+    uint32_t dir_entrys_per_block = block_size / dir_entry_size;
+    struct dir_entry* src = (struct dir_entry*)io_buf;
+    struct dir_entry* dst = (struct dir_entry*)((uint8_t*)io_buf + block_size);
+    bcache_read(cur_part->my_disk, all_blocks[src_idx], src, block_secs);
+    memset(dst, 0, block_size);
+
+    uint32_t moved = 0, remain = 0, dir_entry_idx = 0;
+    while (dir_entry_idx < dir_entrys_per_block) {
+        struct dir_entry* de = src + dir_entry_idx;
+        if (de->f_type != FT_UNKNOWN) {
+            if (dir_bucket_block(dx, dir_name_hash(de->filename)) == dst_idx) {
+                memcpy(dst + moved, de, dir_entry_size);
+                memset(de, 0, dir_entry_size);
+                moved++;
+            } else {
+                remain++;
+            }
+        }
+        dir_entry_idx++;
+    }
+    if (moved == 0) {
+        return 1;
+    }
+
+    if (!dir_block_alloc(dir_inode, all_blocks, dst_idx)) {
+        *dx = old_dx;
+        return -1;
+    }
+    bcache_write(cur_part->my_disk, all_blocks[dst_idx], dst, block_secs);
+    if (remain > 0) {
+        bcache_write(cur_part->my_disk, all_blocks[src_idx], src, block_secs);
+    } else {
+        // 原桶已空, 回收其块, 以保证空目录只有第 0 块
+        dir_block_free(cur_part, dir_inode, all_blocks, src_idx);
+    }
+    return 1;
+}
+
+// 将索引头 dx 写回目录第 0 块, dx->magic 不是 DIR_INDEX_MAGIC 时清除索引头
+static void dir_index_store(uint32_t* all_blocks, struct dir_index* dx, void* io_buf) {
+    bcache_read(cur_part->my_disk, all_blocks[0], io_buf, BLOCK_SECS(cur_part->sb));
+    struct dir_entry* dot = (struct dir_entry*)io_buf;
+    struct dir_index* pdx = (struct dir_index*)(dot->filename + DIR_INDEX_OFFSET);
+    if (dx->magic == DIR_INDEX_MAGIC) {
+        *pdx = *dx;
+    } else {
+        memset(pdx, 0, sizeof(struct dir_index));
+    }
+    bcache_write(cur_part->my_disk, all_blocks[0], io_buf, BLOCK_SECS(cur_part->sb));
+}
+
+// 将目录项 p_de 写入父目录 parent_dir 中, io_buf 由主调函数提供, 至少 2 个块
 bool sync_dir_entry(struct dir* parent_dir, struct dir_entry* p_de, void* io_buf) {
     struct inode* dir_inode = parent_dir->inode;
     uint32_t dir_size = dir_inode->i_size;
@@ -119,96 +345,82 @@ bool sync_dir_entry(struct dir* parent_dir, struct dir_entry* p_de, void* io_buf
 
     ASSERT(dir_size % dir_entry_size == 0);
 
-    // 每扇区最大的目录项数目
-    uint32_t dir_entrys_per_sec = (512 / dir_entry_size);
-    int32_t block_lba = -1;
+    // 每块最大的目录项数目
+    uint32_t block_secs = BLOCK_SECS(cur_part->sb);
+    uint32_t dir_entrys_per_block = cur_part->sb->block_size / dir_entry_size;
 
-    // 将该目录的所有扇区地址(12 个直接块 + 128 个间接块)存入 all_blocks
-    uint8_t block_idx = 0;
     // all_blocks 保存目录所有的块
     uint32_t all_blocks[140] = {0};
-
-    // 将 12 个直接块存入 all_blocks
-    while (block_idx < 12) {
-        all_blocks[block_idx] = dir_inode->i_sectors[block_idx];
-        block_idx++;
+    dir_collect_blocks(cur_part, dir_inode, all_blocks);
+
+    // 写入成功为 1, 尚未写入为 0, 出错为 -1
+    int32_t ret = 0;
+
+    // 第 0 块有空位时直接写入, 对散列目录而言第 0 块是各桶共用的溢出块
+    bcache_read(cur_part->my_disk, all_blocks[0], io_buf, block_secs);
+    struct dir_entry* slot = dir_block_free_slot((struct dir_entry*)io_buf, dir_entrys_per_block);
+    if (slot != NULL) {
+        memcpy(slot, p_de, dir_entry_size);
+        bcache_write(cur_part->my_disk, all_blocks[0], io_buf, block_secs);
+        ret = 1;
     }
 
-    // dir_e 用来在 io_buf 中遍历目录项
-    struct dir_entry* dir_e = (struct dir_entry*)io_buf;
-    int32_t block_bitmap_idx = -1;
-
-    // 开始遍历所有块以寻找目录项空位, 若已有扇区中没有空闲位
-    // 在不超过文件大小的情况下申请新扇区来存储新目录项
-    block_idx = 0;
-    while (block_idx < 140) {
-        block_bitmap_idx = -1;
-        if (all_blocks[block_idx] == 0) {
-            block_lba = block_bitmap_alloc(cur_part);
-            if (block_lba == -1) {
-                printk("alloc block bitmap for sync_dir_entry failed\n");
-                return false;
+    if (ret == 0) {
+        struct dir_index dx, orig_dx;
+        struct dir_index* pdx = dir_index_get(io_buf);
+        memset(&orig_dx, 0, sizeof(struct dir_index));
+        if (pdx != NULL) {
+            orig_dx = *pdx;
+        }
+        dx = orig_dx;
+        if (pdx == NULL) {
+            // 第 0 块已满且目录没有其它块时, 从此按散列组织该目录
+            uint32_t block_idx = 1;
+            while (block_idx < 140 && all_blocks[block_idx] == 0) {
+                block_idx++;
+            }
+            if (block_idx == 140 && !strcmp(((struct dir_entry*)io_buf)->filename, ".")) {
+                dx.magic = DIR_INDEX_MAGIC;
             }
+        }
 
-            // 每分配一个块就同步一次 block_bitmap
-            block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-            ASSERT(block_bitmap_idx != -1);
-            bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-
-            block_bitmap_idx = -1;
-            if (block_idx < 12) { // 若是直接块
-                dir_inode->i_sectors[block_idx] = all_blocks[block_idx] = block_lba;
-            } else if (block_idx == 12) {
-                dir_inode->i_sectors[12] = block_lba;
-                block_lba = -1;
-                // 再分配一个块作为第 0 个间接块
-                block_lba = block_bitmap_alloc(cur_part);
-                if (block_lba == -1) {
-                    block_bitmap_idx = dir_inode->i_sectors[12] - cur_part->sb->data_start_lba;
-                    bitmap_set(&cur_part->block_bitmap, block_bitmap_idx, 0);
-                    dir_inode->i_sectors[12] = 0;
-                    printk("alloc block bitmap for sync_dir_entry failed\n");
-                    return false;
+        if (dx.magic == DIR_INDEX_MAGIC) {
+            uint32_t hash = dir_name_hash(p_de->filename);
+            // 目标桶已满时分裂下一个桶, 直到目标桶有空位
+            while ((ret = dir_block_insert(dir_inode, all_blocks, dir_bucket_block(&dx, hash), p_de, io_buf)) == 0) {
+                int32_t split_ret = dir_bucket_split(dir_inode, all_blocks, &dx, io_buf);
+                if (split_ret == 0) {
+                    // 桶数已达上限, 退回线性组织, 目录项仍在原处
+                    memset(&dx, 0, sizeof(struct dir_index));
+                    break;
+                } else if (split_ret == -1) {
+                    ret = -1;
+                    break;
                 }
-
-                // 每分配一个块就同步一次 block_bitmap
-                block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-                ASSERT(block_bitmap_idx != -1);
-                bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-
-                all_blocks[12] = block_lba;
-                // 把新分配的第 0 个间接块地址写入一级间接块表
-                ide_write(cur_part->my_disk, dir_inode->i_sectors[12], all_blocks+12, 1);
-            } else {
-                all_blocks[block_idx] = block_lba;
-                // 把新分配的第(block_idx - 12)个间接块地址写入一级间接块表
-                ide_write(cur_part->my_disk, dir_inode->i_sectors[12], all_blocks+12, 1);
             }
+        }
+        if (memcmp(&dx, &orig_dx, sizeof(struct dir_index))) {
+            dir_index_store(all_blocks, &dx, io_buf);
+        }
 
-            // 再将新目录项 p_de 写入新分配的间接块
-            memset(io_buf, 0, 512);
-            memcpy(io_buf, p_de, dir_entry_size);
-            ide_write(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
-            dir_inode->i_size += dir_entry_size;
+        // 未按散列组织的目录在其余块中寻找空位, 在不超过文件大小的情况下申请新块
+        uint32_t block_idx = 1;
+        while (ret == 0 && dx.magic != DIR_INDEX_MAGIC && block_idx < 140) {
+            ret = dir_block_insert(dir_inode, all_blocks, block_idx, p_de, io_buf);
+            block_idx++;
         }
+    }
 
-        // 若第 block_idx 块已存在, 将其读进内存, 然后在该块中查找空目录项
-        ide_read(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
-        // 在扇区内查找空目录项
-        uint8_t dir_entry_idx = 0;
-        while (dir_entry_idx < dir_entrys_per_sec) {
-            if ((dir_e + dir_entry_idx)->f_type == FT_UNKNOWN) {
-                memcpy(dir_e+dir_entry_idx, p_de, dir_entry_size);
-                ide_write(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
-                dir_inode->i_size += dir_entry_size;
-                return true;
-            }
-            dir_entry_idx++;
+    if (ret != 1) {
+        if (ret == 0) {
+            printk("directory is full!\n");
         }
-        block_idx++;
+        return false;
     }
-    printk("directory is full!\n");
-    return false;
+    dir_inode->i_size += dir_entry_size;
+    // 覆盖缓存中可能存在的 "文件不存在" 记录
+    dcache_add(cur_part, dir_inode->i_no, p_de->filename, p_de->i_no, p_de->f_type);
+    return true;
 }
 
 // 把分区 part 目录 pdir 中编号为 inode_no 的目录项删除
@@ -216,20 +428,15 @@ bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_n
     struct inode* dir_inode = pdir->inode;
     uint32_t block_idx = 0, all_blocks[140] = {0};
     // 收集目录全部块地址
-    while (block_idx < 12) {
-        all_blocks[block_idx] = dir_inode->i_sectors[block_idx];
-        block_idx++;
-    }
-    if (dir_inode->i_sectors[12]) {
-        ide_read(part->my_disk, dir_inode->i_sectors[12], all_blocks+12, 1);
-    }
+    dir_collect_blocks(part, dir_inode, all_blocks);
 
-    // 目录项在存储时保证不会跨扇区
+    // 目录项在存储时保证不会跨块
     uint32_t dir_entry_size = part->sb->dir_entry_size;
-    uint32_t dir_entrys_per_sec = (SECTOR_SIZE / dir_entry_size); // 每扇区最大的目录项数目
+    uint32_t block_secs = BLOCK_SECS(part->sb);
+    uint32_t dir_entrys_per_block = part->sb->block_size / dir_entry_size; // 每块最大的目录项数目
     struct dir_entry* dir_e = (struct dir_entry*)io_buf;
     struct dir_entry* dir_entry_found = NULL;
-    uint8_t dir_entry_idx, dir_entry_cnt;
+    uint32_t dir_entry_idx, dir_entry_cnt;
     bool is_dir_first_block = false; // 目录的第 1 个块
 
     // 遍历所有块, 寻找目录项
@@ -241,18 +448,18 @@ bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_n
             continue;
         }
         dir_entry_idx = dir_entry_cnt = 0;
-        memset(io_buf, 0, SECTOR_SIZE);
-        // 读取扇区, 获得目录项
-        ide_read(part->my_disk, all_blocks[block_idx], io_buf, 1);
+        memset(io_buf, 0, part->sb->block_size);
+        // 读取块, 获得目录项
+        bcache_read(part->my_disk, all_blocks[block_idx], io_buf, block_secs);
 
-        // 遍历所有的目录项, 统计该扇区的目录项数量及是否有待删除的目录项
-        while (dir_entry_idx < dir_entrys_per_sec) {
+        // 遍历所有的目录项, 统计该块的目录项数量及是否有待删除的目录项
+        while (dir_entry_idx < dir_entrys_per_block) {
             if ((dir_e + dir_entry_idx)->f_type != FT_UNKNOWN) {
                 if (!strcmp((dir_e + dir_entry_idx)->filename, ".")) {
                     is_dir_first_block = true;
                 } else if (strcmp((dir_e + dir_entry_idx)->filename, ".") && 
                            strcmp((dir_e + dir_entry_idx)->filename, "..")) {
-                    dir_entry_cnt++; // 统计此扇区内的目录项个数, 用来判断删除目录项后是否回收该扇区
+                    dir_entry_cnt++; // 统计此块内的目录项个数, 用来判断删除目录项后是否回收该块
                     if ((dir_e + dir_entry_idx)->i_no == inode_no) {
                         ASSERT(dir_entry_found == NULL);
                         dir_entry_found = dir_e + dir_entry_idx;
@@ -262,59 +469,28 @@ bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_n
             }
             dir_entry_idx++;
         }
-        // 若此扇区未找到该目录项, 继续在下个扇区中找
+        // 若此块未找到该目录项, 继续在下个块中找
         if (dir_entry_found == NULL) {
             block_idx++;
             continue;
         }
 
-        // 在此扇区中找到目录项后, 清除该目录项并判断是否回收扇区, 随后退出循环直接返回
+        // 在此块中找到目录项后, 清除该目录项并判断是否回收块, 随后退出循环直接返回
         ASSERT(dir_entry_cnt >= 1);
-        // 除目录第 1 个扇区外, 若该扇区上只有该目录项自己, 则将整个扇区回收
+        // 目录项即将被清除, 先作废其缓存
+        dcache_invalidate(part, dir_inode->i_no, dir_entry_found->filename);
+        // 除目录第 1 个块外, 若该块上只有该目录项自己, 则将整个块回收
         if (dir_entry_cnt == 1 && !is_dir_first_block) {
-            // a 在块位图中回收该块
-            uint32_t block_bitmap_idx = all_blocks[block_idx] - part->sb->data_start_lba;
-            bitmap_set(&part->block_bitmap, block_bitmap_idx, 0);
-            bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-
-            // b 将块地址从数组 i_sectors 或索引表中去掉
-            if (block_idx < 12) {
-                dir_inode->i_sectors[block_idx] = 0;
-            } else { // 在一级间接索引表中擦除该间接块地址
-                // 先判断一级间接索引表中间接块的数量, 如果仅有这 1 个间接块, 连同间接索引表所在的块一同回收
-                uint32_t indirect_blocks = 0;
-                uint32_t indirect_block_idx = 12;
-                while (indirect_block_idx < 140) {
-                    if (all_blocks[indirect_block_idx] != 0) {
-                        indirect_blocks++;
-                    }
-                }
-                ASSERT(indirect_blocks >= 1);
-
-                // 间接索引表中还包括其它间接块, 仅在索引表中擦除当前这个间接块地址
-                if (indirect_blocks > 1) {
-                    all_blocks[block_idx] = 0;
-                    ide_write(part->my_disk, dir_inode->i_sectors[12], all_blocks+12, 1);
-                } else { // 间接索引表中就当前这 1 个间接块, 直接把间接块索引表所在的块回收, 然后擦除间接索引表块地址
-                    // 回收间接索引表所在的块
-                    block_bitmap_idx = dir_inode->i_sectors[12] - part->sb->data_start_lba;
-                    bitmap_set(&part->block_bitmap, block_bitmap_idx, 0);
-                    bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-
-                    // 将间接索引表地址清 0
-                    dir_inode->i_sectors[12] = 0;
-                }
-            }
+            dir_block_free(part, dir_inode, all_blocks, block_idx);
         } else { // 仅将该目录项清空
             memset(dir_entry_found, 0, dir_entry_size);
-            ide_write(part->my_disk, all_blocks[block_idx], io_buf, 1);
+            bcache_write(part->my_disk, all_blocks[block_idx], io_buf, block_secs);
         }
 
         // 更新 inode 信息并同步到硬盘
         ASSERT(dir_inode->i_size >= dir_entry_size);
         dir_inode->i_size -= dir_entry_size;
-        memset(io_buf, 0, SECTOR_SIZE*2);
-        inode_sync(part, dir_inode, io_buf);
+        inode_sync(part, dir_inode);
 
         return true;
     }
@@ -326,35 +502,28 @@ bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_n
 struct dir_entry* dir_read(struct dir* dir) {
     struct dir_entry* dir_e = (struct dir_entry*)dir->dir_buf;
     struct inode* dir_inode = dir->inode;
-    uint32_t all_blocks[140] = {0}, block_cnt = 12;
+    // 目录只用到直接块和一级间接块, 块地址通过块索引逐个查得
+    uint32_t block_cnt = dir_inode->i_sectors[12] != 0 ? 140 : 12;
     uint32_t block_idx = 0, dir_entry_idx = 0;
-    while (block_idx < 12) {
-        all_blocks[block_idx] = dir_inode->i_sectors[block_idx];
-        block_idx++;
-    }
-    if (dir_inode->i_sectors[12] != 0) { // 若含有一级间接块表
-        ide_read(cur_part->my_disk, dir_inode->i_sectors[12], all_blocks+12, 1);
-        block_cnt = 140;
-    }
-    block_idx = 0;
 
     uint32_t cur_dir_entry_pos = 0; // 当前目录项的偏移, 此项用来判断是否是之前已经返回过的目录项
     uint32_t dir_entry_size = cur_part->sb->dir_entry_size;
-    uint32_t dir_entrys_per_sec = SECTOR_SIZE / dir_entry_size; // 1 扇区内可容纳的目录项个数
+    uint32_t dir_entrys_per_block = cur_part->sb->block_size / dir_entry_size; // 1 块内可容纳的目录项个数
     // 因为此目录内可能删除了某些文件或子目录, 所以要遍历所有块
     while (block_idx < block_cnt) {
         if (dir->dir_pos >= dir_inode->i_size) {
             return NULL;
         }
-        if (all_blocks[block_idx] == 0) {
+        uint32_t block_lba = inode_bmap(cur_part, dir_inode, block_idx);
+        if (block_lba == 0) {
             block_idx++;
             continue;
         }
-        memset(dir_e, 0, SECTOR_SIZE);
-        ide_read(cur_part->my_disk, all_blocks[block_idx], dir_e, 1);
+        memset(dir_e, 0, cur_part->sb->block_size);
+        bcache_read(cur_part->my_disk, block_lba, dir_e, BLOCK_SECS(cur_part->sb));
         dir_entry_idx = 0;
-        // 遍历扇区内所有目录项
-        while (dir_entry_idx < dir_entrys_per_sec) {
+        // 遍历块内所有目录项
+        while (dir_entry_idx < dir_entrys_per_block) {
             if ((dir_e + dir_entry_idx)->f_type) { // f_type != FT_UNKNOWN
                 // 判断是不是最新的目录项, 避免返回曾经已经返回过的目录项
                 if (cur_dir_entry_pos < dir->dir_pos) {
@@ -389,7 +558,7 @@ int32_t dir_remove(struct dir* parent_dir, struct dir* child_dir) {
         ASSERT(child_dir_inode->i_sectors[block_idx] == 0);
         block_idx++;
     }
-    void* io_buf = sys_malloc(SECTOR_SIZE*2);
+    void* io_buf = sys_malloc(cur_part->sb->block_size*2);
     if (io_buf == NULL) {
         printk("dir_remove: malloc for io_buf failed\n");
         return -1;
@@ -400,6 +569,8 @@ int32_t dir_remove(struct dir* parent_dir, struct dir* child_dir) {
 
     // 回收 inode 中 i_sectors 中所占用的扇区, 并同步 inode_bitmap 和 block_bitmap
     inode_release(cur_part, child_dir_inode->i_no);
+    // 作废被删目录中所有目录项的缓存
+    dcache_purge_dir(cur_part, child_dir_inode->i_no);
     sys_free(io_buf);
     return 0;
 }
@@ -12,7 +12,7 @@
 struct dir {
     struct inode* inode;
     uint32_t dir_pos; // 记录在目录内的偏移
-    uint8_t dir_buf[512]; // 目录的数据缓冲
+    uint8_t dir_buf[MAX_BLOCK_SIZE]; // 目录的数据缓冲, 可容纳 1 个块
 };
 
 // 目录项结构
@@ -22,8 +22,21 @@ struct dir_entry {
     enum file_types f_type; // 文件类型
 };
 
+// 散列目录的索引头, 存放在目录第 0 块 "." 目录项的文件名 "." 之后的空闲字节中.
+// 线性扫描目录时文件名只比较到结尾的 0, 因此旧的查找方式仍能读取散列目录.
+// 散列目录采用线性散列, 第 i 个桶是目录的第 i+1 块, 第 0 块作为各桶共用的溢出块
+struct dir_index {
+    uint8_t magic; // 为 DIR_INDEX_MAGIC 时表示该目录已按散列组织
+    uint8_t level; // 本轮分裂开始时有 2^level 个桶
+    uint8_t split; // 本轮下一个要分裂的桶
+};
+
+#define DIR_INDEX_MAGIC 0x48 // 'H'
+#define DIR_INDEX_OFFSET 2   // 索引头在 "." 目录项文件名中的偏移
+
 extern struct dir root_dir;             // 根目录
 
+void dir_cache_init(void);
 void open_root_dir(struct partition* part);
 struct dir* dir_open(struct partition* part, uint32_t inode_no);
 void dir_close(struct dir* dir);
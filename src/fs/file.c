@@ -10,6 +10,7 @@
 #include "string.h"
 #include "super_block.h"
 #include "thread.h"
+#include "bcache.h"
 
 // 文件表
 struct file file_table[MAX_FILE_OPEN];
@@ -49,54 +50,174 @@ int32_t pcb_fd_install(int32_t globa_fd_idx) {
     return local_fd_idx;
 }
 
+// 位图第 sec_idx 个扇区在汇总表中的空闲位数
+static uint16_t disk_bitmap_free_cnt(struct partition* part, struct disk_bitmap* dbm, uint32_t sec_idx) {
+    uint16_t free_cnt;
+    bcache_read_bytes(part->my_disk, dbm->summary_lba + sec_idx / SUMMARY_PER_SECTOR, \
+                      sec_idx % SUMMARY_PER_SECTOR * sizeof(uint16_t), &free_cnt, sizeof(uint16_t));
+    return free_cnt;
+}
+
+// 判断硬盘位图 dbm 的第 bit_idx 位是否为 1
+bool disk_bitmap_test(struct partition* part, struct disk_bitmap* dbm, uint32_t bit_idx) {
+    ASSERT(bit_idx < dbm->sects * BITS_PER_SECTOR);
+    uint8_t byte;
+    bcache_read_bytes(part->my_disk, dbm->bits_lba + bit_idx / BITS_PER_SECTOR, \
+                      bit_idx % BITS_PER_SECTOR / 8, &byte, 1);
+    return (byte & (BITMAP_MASK << (bit_idx % 8))) != 0;
+}
+
+// 将硬盘位图 dbm 的第 bit_idx 位设置为 value, 同时更新汇总表中该扇区的空闲位数.
+// 修改只发生在扇区缓存中, 由缓存负责写回硬盘.
+// 位与汇总表的读改写之间可能因读盘而阻塞, 全程持有分区的分配锁
+void disk_bitmap_set(struct partition* part, struct disk_bitmap* dbm, uint32_t bit_idx, int8_t value) {
+    ASSERT((value == 0) || (value == 1));
+    ASSERT(bit_idx < dbm->sects * BITS_PER_SECTOR);
+    uint32_t sec_idx = bit_idx / BITS_PER_SECTOR;
+    uint32_t byte_off = bit_idx % BITS_PER_SECTOR / 8;
+    uint8_t mask = BITMAP_MASK << (bit_idx % 8);
+    uint8_t byte;
+    lock_acquire(&part->alloc_lock);
+    bcache_read_bytes(part->my_disk, dbm->bits_lba + sec_idx, byte_off, &byte, 1);
+    if (((byte & mask) != 0) == value) {
+        lock_release(&part->alloc_lock);
+        return;
+    }
+    byte = value ? (byte | mask) : (byte & ~mask);
+    bcache_write_bytes(part->my_disk, dbm->bits_lba + sec_idx, byte_off, &byte, 1);
+
+    uint16_t free_cnt = disk_bitmap_free_cnt(part, dbm, sec_idx);
+    free_cnt = value ? free_cnt - 1 : free_cnt + 1;
+    bcache_write_bytes(part->my_disk, dbm->summary_lba + sec_idx / SUMMARY_PER_SECTOR, \
+                       sec_idx % SUMMARY_PER_SECTOR * sizeof(uint16_t), &free_cnt, sizeof(uint16_t));
+    lock_release(&part->alloc_lock);
+}
+
+// 在硬盘位图 dbm 的 [start_idx, end_idx) 范围内查找第一个空闲位, 成功返回其下标, 失败返回 -1.
+// 汇总表中空闲位数为 0 的扇区直接跳过, 不必读入
+int32_t disk_bitmap_scan(struct partition* part, struct disk_bitmap* dbm, uint32_t start_idx, uint32_t end_idx) {
+    ASSERT(end_idx <= dbm->sects * BITS_PER_SECTOR);
+    uint8_t* sec_buf = NULL;
+    int32_t found = -1;
+    uint32_t bit_idx = start_idx;
+    while (found == -1 && bit_idx < end_idx) {
+        uint32_t sec_idx = bit_idx / BITS_PER_SECTOR;
+        uint32_t sec_start = sec_idx * BITS_PER_SECTOR;
+        uint32_t sec_end = sec_start + BITS_PER_SECTOR < end_idx ? sec_start + BITS_PER_SECTOR : end_idx;
+        if (disk_bitmap_free_cnt(part, dbm, sec_idx) != 0) {
+            if (sec_buf == NULL && (sec_buf = (uint8_t*)slab_alloc(&sector_buf_slab)) == NULL) {
+                printk("disk_bitmap_scan: slab_alloc for sec_buf failed\n");
+                return -1;
+            }
+            bcache_read(part->my_disk, dbm->bits_lba + sec_idx, sec_buf, 1);
+            // 在读入的这一扇区位图中查找
+            struct bitmap sec_btmp;
+            sec_btmp.btmp_bytes_len = SECTOR_SIZE;
+            sec_btmp.bits = sec_buf;
+            sec_btmp.summary = NULL;
+            int32_t idx = bitmap_scan_from(&sec_btmp, bit_idx - sec_start, sec_end - sec_start);
+            if (idx != -1) {
+                found = sec_start + idx;
+            }
+        }
+        bit_idx = sec_end;
+    }
+    if (sec_buf != NULL) {
+        slab_free(&sector_buf_slab, sec_buf);
+    }
+    return found;
+}
+
 // 分配一个 inode, 返回 inode 号
+// 从分区的分配游标处开始找, 到 inode 总数处仍无空闲就从头再找.
+// 查找到置位期间持有分区的分配锁, 以免两个任务分到同一个 inode
 int32_t inode_bitmap_alloc(struct partition* part) {
-    int32_t bit_idx = bitmap_scan(&part->inode_bitmap, 1);
+    lock_acquire(&part->alloc_lock);
+    uint32_t inode_cnt = part->sb->inode_cnt;
+    uint32_t goal = part->inode_cursor < inode_cnt ? part->inode_cursor : 0;
+    int32_t bit_idx = disk_bitmap_scan(part, &part->inode_bitmap, goal, inode_cnt);
     if (bit_idx == -1) {
-        return -1;
+        bit_idx = disk_bitmap_scan(part, &part->inode_bitmap, 0, goal);
+        if (bit_idx == -1) {
+            lock_release(&part->alloc_lock);
+            return -1;
+        }
     }
-    bitmap_set(&part->inode_bitmap, bit_idx, 1);
+    disk_bitmap_set(part, &part->inode_bitmap, bit_idx, 1);
+    part->inode_cursor = bit_idx + 1;
+    lock_release(&part->alloc_lock);
     return bit_idx;
 }
 
-// 分配 1 个扇区, 返回其扇区地址
-int32_t block_bitmap_alloc(struct partition* part) {
-    int32_t bit_idx = bitmap_scan(&part->block_bitmap, 1);
+// 分区数据区中的块数, 块位图末尾凑整的多余位不对应任何块
+static uint32_t data_block_cnt(struct partition* part) {
+    uint32_t block_cnt = (part->sb->sec_cnt - (part->sb->data_start_lba - part->sb->part_lba_base)) / BLOCK_SECS(part->sb);
+    uint32_t bit_cnt = part->block_bitmap.sects * BITS_PER_SECTOR;
+    return block_cnt < bit_cnt ? block_cnt : bit_cnt;
+}
+
+// 块地址 block_lba 对应于块位图中的位索引
+uint32_t block_lba_to_idx(struct partition* part, uint32_t block_lba) {
+    ASSERT(block_lba >= part->sb->data_start_lba);
+    return (block_lba - part->sb->data_start_lba) / BLOCK_SECS(part->sb);
+}
+
+// 在块位图中回收块地址为 block_lba 的块
+void block_bitmap_free(struct partition* part, uint32_t block_lba) {
+    uint32_t bit_idx = block_lba_to_idx(part, block_lba);
+    ASSERT(bit_idx > 0);
+    disk_bitmap_set(part, &part->block_bitmap, bit_idx, 0);
+}
+
+// 从块地址 goal_lba 处开始, 分配最多 max_cnt 个连续的块, 实际个数存入 cnt, 返回起始块地址.
+// goal_lba 为 0 时从分区的分配游标处开始, 查到数据区末尾仍无空闲块就从头再找.
+// 查找到置位期间持有分区的分配锁, 以免两个任务分到同一个块
+int32_t block_bitmap_alloc_run(struct partition* part, uint32_t goal_lba, uint32_t max_cnt, uint32_t* cnt) {
+    ASSERT(max_cnt > 0);
+    lock_acquire(&part->alloc_lock);
+    uint32_t block_cnt = data_block_cnt(part);
+    uint32_t goal = part->block_cursor;
+    if (goal_lba >= part->sb->data_start_lba && block_lba_to_idx(part, goal_lba) < block_cnt) {
+        goal = block_lba_to_idx(part, goal_lba);
+    }
+    if (goal >= block_cnt) {
+        goal = 0;
+    }
+
+    int32_t bit_idx = disk_bitmap_scan(part, &part->block_bitmap, goal, block_cnt);
     if (bit_idx == -1) {
-        return -1;
+        bit_idx = disk_bitmap_scan(part, &part->block_bitmap, 0, goal);
+        if (bit_idx == -1) {
+            lock_release(&part->alloc_lock);
+            return -1;
+        }
     }
-    bitmap_set(&part->block_bitmap, bit_idx, 1);
+
+    // 从找到的空闲块起尽量向后连续分配
+    uint32_t run_cnt = 0;
+    while (run_cnt < max_cnt && bit_idx + run_cnt < block_cnt && \
+           !disk_bitmap_test(part, &part->block_bitmap, bit_idx + run_cnt)) {
+        disk_bitmap_set(part, &part->block_bitmap, bit_idx + run_cnt, 1);
+        run_cnt++;
+    }
+    *cnt = run_cnt;
+    part->block_cursor = bit_idx + run_cnt;
+    lock_release(&part->alloc_lock);
     // 和 inode_bitmap_malloc 不同, 此处返回的不是位索引
     // 而是具体可用的扇区地址
-    return (part->sb->data_start_lba + bit_idx);
+    return (part->sb->data_start_lba + bit_idx * BLOCK_SECS(part->sb));
 }
 
-// 将内存中 bitmap 第 bit_idx 位所在的 512 字节同步到硬盘
-void bitmap_sync(struct partition* part, uint32_t bit_idx, uint8_t btmp) {
-    // 本 inode 索引相对于位图的扇区偏移量
-    uint32_t off_sec = bit_idx / 4096;
-    // 本 inode 索引相对于位图的字节偏移量
-    uint32_t off_size = off_sec * BLOCK_SIZE;
-    uint32_t sec_lba;
-    uint8_t* bitmap_off;
-
-    switch (btmp) {
-        case INODE_BITMAP:
-            sec_lba = part->sb->inode_bitmap_lba + off_sec;
-            bitmap_off = part->inode_bitmap.bits + off_size;
-            break;
-        case BLOCK_BITMAP:
-            sec_lba = part->sb->block_bitmap_lba + off_sec;
-            bitmap_off = part->block_bitmap.bits + off_size;
-            break;
-    }
-    ide_write(part->my_disk, sec_lba, bitmap_off, 1);
+// 分配 1 个块, 返回其块地址
+int32_t block_bitmap_alloc(struct partition* part) {
+    uint32_t cnt;
+    return block_bitmap_alloc_run(part, 0, 1, &cnt);
 }
 
 // 创建文件, 若成功则返回文件描述符, 否则返回 -1
 int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
     // 后续操作的公共缓冲区
-    void* io_buf = sys_malloc(1024);
+    void* io_buf = sys_malloc(cur_part->sb->block_size * 2);
     if (io_buf == NULL) {
         printk("in file_creat: sys_malloc for io_buf failed\n");
         return -1;
@@ -113,13 +234,20 @@ int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
 
     // 此 inode 要从堆中申请内存, 不可生成局部变量(函数退出时会释放)
     // 因为 file_table 数组中的文件描述符的 inode 指针要指向它
-    struct inode* new_file_inode = (struct inode*)sys_malloc(sizeof(struct inode));
+    struct inode* new_file_inode = inode_alloc();
     if (new_file_inode == NULL) {
         printk("file_create: sys_malloc for inode failed\n");
         rollback_step = 1;
         goto rollback;
     }
     inode_init(inode_no, new_file_inode); // 初始化 inode
+    if (cur_part->sb->features & FS_FEATURE_INLINE_DATA) {
+        // 新文件的数据先存放在 inode 中, 超出 INODE_INLINE_SIZE 时再转存到数据块
+        new_file_inode->i_flags |= INODE_FLAG_INLINE;
+    } else if (cur_part->sb->features & FS_FEATURE_EXTENTS) {
+        // 新文件按 extent 组织, 顺序写入的大文件只需少量 extent
+        new_file_inode->i_flags |= INODE_FLAG_EXTENTS;
+    }
 
     // 返回的是 file_table 数组的下标
     int fd_idx = get_free_slot_in_global();
@@ -132,6 +260,7 @@ int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
     file_table[fd_idx].fd_inode = new_file_inode;
     file_table[fd_idx].fd_pos = 0;
     file_table[fd_idx].fd_flag = flag;
+    file_table[fd_idx].ra_pos = file_table[fd_idx].ra_size = file_table[fd_idx].ra_end = 0;
     file_table[fd_idx].fd_inode->write_deny = false;
 
     struct dir_entry new_dir_entry;
@@ -148,19 +277,14 @@ int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
         goto rollback;
     }
 
-    memset(io_buf, 0, 1024);
     // b 将父目录 inode 的内容同步到硬盘
-    inode_sync(cur_part, parent_dir->inode, io_buf);
+    inode_sync(cur_part, parent_dir->inode);
 
-    memset(io_buf, 0, 1024);
     // c 将新创建文件的 inode 内容同步到硬盘
-    inode_sync(cur_part, new_file_inode, io_buf);
+    inode_sync(cur_part, new_file_inode);
 
-    // d 将 inode_bitmap 位图同步到硬盘
-    bitmap_sync(cur_part, inode_no, INODE_BITMAP);
-
-    // e 将创建的文件 inode 添加到 open_inodes 链表
-    list_push(&cur_part->open_inodes, &new_file_inode->inode_tag);
+    // d 将创建的文件 inode 添加到 inode 缓存
+    inode_cache_add(cur_part, new_file_inode);
     new_file_inode->i_open_cnts = 1;
 
     sys_free(io_buf);
@@ -174,11 +298,11 @@ rollback:
             // 失败时, 将 file_table 中的相应位清空
             memset(&file_table[fd_idx], 0, sizeof(struct file));
         case 2:
-            sys_free(new_file_inode);
+            inode_free(new_file_inode);
         case 1:
             // 如果新文件的 inode 创建失败
             // 之前位图中分配的 inode_no 也要恢复
-            bitmap_set(&cur_part->inode_bitmap, inode_no, 0);
+            disk_bitmap_set(cur_part, &cur_part->inode_bitmap, inode_no, 0);
             break;
     }
     sys_free(io_buf);
@@ -195,6 +319,7 @@ int32_t file_open(uint32_t inode_no, uint8_t flag) {
     file_table[fd_idx].fd_inode = inode_open(cur_part, inode_no);
     file_table[fd_idx].fd_pos = 0; // 每次打开文件, 要将 fd_pos 还原为 0, 即让文件内的指针指向开头
     file_table[fd_idx].fd_flag = flag;
+    file_table[fd_idx].ra_pos = file_table[fd_idx].ra_size = file_table[fd_idx].ra_end = 0;
     bool* write_deny = &file_table[fd_idx].fd_inode->write_deny;
 
     // 只要是关于写文件, 判断是否有其它进程正写此文件
@@ -225,197 +350,211 @@ int32_t file_close(struct file* file) {
     return 0;
 }
 
+// 回收文件 inode 从第 start_idx 块起的 cnt 个块并清除其映射, 用于写文件失败时回滚
+// 从后往前回收, 按 extent 组织的文件每次只能去掉最后一块
+static void file_blocks_free(struct inode* inode, uint32_t start_idx, uint32_t cnt) {
+    uint32_t block_idx = start_idx + cnt;
+    while (block_idx-- > start_idx) {
+        uint32_t block_lba = inode_bmap(cur_part, inode, block_idx);
+        if (block_lba != 0) {
+            block_bitmap_free(cur_part, block_lba);
+            inode_bmap_set(cur_part, inode, block_idx, 0);
+        }
+    }
+}
+
+// 为文件 inode 的第 start_idx 到 end_idx-1 块分配硬盘块, 尽量紧接着文件最后一块连续分配,
+// 以便文件在硬盘上顺序存放. 失败时归还本次分配的块并返回 false
+static bool file_blocks_alloc(struct inode* inode, uint32_t start_idx, uint32_t end_idx) {
+    uint32_t block_secs = BLOCK_SECS(cur_part->sb);
+    uint32_t goal_lba = start_idx > 0 ? inode_bmap(cur_part, inode, start_idx - 1) + block_secs : 0;
+    uint32_t block_idx = start_idx;
+    while (block_idx < end_idx) {
+        uint32_t run_cnt;
+        int32_t block_lba = block_bitmap_alloc_run(cur_part, goal_lba, end_idx - block_idx, &run_cnt);
+        if (block_lba == -1) {
+            file_blocks_free(inode, start_idx, block_idx - start_idx);
+            return false;
+        }
+        goal_lba = block_lba + run_cnt * block_secs;
+        // 登记到块索引中, 需要新的间接块表或 extent 块时在其中分配
+        uint32_t mapped = inode_bmap_set_run(cur_part, inode, block_idx, block_lba, run_cnt);
+        block_idx += mapped;
+        if (mapped < run_cnt) {
+            // 本段中尚未登记的块直接在位图中归还
+            uint32_t run_idx = mapped;
+            while (run_idx < run_cnt) {
+                block_bitmap_free(cur_part, block_lba + run_idx * block_secs);
+                run_idx++;
+            }
+            file_blocks_free(inode, start_idx, block_idx - start_idx);
+            return false;
+        }
+    }
+    return true;
+}
+
+// 把数据存放在 inode 中的文件转为用数据块存放: 分配第 0 块, 写入原有的数据.
+// 分区支持 extent 时之后按 extent 组织. 失败时文件保持原样并返回 false
+static bool file_inline_spill(struct inode* inode, void* io_buf) {
+    uint8_t data[INODE_INLINE_SIZE];
+    memcpy(data, inode->i_inline, INODE_INLINE_SIZE);
+    uint32_t flags = inode->i_flags;
+
+    memset(inode->i_inline, 0, INODE_INLINE_SIZE);
+    inode->i_flags &= ~INODE_FLAG_INLINE;
+    if (cur_part->sb->features & FS_FEATURE_EXTENTS) {
+        inode->i_flags |= INODE_FLAG_EXTENTS;
+    }
+    if (inode->i_size > 0) {
+        if (!file_blocks_alloc(inode, 0, 1)) {
+            memcpy(inode->i_inline, data, INODE_INLINE_SIZE);
+            inode->i_flags = flags;
+            return false;
+        }
+        memset(io_buf, 0, cur_part->sb->block_size);
+        memcpy(io_buf, data, inode->i_size);
+        bcache_write(cur_part->my_disk, inode_bmap(cur_part, inode, 0), io_buf, BLOCK_SECS(cur_part->sb));
+    }
+    return true;
+}
+
 // 把 buf 中的 count 个字节写入 file, 成功则返回写入的字节数, 失败则返回 -1
 int32_t file_write(struct file* file, const void* buf, uint32_t count) {
-    if ((file->fd_inode->i_size + count) > (BLOCK_SIZE * 140)) { // 文件目前最大只支持 512*140=71680 字节
-        printk("exceed max file_size 71680 bytes, write file failed\n");
+    struct inode* inode = file->fd_inode;
+    if ((inode->i_flags & INODE_FLAG_INLINE) && count <= INODE_INLINE_SIZE - inode->i_size) {
+        // 写入后仍放得进 inode 的, 只需同步 inode 所在的扇区
+        memcpy(inode->i_inline + inode->i_size, buf, count);
+        file->fd_pos = inode->i_size - 1 + count;
+        inode->i_size += count;
+        inode_sync(cur_part, inode);
+        return count;
+    }
+
+    uint32_t max_file_size = inode_max_bytes(cur_part);
+    if (count > max_file_size - inode->i_size) {
+        printk("exceed max file_size %d bytes, write file failed\n", max_file_size);
         return -1;
     }
-    uint8_t* io_buf = sys_malloc(BLOCK_SIZE);
+    uint32_t block_size = cur_part->sb->block_size;
+    uint32_t block_secs = BLOCK_SECS(cur_part->sb);
+    // 用于拼写不满整块的数据
+    uint8_t* io_buf = sys_malloc(block_size);
     if (io_buf == NULL) {
         printk("file_write: sys_malloc for io_buf failed\n");
         return -1;
     }
-    uint32_t* all_blocks = (uint32_t*)sys_malloc(BLOCK_SIZE+48); // 用来记录文件所有的块地址
-    if (all_blocks == NULL) {
-        printk("file_write: sys_malloc for all_blocks failed\n");
+    if ((inode->i_flags & INODE_FLAG_INLINE) && !file_inline_spill(inode, io_buf)) {
+        printk("file_write: block_bitmap_alloc failed\n");
+        sys_free(io_buf);
         return -1;
     }
 
     const uint8_t* src = buf;       // 用 src 指向 buf 中待写入的数据
     uint32_t bytes_written = 0;     // 用来记录已写入数据大小
     uint32_t size_left = count;	    // 用来记录未写入数据大小
-    int32_t block_lba = -1;	        // 块地址
-    uint32_t block_bitmap_idx = 0;  // 用来记录block对应于block_bitmap中的索引,做为参数传给bitmap_sync
-    uint32_t sec_idx;	            // 用来索引扇区
-    uint32_t sec_lba;	            // 扇区地址
-    uint32_t sec_off_bytes;         // 扇区内字节偏移量
-    uint32_t sec_left_bytes;        // 扇区内剩余字节量
+    uint32_t block_idx;	            // 用来索引块
+    uint32_t block_lba;	            // 块地址
+    uint32_t block_off_bytes;       // 块内字节偏移量
+    uint32_t block_left_bytes;      // 块内剩余字节量
     uint32_t chunk_size;	        // 每次写入硬盘的数据块大小
-    int32_t indirect_block_table;   // 用来获取一级间接表地址
-    uint32_t block_idx;		        // 块索引
 
-    // 判断文件是否是第一次写, 如果是, 先为其分配一个块
-    if (file->fd_inode->i_sectors[0] == 0) {
-        block_lba = block_bitmap_alloc(cur_part);
-        if (block_lba == -1) {
-            printk("file_write: block_bitmap_alloc failed\n");
-            return -1;
-        }
-        file->fd_inode->i_sectors[0] = block_lba;
-
-        // 每分配一个块就将位图同步到硬盘
-        block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-        ASSERT(block_bitmap_idx != 0);
-        bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-    }
-    
-    // 写入 count 个字节前, 该文件已经占用的块数
-    uint32_t file_has_used_blocks = file->fd_inode->i_size / BLOCK_SIZE + 1;
-
-    // 存储 count 字节后，该文件将占用的块数
-    uint32_t file_will_use_blocks = (file->fd_inode->i_size + count) / BLOCK_SIZE + 1;
-    ASSERT(file_will_use_blocks <= 140);
-
-    // 通过此增量判断是否需要分配扇区, 如增量为 0, 表示原扇区够用
-    uint32_t add_blocks = file_will_use_blocks - file_has_used_blocks;
-
-    // 开始将所有块地址收集到 all_blocks (系统中块大小等于扇区大小)
-    // 后面都统一在 all_blocks 中获取写入扇区地址
-    if (add_blocks == 0) {
-        if (file_has_used_blocks <= 12) {
-            // 在同一扇区内写入数据, 不涉及到分配新扇区
-            block_idx = file_has_used_blocks - 1;
-            all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-        } else {
-            // 未写入新数据之前已经占用了间接块, 需要将间接块地址读进来
-            ASSERT(file->fd_inode->i_sectors[12] != 0);
-            indirect_block_table = file->fd_inode->i_sectors[12];
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks+12, 1);
-        }
-    } else {
-        // 有增量, 涉及到分配新扇区及是否分配一级间接块表
-        // 第一种情况, 12 个直接块够用
-        if (file_will_use_blocks <= 12) {
-            block_idx = file_has_used_blocks - 1;
-            ASSERT(file->fd_inode->i_sectors[block_idx] != 0);
-            all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-
-            // 再将未来要用的扇区分配好后写入 all_blocks
-            block_idx = file_has_used_blocks; // 指向第一个要分配的新扇区
-            while (block_idx < file_will_use_blocks) {
-                block_lba = block_bitmap_alloc(cur_part);
-                if (block_lba == -1) {
-                    printk("file_write: block_bitmap_alloc for situation 1 failed\n");
-                    return -1;
-                }
-
-                ASSERT(file->fd_inode->i_sectors[block_idx] == 0);
-                file->fd_inode->i_sectors[block_idx] = all_blocks[block_idx] = block_lba;
-
-                // 每分配一个块就将位图同步到硬盘
-                block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-                bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-
-                block_idx++; // 下一个分配的新扇区
-            }
-        } else if (file_has_used_blocks <= 12 && file_will_use_blocks > 12) {
-            // 第二种情况: 旧数据在 12 个直接块内, 新数据将使用间接块
-            
-            // 先将有剩余空间的可继续用的扇区地址收集到 all_blocks
-            block_idx = file_has_used_blocks - 1; // 指向旧数据所在的最后一个扇区
-            all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-
-            // 创建一级间接块表
-            block_lba = block_bitmap_alloc(cur_part);
-            if (block_lba == -1) {
-                printk("file_write: block_bitmap_alloc for situation 2 failed\n");
-                return -1;
-            }
-
-            ASSERT(file->fd_inode->i_sectors[12] == 0);
-            // 分配一级间接块索引表
-            indirect_block_table = file->fd_inode->i_sectors[12] = block_lba;
-
-            block_idx = file_has_used_blocks;
-            while (block_idx < file_will_use_blocks) {
-                block_lba = block_bitmap_alloc(cur_part);
-                if (block_lba == -1) {
-                    printk("file_write: block_bitmap_alloc for situation 2 failed\n");
-                    return -1;
-                }
-
-                if (block_idx < 12) {
-                    ASSERT(file->fd_inode->i_sectors[block_idx] == 0);
-                    file->fd_inode->i_sectors[block_idx] = all_blocks[block_idx] = block_lba;
-                } else { // 间接块只写入到 all_block 数组中, 待全部分配完成后一次性同步到硬盘
-                    all_blocks[block_idx] = block_lba;
-                }
-
-                // 每分配一个块就将位图同步到硬盘
-                block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-                bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-
-                block_idx++; // 下一个扇区
-            }
-            ide_write(cur_part->my_disk, indirect_block_table, all_blocks+12, 1); // 同步一级间接块表到硬盘
-        } else if (file_has_used_blocks > 12) {
-            // 第三种情况: 新数据占据间接块
-            ASSERT(file->fd_inode->i_sectors[12] != 0);
-            indirect_block_table = file->fd_inode->i_sectors[12];
-
-            // 已使用的间接块也将被读入 all_blocks, 无须单独收录
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks+12, 1); // 获取所有间接块地址
-
-            block_idx = file_has_used_blocks;
-            while (block_idx < file_will_use_blocks) {
-                block_lba = block_bitmap_alloc(cur_part);
-                if (block_lba == -1) {
-                    printk("file_write: block_bitmap_alloc for situation 3 failed\n");
-                    return -1;
-                }
-                all_blocks[block_idx++] = block_lba;
-
-                // 每分配一个块就将位图同步到硬盘
-                block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-                bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-            }
-            ide_write(cur_part->my_disk, indirect_block_table, all_blocks+12, 1); 
-        }
+    // 写入前后文件占用的块数, 先把新增的块全部分配好并登记到块索引中
+    uint32_t file_has_used_blocks = DIV_ROUND_UP(inode->i_size, block_size);
+    uint32_t file_will_use_blocks = DIV_ROUND_UP(inode->i_size + count, block_size);
+    if (!file_blocks_alloc(inode, file_has_used_blocks, file_will_use_blocks)) {
+        printk("file_write: block_bitmap_alloc failed\n");
+        inode_sync(cur_part, inode);
+        sys_free(io_buf);
+        return -1;
     }
 
-    bool first_write_block = true; // 含有剩余空间的扇区标识
-    // 块地址已经收集到 all_blocks 中, 下面开始写数据
-    file->fd_pos = file->fd_inode->i_size - 1;
+    // 块已经全部分配, 下面开始写数据
+    file->fd_pos = inode->i_size - 1;
     while (bytes_written < count) {
-        memset(io_buf, 0, BLOCK_SIZE);
-        sec_idx = file->fd_inode->i_size / BLOCK_SIZE;
-        sec_lba = all_blocks[sec_idx];
-        sec_off_bytes = file->fd_inode->i_size % BLOCK_SIZE;
-        sec_left_bytes = BLOCK_SIZE - sec_off_bytes;
-
-        // 判断此次写入硬盘的数据大小
-        chunk_size = size_left < sec_left_bytes ? size_left : sec_left_bytes;
-        if (first_write_block) {
-            ide_read(cur_part->my_disk, sec_lba, io_buf, 1);
-            first_write_block = false;
+        block_idx = inode->i_size / block_size;
+        block_off_bytes = inode->i_size % block_size;
+        block_left_bytes = block_size - block_off_bytes;
+
+        if (block_off_bytes == 0 && size_left >= block_size) {
+            // 写满整块时, 物理上相连的块用一条命令直接从 buf 写入硬盘, 一条命令最多 256 个扇区
+            uint32_t max_blocks = size_left / block_size;
+            if (max_blocks > 256 / block_secs) {
+                max_blocks = 256 / block_secs;
+            }
+            uint32_t blocks = inode_bmap_run(cur_part, inode, block_idx, max_blocks, &block_lba);
+            chunk_size = blocks * block_size;
+            bcache_write_direct(cur_part->my_disk, block_lba, src, blocks * block_secs);
+        } else {
+            block_lba = inode_bmap(cur_part, inode, block_idx);
+            ASSERT(block_lba != 0);
+            // 判断此次写入硬盘的数据大小
+            chunk_size = size_left < block_left_bytes ? size_left : block_left_bytes;
+            memset(io_buf, 0, block_size);
+            if (block_off_bytes != 0) { // 块中已有文件数据, 先读出来
+                bcache_read(cur_part->my_disk, block_lba, io_buf, block_secs);
+            }
+            memcpy(io_buf+block_off_bytes, src, chunk_size);
+            bcache_write(cur_part->my_disk, block_lba, io_buf, block_secs);
         }
-        memcpy(io_buf+sec_off_bytes, src, chunk_size);
-        ide_write(cur_part->my_disk, sec_lba, io_buf, 1);
-        printk("file write at lba 0x%x\n", sec_lba);
+        printk("file write at lba 0x%x\n", block_lba);
 
         src += chunk_size; // 将指针推移到下个新数据
-        file->fd_inode->i_size += chunk_size; // 更新文件大小
+        inode->i_size += chunk_size; // 更新文件大小
         file->fd_pos += chunk_size;
         bytes_written += chunk_size;
         size_left -= chunk_size;
     }
-    inode_sync(cur_part, file->fd_inode, io_buf);
-    sys_free(all_blocks);
+    inode_sync(cur_part, inode);
     sys_free(io_buf);
     return bytes_written;
 }
 
+// 读完 file 的 [read_start, file->fd_pos) 后预读其后的块.
+// 从上次结束处接着读视为顺序读, 预读窗口翻倍, 否则窗口复位为 RA_MIN_BLOCKS.
+// 窗口按扇区数封顶, 换算成块数时至少为 1 块
+static void file_readahead(struct file* file, uint32_t read_start) {
+    uint32_t ra_max = RA_MAX_SECS / BLOCK_SECS(cur_part->sb);
+    if (ra_max == 0) {
+        ra_max = 1;
+    }
+    if (read_start == file->ra_pos && file->ra_size != 0) {
+        file->ra_size *= 2;
+    } else {
+        file->ra_size = RA_MIN_BLOCKS;
+        file->ra_end = 0;
+    }
+    if (file->ra_size > ra_max) {
+        file->ra_size = ra_max;
+    }
+    file->ra_pos = file->fd_pos;
+
+    struct inode* inode = file->fd_inode;
+    uint32_t block_size = cur_part->sb->block_size;
+    uint32_t file_blocks = DIV_ROUND_UP(inode->i_size, block_size);
+    uint32_t ra_start = DIV_ROUND_UP(file->fd_pos, block_size); // 第一个尚未读过的块
+    uint32_t ra_stop = ra_start + file->ra_size;
+    if (ra_stop > file_blocks) {
+        ra_stop = file_blocks;
+    }
+    if (ra_start < file->ra_end) { // 上次已预读过的不再重复
+        ra_start = file->ra_end;
+    }
+    if (ra_start >= ra_stop) {
+        return;
+    }
+    file->ra_end = ra_stop;
+
+    // 物理上连续的一段块一次提交
+    uint32_t block_idx = ra_start;
+    while (block_idx < ra_stop) {
+        uint32_t block_lba;
+        uint32_t blocks = inode_bmap_run(cur_part, inode, block_idx, ra_stop - block_idx, &block_lba);
+        bcache_readahead(cur_part->my_disk, block_lba, blocks * BLOCK_SECS(cur_part->sb));
+        block_idx += blocks;
+    }
+}
+
 // 从文件 file 中读取 count 个字节写入 buf, 返回读出的字节数, 若到文件尾则返回 -1
 int32_t file_read(struct file* file, void* buf, uint32_t count) {
     uint8_t* buf_dst = (uint8_t*)buf;
@@ -430,84 +569,53 @@ int32_t file_read(struct file* file, void* buf, uint32_t count) {
         }
     }
 
-    uint8_t* io_buf = sys_malloc(BLOCK_SIZE);
+    if (file->fd_inode->i_flags & INODE_FLAG_INLINE) {
+        // 数据就在 inode 中, 不必读硬盘
+        memcpy(buf_dst, file->fd_inode->i_inline + file->fd_pos, size);
+        file->fd_pos += size;
+        return size;
+    }
+
+    uint32_t block_size = cur_part->sb->block_size;
+    uint32_t block_secs = BLOCK_SECS(cur_part->sb);
+    uint8_t* io_buf = sys_malloc(block_size);
     if (io_buf == NULL) {
         printk("file_read: sys_malloc for io_buf failed\n");
-    }
-    uint32_t* all_blocks = (uint32_t*)sys_malloc(BLOCK_SIZE+48); // 用来记录文件所有的块地址
-    if (all_blocks == NULL) {
-        printk("file_read: sys_malloc for all_blocks failed\n");
         return -1;
     }
 
-    uint32_t block_read_start_idx = file->fd_pos / BLOCK_SIZE; // 数据所在块的起始地址
-    uint32_t block_read_end_idx = (file->fd_pos + size) / BLOCK_SIZE; // 数据所在块的终止地址
-    uint32_t read_blocks = block_read_start_idx - block_read_end_idx; // 如增量为 0, 表示数据在同一扇区
-    ASSERT(block_read_start_idx < 139 && block_read_end_idx < 139);
-
-    int32_t indirect_block_table; // 用来获取一级间接表地址
-    uint32_t block_idx; // 获取待读的块地址
-
-    // 开始构建 all_blocks 块地址数组, 专门存储用到的块地址
-    if (read_blocks == 0) {
-        ASSERT(block_read_end_idx == block_read_start_idx);
-        if (block_read_end_idx < 12) { // 待读的数据在 12 个直接块之内
-            block_idx = block_read_end_idx;
-            all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-        } else {
-            indirect_block_table = file->fd_inode->i_sectors[12];
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks+12, 1);
-        }
-    } else { // 若要读多个块
-        if (block_read_end_idx < 12) { // 数据结束所在的块属于直接块
-            // 第一种情况, 起始块和终止块属于直接块
-            block_idx = block_read_start_idx;
-            while (block_idx <= block_read_end_idx) {
-                all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-                block_idx++;
-            }
-        } else if (block_read_start_idx < 12 && block_read_end_idx >= 12) {
-            // 第二种情况, 待读入的数据跨越直接块和间接块两类
-            // 先将直接块地址写入 all_blocks
-            block_idx = block_read_start_idx;
-            while (block_idx < 12) {
-                all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-                block_idx++;
+    // 每段数据的块地址都通过块索引现查, 不再事先收集文件所有的块地址
+    uint32_t block_idx, block_lba, block_off_bytes, block_left_bytes, chunk_size;
+    uint32_t bytes_read = 0;
+    while (bytes_read < size) {
+        block_idx = file->fd_pos / block_size;
+        block_off_bytes = file->fd_pos % block_size;
+        block_left_bytes = block_size - block_off_bytes;
+
+        if (block_off_bytes == 0 && size_left >= block_size) {
+            // 读取整块时, 物理上相连的块用一条命令直接读入 buf, 一条命令最多 256 个扇区
+            uint32_t max_blocks = size_left / block_size;
+            if (max_blocks > 256 / block_secs) {
+                max_blocks = 256 / block_secs;
             }
-            ASSERT(file->fd_inode->i_sectors[12] != 0); // 确保已经分配了一级间接块表
-
-            // 再将间接块地址写入 all_blocks
-            indirect_block_table = file->fd_inode->i_sectors[12];
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks+12, 1); // 将一级间接块表读进来写入到第 13 个块的位置之后
+            uint32_t blocks = inode_bmap_run(cur_part, file->fd_inode, block_idx, max_blocks, &block_lba);
+            chunk_size = blocks * block_size;
+            bcache_read_direct(cur_part->my_disk, block_lba, buf_dst, blocks * block_secs);
         } else {
-            // 第三种情况, 数据在间接块中
-            ASSERT(file->fd_inode->i_sectors[12] != 0);
-            indirect_block_table = file->fd_inode->i_sectors[12]; // 获取一级间接表地址
-            // 将一级间接块表读进来写入到第 13 个块的位置之后
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks+12, 1);
+            block_lba = inode_bmap(cur_part, file->fd_inode, block_idx);
+            ASSERT(block_lba != 0);
+            chunk_size = size_left < block_left_bytes ? size_left : block_left_bytes; // 待读入的数据大小
+            memset(io_buf, 0, block_size);
+            bcache_read(cur_part->my_disk, block_lba, io_buf, block_secs);
+            memcpy(buf_dst, io_buf+block_off_bytes, chunk_size);
         }
-    }
-
-    // 用到的块地址已经收集到 all_blocks 中, 下面开始读数据
-    uint32_t sec_idx, sec_lba, sec_off_bytes, sec_left_bytes, chunk_size;
-    uint32_t bytes_read = 0;
-    while (bytes_read < size) {
-        sec_idx = file->fd_pos / BLOCK_SIZE;
-        sec_lba = all_blocks[sec_idx];
-        sec_off_bytes = file->fd_pos % BLOCK_SIZE;
-        sec_left_bytes = BLOCK_SIZE - sec_off_bytes;
-        chunk_size = size_left < sec_left_bytes ? size_left : sec_left_bytes; // 待读入的数据大小
-
-        memset(io_buf, 0, BLOCK_SIZE);
-        ide_read(cur_part->my_disk, sec_lba, io_buf, 1);
-        memcpy(buf_dst, io_buf+sec_off_bytes, chunk_size);
 
         buf_dst += chunk_size;
         file->fd_pos += chunk_size;
         bytes_read += chunk_size;
         size_left -= chunk_size;
     }
-    sys_free(all_blocks);
+    file_readahead(file, file->fd_pos - bytes_read);
     sys_free(io_buf);
     return bytes_read;
 }
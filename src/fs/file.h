@@ -4,12 +4,16 @@
 #include "ide.h"
 #include "dir.h"
 #include "global.h"
+#include "bcache.h"
 
 // 文件结构
 struct file {
     uint32_t fd_pos; // 记录当前文件操作的偏移地址, 以 0 为起始, 最大为文件大小 - 1
     uint32_t fd_flag;
     struct inode* fd_inode;
+    uint32_t ra_pos;  // 上次读结束的位置, 本次从这里读就是顺序读
+    uint32_t ra_size; // 预读窗口的块数, 顺序读时逐次翻倍, 跳转后复位
+    uint32_t ra_end;  // 已发出预读的块索引上界(不含)
 };
 
 // 标准输入输出描述符
@@ -19,19 +23,20 @@ enum std_fd {
     stderr_no  // 2 标准错误
 };
 
-// 位图类型
-enum bitmap_type {
-    INODE_BITMAP, // inode 位图
-    BLOCK_BITMAP  // 块位图
-};
-
 #define MAX_FILE_OPEN 32 // 系统可打开的最大文件数
+#define RA_MIN_BLOCKS 4  // 预读窗口的初始块数
+#define RA_MAX_SECS (BCACHE_BUFS / 4) // 预读窗口的最大扇区数, 只占缓存的一部分, 以免挤掉元数据扇区
 
 extern struct file file_table[MAX_FILE_OPEN];
+bool disk_bitmap_test(struct partition* part, struct disk_bitmap* dbm, uint32_t bit_idx);
+void disk_bitmap_set(struct partition* part, struct disk_bitmap* dbm, uint32_t bit_idx, int8_t value);
+int32_t disk_bitmap_scan(struct partition* part, struct disk_bitmap* dbm, uint32_t start_idx, uint32_t end_idx);
 int32_t inode_bitmap_alloc(struct partition* part);
 int32_t block_bitmap_alloc(struct partition* part);
+uint32_t block_lba_to_idx(struct partition* part, uint32_t block_lba);
+void block_bitmap_free(struct partition* part, uint32_t block_lba);
+int32_t block_bitmap_alloc_run(struct partition* part, uint32_t goal_lba, uint32_t max_cnt, uint32_t* cnt);
 int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag);
-void bitmap_sync(struct partition* part, uint32_t bit_idx, uint8_t btmp);
 int32_t get_free_slot_in_global(void);
 int32_t pcb_fd_install(int32_t globa_fd_idx);
 int32_t file_open(uint32_t inode_no, uint8_t flag);
@@ -11,10 +11,14 @@
 #include "stdio-kernel.h"
 #include "string.h"
 #include "super_block.h"
+#include "bcache.h"
+#include "dcache.h"
 #include "console.h"
 #include "keyboard.h"
 #include "ioqueue.h"
+#include "pipe.h"
 struct partition* cur_part; // 默认情况下操作的是哪个分区
+struct slab_cache sector_buf_slab; // 读写单个扇区时用的缓冲区
 
 
 // 在分区链表中找到名为 part_name 的分区, 并将其指针赋值给 cur_part
@@ -26,7 +30,7 @@ static bool mount_partition(struct list_elem* pelem, int arg) {
         struct disk* hd = cur_part->my_disk;
 
         // sb_buf 用来存储从硬盘上读入的超级块
-        struct super_block* sb_buf = (struct super_block*)sys_malloc(SECTOR_SIZE);
+        struct super_block* sb_buf = (struct super_block*)slab_alloc(&sector_buf_slab);
 
         // 在内存中创建分区 cur_part 的超级块
         cur_part->sb = (struct super_block*)sys_malloc(sizeof(struct super_block));
@@ -36,30 +40,24 @@ static bool mount_partition(struct list_elem* pelem, int arg) {
 
         // 读入超级块
         memset(sb_buf, 0, SECTOR_SIZE);
-        ide_read(hd, cur_part->start_lba+1, sb_buf, 1);
+        bcache_read(hd, cur_part->start_lba+1, sb_buf, 1);
 
         // 把 sb_buf 中超级块的信息复制到分区的超级块 sb 中
         memcpy(cur_part->sb, sb_buf, sizeof(struct super_block));
 
-        // 将硬盘上的块位图读入到内存
-        cur_part->block_bitmap.bits = (uint8_t*)sys_malloc(sb_buf->block_bitmap_sects*SECTOR_SIZE);
-        if (cur_part->block_bitmap.bits == NULL) {
-            PANIC("alloc memory failed!");
-        }
-        cur_part->block_bitmap.btmp_bytes_len = sb_buf->block_bitmap_sects * SECTOR_SIZE;
-        // 从硬盘上读入块位图到分区的 block_bitmap.bits
-        ide_read(hd, sb_buf->block_bitmap_lba, cur_part->block_bitmap.bits, sb_buf->block_bitmap_sects);
+        // 位图不整体读入内存, 只记下其位置, 用到哪个扇区时再经扇区缓存读入
+        cur_part->block_bitmap.bits_lba = sb_buf->block_bitmap_lba;
+        cur_part->block_bitmap.sects = sb_buf->block_bitmap_sects;
+        cur_part->block_bitmap.summary_lba = sb_buf->block_summary_lba;
+        cur_part->inode_bitmap.bits_lba = sb_buf->inode_bitmap_lba;
+        cur_part->inode_bitmap.sects = sb_buf->inode_bitmap_sects;
+        cur_part->inode_bitmap.summary_lba = sb_buf->inode_summary_lba;
+        slab_free(&sector_buf_slab, sb_buf);
 
-        // 将硬盘上的 inode 位图读入到内存
-        cur_part->inode_bitmap.bits = (uint8_t*)sys_malloc(sb_buf->inode_bitmap_sects*SECTOR_SIZE);
-        if (cur_part->inode_bitmap.bits == NULL) {
-            PANIC("alloc memory failed!");
-        }
-        cur_part->inode_bitmap.btmp_bytes_len = sb_buf->inode_bitmap_sects*SECTOR_SIZE;
-        // 从硬盘上读入 inode 位图到分区的 inode_bitmap.bits
-        ide_read(hd, sb_buf->inode_bitmap_lba, cur_part->inode_bitmap.bits, sb_buf->inode_bitmap_sects);
+        cur_part->block_cursor = 0;
+        cur_part->inode_cursor = 0;
+        lock_init(&cur_part->alloc_lock);
 
-        list_init(&cur_part->open_inodes);
         printk("mount %s done!\n", part->name);
 
         return true; // 使 list_traversal 停止遍历
@@ -67,43 +65,92 @@ static bool mount_partition(struct list_elem* pelem, int arg) {
     return false; // 使 list_traversal 继续遍历
 }
 
+// 将位图 bits 中第 bit_len 位起直到末扇区结束的各位置 1, 超出实际个数的部分视为已占用
+static void bitmap_format_tail(uint8_t* bits, uint32_t bit_len, uint32_t sects) {
+    uint32_t bit_idx = bit_len;
+    while (bit_idx % 8) {
+        bits[bit_idx / 8] |= 1 << (bit_idx % 8);
+        bit_idx++;
+    }
+    memset(&bits[bit_idx / 8], 0xff, sects * SECTOR_SIZE - bit_idx / 8);
+}
+
+// 统计位图 bits 每个扇区中的空闲位数, 作为汇总表写入硬盘的 summary_lba 处
+static void bitmap_summary_write(struct disk* hd, uint8_t* bits, uint32_t sects, uint32_t summary_lba) {
+    uint32_t summary_sects = DIV_ROUND_UP(sects, SUMMARY_PER_SECTOR);
+    uint16_t* summary = (uint16_t*)sys_malloc(summary_sects * SECTOR_SIZE);
+    if (summary == NULL) {
+        PANIC("bitmap_summary_write: sys_malloc for summary failed");
+    }
+    memset(summary, 0, summary_sects * SECTOR_SIZE);
+    uint32_t byte_idx = 0;
+    while (byte_idx < sects * SECTOR_SIZE) {
+        uint8_t byte = bits[byte_idx];
+        uint8_t bit_idx = 0;
+        while (bit_idx < 8) {
+            if (!(byte & (1 << bit_idx))) {
+                summary[byte_idx / SECTOR_SIZE]++;
+            }
+            bit_idx++;
+        }
+        byte_idx++;
+    }
+    ide_write(hd, summary_lba, summary, summary_sects);
+    sys_free(summary);
+}
+
 // 格式化分区, 也就是初始化分区的元信息, 创建文件系统
-static void partition_format(struct partition* part) {
-    // 为方便实现, 一个块大小是一扇区
+// 数据区的块大小为 block_size 字节, 须是扇区大小的 2 的幂倍且不超过 MAX_BLOCK_SIZE,
+// 引导块、超级块、位图和 inode 数组仍以扇区为单位存放.
+// inode_cnt 为分区的 inode 总数, 即最多能创建的文件数, 为 0 时按分区大小每 BYTES_PER_INODE 字节配一个
+static void partition_format(struct partition* part, uint32_t block_size, uint32_t inode_cnt) {
+    ASSERT(block_size >= SECTOR_SIZE && block_size <= MAX_BLOCK_SIZE && (block_size & (block_size - 1)) == 0);
+    uint32_t block_secs = block_size / SECTOR_SIZE;
+    if (inode_cnt == 0) {
+        inode_cnt = part->sec_cnt / (BYTES_PER_INODE / SECTOR_SIZE);
+    }
+    // 凑成 inode 数组扇区的整数倍, 至少放得下根目录
+    inode_cnt = DIV_ROUND_UP(inode_cnt > 0 ? inode_cnt : 1, INODES_PER_SECTOR) * INODES_PER_SECTOR;
     uint32_t boot_sector_sects = 1;
     uint32_t super_block_sects = 1;
-    // I 结点位图占用的扇区数, 最多支持 4096 个文件
-    uint32_t inode_bitmap_sects = DIV_ROUND_UP(MAX_FILES_PER_PART, BITS_PER_SECTOR);    // inode 位图占用的扇区数
-    uint32_t inode_table_sects = DIV_ROUND_UP(((sizeof(struct inode) * MAX_FILES_PER_PART)), SECTOR_SIZE);  // inode_table 数组占用的扇区数
-    uint32_t used_sects = boot_sector_sects + super_block_sects + inode_bitmap_sects + inode_table_sects;
+    uint32_t inode_bitmap_sects = DIV_ROUND_UP(inode_cnt, BITS_PER_SECTOR);    // inode 位图占用的扇区数
+    uint32_t inode_summary_sects = DIV_ROUND_UP(inode_bitmap_sects, SUMMARY_PER_SECTOR); // inode 位图汇总表占用的扇区数
+    uint32_t inode_table_sects = DIV_ROUND_UP(((INODE_DISK_SLOT * inode_cnt)), SECTOR_SIZE);  // inode_table 数组占用的扇区数
+    uint32_t used_sects = boot_sector_sects + super_block_sects + inode_bitmap_sects + inode_summary_sects + inode_table_sects;
     uint32_t free_sects = part->sec_cnt - used_sects;   // 分区总扇区 - 使用的扇区 = 可用的扇区
 
-    // 简单处理块位图占据的扇区数
+    // 简单处理块位图及其汇总表占据的扇区数, 位图中每一位对应一个块
     uint32_t block_bitmap_sects;
-    block_bitmap_sects = DIV_ROUND_UP(free_sects, BITS_PER_SECTOR);
+    block_bitmap_sects = DIV_ROUND_UP(free_sects / block_secs, BITS_PER_SECTOR);
+    uint32_t block_summary_sects = DIV_ROUND_UP(block_bitmap_sects, SUMMARY_PER_SECTOR);
     // block_bitmap_bit_len 位图中位的长度, 可用块的数量
-    uint32_t block_bitmap_bit_len = free_sects - block_bitmap_sects;
+    uint32_t block_bitmap_bit_len = (free_sects - block_bitmap_sects - block_summary_sects) / block_secs;
     block_bitmap_sects = DIV_ROUND_UP(block_bitmap_bit_len, BITS_PER_SECTOR);
+    block_summary_sects = DIV_ROUND_UP(block_bitmap_sects, SUMMARY_PER_SECTOR);
 
     // 超级块初始化
     struct super_block sb;
-    sb.magic = 0x19590318;
+    sb.magic = FS_MAGIC;
     sb.sec_cnt = part->sec_cnt;
-    sb.inode_cnt = MAX_FILES_PER_PART;
+    sb.inode_cnt = inode_cnt;
     sb.part_lba_base = part->start_lba;
     // 第 0 块是引导块, 第 1 块是超级块
     sb.block_bitmap_lba = sb.part_lba_base + 2;
     sb.block_bitmap_sects = block_bitmap_sects;
+    sb.block_summary_lba = sb.block_bitmap_lba + sb.block_bitmap_sects;
 
-    sb.inode_bitmap_lba = sb.block_bitmap_lba + sb.block_bitmap_sects;
+    sb.inode_bitmap_lba = sb.block_summary_lba + block_summary_sects;
     sb.inode_bitmap_sects = inode_bitmap_sects;
+    sb.inode_summary_lba = sb.inode_bitmap_lba + sb.inode_bitmap_sects;
 
-    sb.inode_table_lba = sb.inode_bitmap_lba + sb.inode_bitmap_sects;
+    sb.inode_table_lba = sb.inode_summary_lba + inode_summary_sects;
     sb.inode_table_sects = inode_table_sects;
 
     sb.data_start_lba = sb.inode_table_lba + sb.inode_table_sects;
     sb.root_inode_no = 0;   // 根目录的inode编号是 0
     sb.dir_entry_size = sizeof(struct dir_entry);
+    sb.features = FS_FEATURE_EXTENTS | FS_FEATURE_INLINE_DATA;
+    sb.block_size = block_size;
 
     printk("%s info:\n", part->name);
     printk("   magic:0x%x\n", sb.magic);
@@ -112,43 +159,43 @@ static void partition_format(struct partition* part) {
     printk("   inode_cnt:0x%x\n", sb.inode_cnt);
     printk("   block_bitmap_lba:0x%x\n", sb.block_bitmap_lba);
     printk("   block_bitmap_sectors:0x%x\n", sb.block_bitmap_sects);
+    printk("   block_summary_lba:0x%x\n", sb.block_summary_lba);
     printk("   inode_bitmap_lba:0x%x\n", sb.inode_bitmap_lba);
     printk("   inode_bitmap_sectors:0x%x\n", sb.inode_bitmap_sects);
+    printk("   inode_summary_lba:0x%x\n", sb.inode_summary_lba);
     printk("   inode_table_lba:0x%x\n", sb.inode_table_lba);
     printk("   inode_table_sectors:0x%x\n", sb.inode_table_sects);
     printk("   data_start_lba:0x%x\n", sb.data_start_lba);
+    printk("   features:0x%x\n", sb.features);
+    printk("   block_size:0x%x\n", sb.block_size);
 
+    // 格式化发生在挂载之前, 分区的扇区尚未进入缓存, 大块的元信息直接写硬盘
     struct disk* hd = part->my_disk;
 // 1 将超级块写入本分区的 1 扇区
     ide_write(hd, part->start_lba+1, &sb, 1);
     printk("    super_block_lba:0x%x\n", part->start_lba+1);
 
-    // 找出数据量最大的元信息, 用其尺寸做存储缓冲区
-    uint32_t buf_size = (sb.block_bitmap_sects >= sb.inode_bitmap_sects ? sb.block_bitmap_sects : sb.inode_bitmap_sects);
-    buf_size = (buf_size >= sb.inode_table_sects ? buf_size : sb.inode_table_sects) * SECTOR_SIZE;
+    // 找出数据量最大的位图, 用其尺寸做存储缓冲区, inode 数组可能很大, 分段写入
+    uint32_t buf_size = (sb.block_bitmap_sects >= sb.inode_bitmap_sects ? sb.block_bitmap_sects : sb.inode_bitmap_sects) * SECTOR_SIZE;
+    // 还要能容纳根目录的第 1 个块
+    buf_size = buf_size >= block_size ? buf_size : block_size;
     uint8_t* buf = (uint8_t*)sys_malloc(buf_size);
 
-// 2 将块位图初始化并写入 sb.block_bitmap_lba
+// 2 将块位图初始化并写入 sb.block_bitmap_lba, 其汇总表写入 sb.block_summary_lba
     // 初始化块位图 block_bitmap
+    memset(buf, 0, buf_size);
     buf[0] |= 0x01; // 第 1 个块预留给根目录, 位图中先占位
-    uint32_t block_bitmap_last_byte = block_bitmap_bit_len / 8;
-    uint8_t block_bitmap_last_bit = block_bitmap_bit_len % 8;
-    // last_size 是位图所在最后一个扇区中, 不足一扇区的其余部分
-    uint32_t last_size = SECTOR_SIZE - (block_bitmap_last_byte % SECTOR_SIZE);
-    // 1 先将位图最后一字节到其所在的扇区的结束全置为 1, 即超出实际块数的部分直接置为已占用
-    memset(&buf[block_bitmap_last_byte], 0xff, last_size);
-    // 2 再将上一步中覆盖的最后一字节内的有效位重新置 0
-    uint8_t bit_idx = 0;
-    while (bit_idx <= block_bitmap_last_bit) {
-        buf[block_bitmap_last_byte] &= ~(1 << bit_idx++);
-    }
+    bitmap_format_tail(buf, block_bitmap_bit_len, sb.block_bitmap_sects);
     ide_write(hd, sb.block_bitmap_lba, buf, sb.block_bitmap_sects);
+    bitmap_summary_write(hd, buf, sb.block_bitmap_sects, sb.block_summary_lba);
 
-// 3 将 inode 位图初始化并写入 sb.inode_bitmap_lba
+// 3 将 inode 位图初始化并写入 sb.inode_bitmap_lba, 其汇总表写入 sb.inode_summary_lba
     // 先清空缓冲区
     memset(buf, 0, buf_size);
     buf[0] |= 0x1; // 第 0 个 inode 分给了根目录
+    bitmap_format_tail(buf, sb.inode_cnt, sb.inode_bitmap_sects);
     ide_write(hd, sb.inode_bitmap_lba, buf, sb.inode_bitmap_sects);
+    bitmap_summary_write(hd, buf, sb.inode_bitmap_sects, sb.inode_summary_lba);
 
 // 4 将 inode 数组初始化并写入 sb.inode_table_lba
     // 准备写 inode_table 中的第 0 项, 即根目录所在的 inode
@@ -157,7 +204,18 @@ static void partition_format(struct partition* part) {
     i->i_size = sb.dir_entry_size * 2; // . 和 ..
     i->i_no = 0; // 根目录占 inode 数组中第 0 个 inode
     i->i_sectors[0] = sb.data_start_lba;
-    ide_write(hd, sb.inode_table_lba, buf, sb.inode_table_sects);
+    ide_write(hd, sb.inode_table_lba, buf, 1);
+    // 其余扇区全部清 0, 每次最多写一个缓冲区
+    memset(buf, 0, SECTOR_SIZE);
+    uint32_t table_sec_idx = 1;
+    while (table_sec_idx < sb.inode_table_sects) {
+        uint32_t secs = sb.inode_table_sects - table_sec_idx;
+        if (secs > buf_size / SECTOR_SIZE) {
+            secs = buf_size / SECTOR_SIZE;
+        }
+        ide_write(hd, sb.inode_table_lba + table_sec_idx, buf, secs);
+        table_sec_idx += secs;
+    }
 
 // 5 将根目录写入 sb.data_start_lba
     // 写入根目录的两个目录项 . 和 ..
@@ -174,7 +232,7 @@ static void partition_format(struct partition* part) {
     p_de->i_no = 0; // 根目录的父目录依然是根目录自己
     p_de->f_type = FT_DIRECTORY;
     // sb.data_start_lba 已经分配给了根目录, 里面是根目录的目录项
-    ide_write(hd, sb.data_start_lba, buf, 1);
+    ide_write(hd, sb.data_start_lba, buf, block_secs);
 
     printk("    root_dir_lba:0x%x\n", sb.data_start_lba);
     printk("%s format done\n", part->name);
@@ -221,6 +279,26 @@ int32_t path_depth_cnt(char* pathname) {
     return depth;
 }
 
+// 打开 inode 号为 inode_no 的目录, 根目录直接返回 root_dir
+static struct dir* dir_open_ino(uint32_t inode_no) {
+    if (inode_no == cur_part->sb->root_inode_no) {
+        return &root_dir;
+    }
+    return dir_open(cur_part, inode_no);
+}
+
+// 在 inode 号为 dir_ino 的目录中查找名为 name 的文件, 找到后将目录项存入 dir_e
+// 目录项缓存命中时不必打开该目录
+static bool lookup_dir_entry(uint32_t dir_ino, const char* name, struct dir_entry* dir_e) {
+    if (dcache_lookup(cur_part, dir_ino, name, dir_e)) {
+        return dir_e->f_type != FT_UNKNOWN;
+    }
+    struct dir* dir = dir_open_ino(dir_ino);
+    bool found = search_dir_entry(cur_part, dir, name, dir_e);
+    dir_close(dir);
+    return found;
+}
+
 // 搜索文件 pathname, 若找到则返回其 inode 号, 否则返回 -1
 static int search_file(const char* pathname, struct path_search_record* searched_record) {
     // 如果待查找的是根目录, 为避免下面无用的查找, 直接返回已知根目录信息
@@ -236,15 +314,16 @@ static int search_file(const char* pathname, struct path_search_record* searched
     // 保证 pathname 至少是这样的路径 /x, 且小于最大长度
     ASSERT(pathname[0] == '/' && path_len > 1 && path_len < MAX_PATH_LEN);
     char* sub_path = (char*)pathname;
-    struct dir* parent_dir = &root_dir;
     struct dir_entry dir_e;
 
     // 记录路径解析出来的各级名称
     char name[MAX_FILE_NAME_LEN] = {0};
 
-    searched_record->parent_dir = parent_dir;
+    searched_record->parent_dir = &root_dir;
     searched_record->file_type = FT_UNKNOWN;
-    uint32_t parent_inode_no = 0; // 父目录的 inode 号
+    // 逐级查找时只记录 inode 号, 返回前才打开 searched_record->parent_dir
+    uint32_t dir_inode_no = cur_part->sb->root_inode_no; // 当前所在目录的 inode 号
+    uint32_t parent_inode_no = 0;                        // 父目录的 inode 号
 
     sub_path = path_parse(sub_path, name);
     while (name[0]) { // 若第一个字符就是结束符, 结束循环
@@ -256,7 +335,7 @@ static int search_file(const char* pathname, struct path_search_record* searched
         strcat(searched_record->searched_path, name);
 
         // 在所给的目录中查找文件
-        if (search_dir_entry(cur_part, parent_dir, name, &dir_e)) {
+        if (lookup_dir_entry(dir_inode_no, name, &dir_e)) {
             memset(name, 0, MAX_FILE_NAME_LEN);
             // 若 sub_path 不等于 NULL, 也就是未结束时继续拆分路径
             if (sub_path) {
@@ -265,25 +344,23 @@ static int search_file(const char* pathname, struct path_search_record* searched
 
             // 如果被打开的是目录
             if (FT_DIRECTORY == dir_e.f_type) {
-                parent_inode_no = parent_dir->inode->i_no;
-                dir_close(parent_dir);
-                parent_dir = dir_open(cur_part, dir_e.i_no); // 更新父目录
-                searched_record->parent_dir = parent_dir;
+                parent_inode_no = dir_inode_no;
+                dir_inode_no = dir_e.i_no; // 更新父目录
                 continue;
             } else if (FT_REGULAR == dir_e.f_type) { // 若是普通文件
+                searched_record->parent_dir = dir_open_ino(dir_inode_no);
                 searched_record->file_type = FT_REGULAR;
                 return dir_e.i_no;
             }
         } else { // 若找不到, 则返回 -1
+            searched_record->parent_dir = dir_open_ino(dir_inode_no);
             return -1;
         }
     }
 
     // 执行到此, 必然是遍历了完整路径并且查找的文件或目录只有同名目录存在
-    dir_close(searched_record->parent_dir);
-
     // 保存被查找目录的直接父目录
-    searched_record->parent_dir = dir_open(cur_part, parent_inode_no);
+    searched_record->parent_dir = dir_open_ino(parent_inode_no);
     searched_record->file_type = FT_DIRECTORY;
     return dir_e.i_no;
 }
@@ -364,12 +441,8 @@ int32_t sys_close(int32_t fd) {
 	if (fd > 2) {
 		uint32_t global_fd = fd_local2global(fd);
 		if (is_pipe(fd)) {
-			/* 如果此管道上的描述符都被关闭,释放管道的环形缓冲区 */
-			if (--file_table[global_fd].fd_pos == 0) {
-				mfree_page(PF_KERNEL, file_table[global_fd].fd_inode, 1);
-				file_table[global_fd].fd_inode = NULL;
-		}
-		ret = 0;
+			pipe_release(global_fd);
+			ret = 0;
 		} else {
 			ret = file_close(&file_table[global_fd]);
 		}
@@ -489,23 +562,16 @@ int32_t sys_unlink(const char* pathname) {
         dir_close(searched_record.parent_dir);
         return -1;
     }
-    // 检查是否在已打开文件列表(文件表)中
-    uint32_t file_idx = 0;
-    while (file_idx < MAX_FILE_OPEN) {
-        if (file_table[file_idx].fd_inode != NULL && (uint32_t)inode_no == file_table[file_idx].fd_inode->i_no) {
-            break;
-        }
-        file_idx++;
-    }
-    if (file_idx < MAX_FILE_OPEN) {
+    // 检查 inode 是否正被打开, 除文件表外, 正在运行的程序还通过 exec_inode 打开着自己的可执行文件,
+    // 此时回收其数据块, 之后缺页时读入的就是别的文件的内容
+    if (inode_in_use(cur_part, inode_no)) {
         dir_close(searched_record.parent_dir);
         printk("file %s is in use, not allow to delete!\n", pathname);
         return -1;
     }
-    ASSERT(file_idx == MAX_FILE_OPEN);
 
     // 为 delete_dir_entry 申请缓冲区
-    void* io_buf = sys_malloc(SECTOR_SIZE+SECTOR_SIZE);
+    void* io_buf = sys_malloc(cur_part->sb->block_size*2);
     if (io_buf == NULL) {
         dir_close(searched_record.parent_dir);
         printk("sys_unlink: malloc for io_buf failed\n");
@@ -523,7 +589,8 @@ int32_t sys_unlink(const char* pathname) {
 // 创建目录 pathname, 成功返回 0, 失败返回 -1
 int32_t sys_mkdir(const char* pathname) {
     uint8_t rollback_step = 0; // 用于操作失败时回滚各资源状态
-    void* io_buf = sys_malloc(SECTOR_SIZE*2);
+    uint32_t io_buf_size = cur_part->sb->block_size*2;
+    void* io_buf = sys_malloc(io_buf_size);
     if (io_buf == NULL) {
         printk("sys_mkdir: sys_malloc for io_buf failed\n");
         return -1;
@@ -572,13 +639,11 @@ int32_t sys_mkdir(const char* pathname) {
         goto rollback;
     }
     new_dir_inode.i_sectors[0] = block_lba;
-    // 每分配一个块就将位图同步到硬盘
-    block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
+    block_bitmap_idx = block_lba_to_idx(cur_part, block_lba);
     ASSERT(block_bitmap_idx != 0);
-    bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
 
     // 将当前目录的目录项 '.' 和 '..' 写入目录
-    memset(io_buf, 0, SECTOR_SIZE*2); // 清空 io_buf
+    memset(io_buf, 0, io_buf_size); // 清空 io_buf
     struct dir_entry* p_de = (struct dir_entry*)io_buf;
 
     // 初始化当前目录 '.'
@@ -591,7 +656,7 @@ int32_t sys_mkdir(const char* pathname) {
     memcpy(p_de->filename, "..", 2);
     p_de->i_no = parent_dir->inode->i_no;
     p_de->f_type = FT_DIRECTORY;
-    ide_write(cur_part->my_disk, new_dir_inode.i_sectors[0], io_buf, 1);
+    bcache_write(cur_part->my_disk, new_dir_inode.i_sectors[0], io_buf, BLOCK_SECS(cur_part->sb));
 
     new_dir_inode.i_size = 2 * cur_part->sb->dir_entry_size;
 
@@ -599,7 +664,7 @@ int32_t sys_mkdir(const char* pathname) {
     struct dir_entry new_dir_entry;
     memset(&new_dir_entry, 0, sizeof(struct dir_entry));
     create_dir_entry(dirname, inode_no, FT_DIRECTORY, &new_dir_entry);
-    memset(io_buf, 0, SECTOR_SIZE*2); // 清空 io_buf
+    memset(io_buf, 0, io_buf_size); // 清空 io_buf
     if (!sync_dir_entry(parent_dir, &new_dir_entry, io_buf)) {
         printk("sys_mkdir: sync_dir_entry to disk failed\n");
         rollback_step = 2;
@@ -607,15 +672,10 @@ int32_t sys_mkdir(const char* pathname) {
     }
 
     // 父目录的 inode 同步到硬盘
-    memset(io_buf, 0, SECTOR_SIZE*2);
-    inode_sync(cur_part, parent_dir->inode, io_buf);
+    inode_sync(cur_part, parent_dir->inode);
     
     // 将新创建目录的 inode 同步到硬盘
-    memset(io_buf, 0, SECTOR_SIZE*2);
-    inode_sync(cur_part, &new_dir_inode, io_buf);
-
-    // 将 inode 位图同步到硬盘
-    bitmap_sync(cur_part, inode_no, INODE_BITMAP);
+    inode_sync(cur_part, &new_dir_inode);
 
     sys_free(io_buf);
 
@@ -627,7 +687,7 @@ int32_t sys_mkdir(const char* pathname) {
 rollback:
     switch (rollback_step) {
         case 2:
-            bitmap_set(&cur_part->inode_bitmap, inode_no, 0);
+            disk_bitmap_set(cur_part, &cur_part->inode_bitmap, inode_no, 0);
         case 1:
             dir_close(searched_record.parent_dir);
             break;
@@ -719,10 +779,10 @@ static uint32_t get_parent_dir_inode_nr(uint32_t child_inode_nr, void* io_buf) {
     uint32_t block_lba = child_dir_inode->i_sectors[0];
     ASSERT(block_lba >= cur_part->sb->data_start_lba);
     inode_close(child_dir_inode);
-    ide_read(cur_part->my_disk, block_lba, io_buf, 1);
+    bcache_read(cur_part->my_disk, block_lba, io_buf, 1);
     struct dir_entry* dir_e = (struct dir_entry*)io_buf;
     // 第 0 个目录项是 ".", 第 1 个目录项是 ".."
-    ASSERT(dir_e[1].i_no < 4096 && dir_e[1].f_type == FT_DIRECTORY);
+    ASSERT(dir_e[1].i_no < cur_part->sb->inode_cnt && dir_e[1].f_type == FT_DIRECTORY);
     return dir_e[1].i_no; // 返回父目录的 inode 编号
 }
 
@@ -731,33 +791,26 @@ static uint32_t get_parent_dir_inode_nr(uint32_t child_inode_nr, void* io_buf) {
 // 成功返回 0, 失败返回 -1
 static int get_child_dir_name(uint32_t p_inode_nr, uint32_t c_inode_nr, char* path, void* io_buf) {
     struct inode* parent_dir_inode = inode_open(cur_part, p_inode_nr);
-    // 填充 all_blocks, 将该目录的所占扇区地址全部写入 all_blocks
+    // 目录只用到直接块和一级间接块, 块地址通过块索引逐个查得
     uint8_t block_idx = 0;
-    uint32_t all_blocks[140] = {0}, block_cnt = 12;
-    while (block_idx < 12) {
-        all_blocks[block_idx] = parent_dir_inode->i_sectors[block_idx];
-        block_idx++;
-    }
-    if (parent_dir_inode->i_sectors[12]) {
-        ide_read(cur_part->my_disk, parent_dir_inode->i_sectors[12], all_blocks+12, 1);
-        block_cnt = 140;
-    }
-    inode_close(parent_dir_inode);
+    uint32_t block_cnt = parent_dir_inode->i_sectors[12] != 0 ? 140 : 12;
 
     struct dir_entry* dir_e = (struct dir_entry*)io_buf;
     uint32_t dir_entry_size = cur_part->sb->dir_entry_size;
-    uint32_t dir_entrys_per_sec = (512 / dir_entry_size);
+    uint32_t dir_entrys_per_block = cur_part->sb->block_size / dir_entry_size;
     block_idx = 0;
     // 遍历所有块
     while (block_idx < block_cnt) {
-        if (all_blocks[block_idx]) {
-            ide_read(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
-            uint8_t dir_e_idx = 0;
+        uint32_t block_lba = inode_bmap(cur_part, parent_dir_inode, block_idx);
+        if (block_lba) {
+            bcache_read(cur_part->my_disk, block_lba, io_buf, BLOCK_SECS(cur_part->sb));
+            uint32_t dir_e_idx = 0;
             // 遍历每个目录项
-            while (dir_e_idx < dir_entrys_per_sec) {
+            while (dir_e_idx < dir_entrys_per_block) {
                 if ((dir_e + dir_e_idx)->i_no == c_inode_nr) {
                     strcat(path, "/");
                     strcat(path, (dir_e+dir_e_idx)->filename);
+                    inode_close(parent_dir_inode);
                     return 0;
                 }
                 dir_e_idx++;
@@ -765,6 +818,7 @@ static int get_child_dir_name(uint32_t p_inode_nr, uint32_t c_inode_nr, char* pa
         }
         block_idx++;
     }
+    inode_close(parent_dir_inode);
     return -1;
 }
 
@@ -773,7 +827,8 @@ static int get_child_dir_name(uint32_t p_inode_nr, uint32_t c_inode_nr, char* pa
 // 失败则返回 NULL
 char* sys_getcwd(char* buf, uint32_t size) {
     ASSERT(buf != NULL);
-    void* io_buf = sys_malloc(SECTOR_SIZE);
+    // get_child_dir_name 每次读入目录的 1 个块
+    void* io_buf = sys_malloc(cur_part->sb->block_size);
     if (io_buf == NULL) {
         return NULL;
     }
@@ -781,7 +836,7 @@ char* sys_getcwd(char* buf, uint32_t size) {
     struct task_struct* cur_thread = running_thread();
     int32_t parent_inode_nr = 0;
     int32_t child_inode_nr = cur_thread->cwd_inode_nr;
-    ASSERT(child_inode_nr >= 0 && child_inode_nr < 4096); // 最大支持 4096 个 inode
+    ASSERT(child_inode_nr >= 0 && (uint32_t)child_inode_nr < cur_part->sb->inode_cnt);
     // 若当前目录是根目录, 直接返回 '/'
     if (child_inode_nr == 0) {
         buf[0] = '/';
@@ -883,12 +938,19 @@ void sys_help(void) {
 void filesys_init() {
     uint8_t channel_no = 0, dev_no, part_idx = 0;
 
+    slab_cache_init(&sector_buf_slab, "sector_buf", SECTOR_SIZE, NULL);
+
     // sb_buf 用来存储从硬盘上读入的超级块
-    struct super_block* sb_buf = (struct super_block*)sys_malloc(SECTOR_SIZE);
+    struct super_block* sb_buf = (struct super_block*)slab_alloc(&sector_buf_slab);
 
     if (sb_buf == NULL) {
         PANIC("alloc memory failed!");
     }
+    bcache_init();
+    inode_cache_init();
+    dir_cache_init();
+    dcache_init();
+    pipe_init();
     printk("searching filesystem......\n");
     while (channel_no < channel_cnt) {
         dev_no = 0;
@@ -908,12 +970,12 @@ void filesys_init() {
                     // 读出分区的超级块, 根据魔数是否正确来判断是否存在文件系统
                     ide_read(hd, part->start_lba+1, sb_buf, 1);
 
-                    if (sb_buf->magic == 0x19590318) {
+                    if (sb_buf->magic == FS_MAGIC) {
                         printk("%s has filesystem\n", part->name);
                     } else { // 其它文件系统不支持, 一律按无文件系统处理
                         printk("formatting %s's partition %s......\n",
                             hd->name, part->name);
-                        partition_format(part);
+                        partition_format(part, FS_BLOCK_SIZE, 0);
                     }
                 }
                 part_idx++;
@@ -923,7 +985,7 @@ void filesys_init() {
         }
         channel_no++; // 下一通道
     }
-    sys_free(sb_buf);
+    slab_free(&sector_buf_slab, sb_buf);
 
     // 确定默认操作的分区
     char default_part[8] = "sdb1";
@@ -2,11 +2,14 @@
 #define __FS_FS_H
 #include "stdint.h"
 #include "ide.h"
+#include "slab.h"
 
-#define MAX_FILES_PER_PART 4096 // 每个分区所支持最大创建的文件数
+#define BYTES_PER_INODE 4096    // 格式化时按分区大小每这么多字节配一个 inode
 #define BITS_PER_SECTOR 4096    // 每扇区的位数
+#define SUMMARY_PER_SECTOR 256  // 每扇区汇总表可记录的位图扇区数
 #define SECTOR_SIZE 512         // 扇区字节大小
-#define BLOCK_SIZE SECTOR_SIZE  // 块字节大小
+#define MAX_BLOCK_SIZE 4096     // 块字节大小的上限, 块大小是扇区大小的 2 的幂倍
+#define FS_BLOCK_SIZE 4096      // 格式化分区时采用的块字节大小
 #define MAX_PATH_LEN 512        // 路径最大长度
 
 // 文件类型
@@ -48,6 +51,7 @@ struct stat {
 
 
 extern struct partition* cur_part;
+extern struct slab_cache sector_buf_slab; // 1 扇区大小的缓冲区
 void filesys_init(void);
 char* path_parse(char* pathname, char* name_store);
 int32_t path_depth_cnt(char* pathname);
@@ -9,222 +9,660 @@
 #include "stdio-kernel.h"
 #include "string.h"
 #include "super_block.h"
+#include "bcache.h"
 
 // 用来存储 inode 位置
 struct inode_position {
-    bool two_sec; // inode 是否跨扇区
     uint32_t sec_lba; // inode 所在的扇区号
     uint32_t off_size; // inode 在扇区内的字节偏移量
 };
 
 // 获取 inode 所在的扇区和扇区内的偏移量
+// 每个 inode 占 INODE_DISK_SLOT 字节, 扇区中正好放下整数个, inode 不会跨扇区
 static void inode_locate(struct partition* part, 
                          uint32_t inode_no, 
                          struct inode_position* inode_pos) {
     // inode_table 在硬盘上是连续的
-    ASSERT(inode_no < 4096);
+    ASSERT(inode_no < part->sb->inode_cnt);
     uint32_t inode_table_lba = part->sb->inode_table_lba;
 
-    uint32_t inode_size = sizeof(struct inode);
     // 第 inode_no 号 I 结点相对于 inode_table_lba 的字节偏移量
-    uint32_t off_size = inode_no * inode_size;
-    // 第 inode_no 号 I 结点相对于 inode_table_lba 的扇区偏移量
-    uint32_t off_sec = off_size / 512;
-    // 待查找的 inode 所在扇区中的起始地址
-    uint32_t off_size_in_sec = off_size % 512;
-    // 判断此 i 结点是否跨越 2 个扇区
-    uint32_t left_in_sec = 512 - off_size_in_sec;
-    if (left_in_sec < inode_size) {
-        // 若扇区内剩下的空间不足以容纳一个 inode, 必然是 I 结点跨越了 2 个扇区
-        inode_pos->two_sec = true;
-    } else { // 否则, 所查找的 inode 未跨扇区
-        inode_pos->two_sec = false;
+    uint32_t off_size = inode_no * INODE_DISK_SLOT;
+    inode_pos->sec_lba = inode_table_lba + off_size / SECTOR_SIZE;
+    inode_pos->off_size = off_size % SECTOR_SIZE;
+}
+
+static struct inode* inode_lookup(struct partition* part, uint32_t inode_no);
+
+// 串行化对 inode 表的写入, 拼整扇区时读到的 inode 位图才不会与写入的内容不一致
+static struct lock inode_table_lock;
+
+// 把 inode 去掉只存在于内存中的成员后, 填入硬盘上 inode 槽位大小的缓冲 slot
+static void inode_pack(struct inode* inode, uint8_t* slot) {
+    // 硬盘中的 inode 中的成员 inode_tag 和 i_open_cnts 是不需要的
+    // 它们只在内存中记录链表位置和被多少进程共享
+    struct inode* pure_inode = (struct inode*)slot;
+    memset(slot, 0, INODE_DISK_SLOT);
+    memcpy(pure_inode, inode, INODE_DISK_SIZE);
+
+    // 以下 inode 的三个成员只存在于内存中
+    // 现在将 inode 同步到硬盘, 清掉这三项即可
+    pure_inode->i_open_cnts = 0;
+    pure_inode->write_deny = false;
+    pure_inode->inode_tag.prev = pure_inode->inode_tag.next = NULL;
+}
+
+// 在内存中拼出 inode 所在扇区的完整内容存入 sec_buf: 同扇区的其它 inode 要么空闲(硬盘上全为 0),
+// 要么在 inode 缓存中, 此时整扇区直接写入缓存即可, 不必先读出. 有 inode 不在内存中时返回 false
+static bool inode_sector_build(struct partition* part, struct inode* inode, uint8_t* sec_buf) {
+    uint32_t first_no = inode->i_no / INODES_PER_SECTOR * INODES_PER_SECTOR;
+    // inode 位图经扇区缓存读取, 可能阻塞, 要在关中断之前查好
+    bool in_use[INODES_PER_SECTOR];
+    uint32_t slot_idx = 0;
+    while (slot_idx < INODES_PER_SECTOR) {
+        uint32_t inode_no = first_no + slot_idx;
+        in_use[slot_idx] = inode_no < part->sb->inode_cnt && \
+                           disk_bitmap_test(part, &part->inode_bitmap, inode_no);
+        slot_idx++;
     }
 
-    inode_pos->sec_lba = inode_table_lba + off_sec;
-    inode_pos->off_size = off_size_in_sec;
+    slot_idx = 0;
+    bool built = true;
+    enum intr_status old_status = intr_disable();
+    while (built && slot_idx < INODES_PER_SECTOR) {
+        uint32_t inode_no = first_no + slot_idx;
+        uint8_t* slot = sec_buf + slot_idx * INODE_DISK_SLOT;
+        struct inode* sibling;
+        if (inode_no == inode->i_no) {
+            inode_pack(inode, slot);
+        } else if (!in_use[slot_idx]) {
+            memset(slot, 0, INODE_DISK_SLOT);
+        } else if ((sibling = inode_lookup(part, inode_no)) != NULL) {
+            inode_pack(sibling, slot);
+        } else {
+            built = false;
+        }
+        slot_idx++;
+    }
+    intr_set_status(old_status);
+    return built;
 }
 
 // 将 inode 写入到分区 part
-void inode_sync(struct partition* part, struct inode* inode, void* io_buf) {
-    uint8_t inode_no = inode->i_no;
+// 同扇区的 inode 都在内存中时整扇区一次写入, 否则只改写该 inode 的槽位
+void inode_sync(struct partition* part, struct inode* inode) {
     struct inode_position inode_pos;
     // inode 位置信息会存入 inode_pos
-    inode_locate(part, inode_no, &inode_pos);
+    inode_locate(part, inode->i_no, &inode_pos);
     ASSERT(inode_pos.sec_lba <= (part->start_lba + part->sec_cnt));
 
-    // 硬盘中的 inode 中的成员 inode_tag 和 i_open_cnts 是不需要的
-    // 它们只在内存中记录链表位置和被多少进程共享
-    struct inode pure_inode;
-    memcpy(&pure_inode, inode, sizeof(struct inode));
-
-    // 以下 inode 的三个成员只存在于内存中
-    // 现在将 inode 同步到硬盘, 清掉这三项即可
-    pure_inode.i_open_cnts = 0;
-    pure_inode.write_deny = false;
-    pure_inode.inode_tag.prev = pure_inode.inode_tag.next = NULL;
-
-    // io_buf 是用于硬盘 io 的缓冲区
-    char* inode_buf = (char*)io_buf;
-    if (inode_pos.two_sec) {
-        // 若是跨了两个扇区, 就要读出两个扇区再写入两个扇区
-        // 读写硬盘是以扇区为单位, 若写入的数据小于一扇区
-        // 要将原硬盘上的内容先读出来再和新数据拼成一扇区后再写入
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
-        // 开始将待写入的 inode 拼入到这 2 个扇区中的相应位置
-        memcpy((inode_buf+inode_pos.off_size), &pure_inode, sizeof(struct inode));
-        // 将拼接好的数据再写入磁盘
-        ide_write(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
+    uint8_t* sec_buf = (uint8_t*)slab_alloc(&sector_buf_slab);
+    if (sec_buf == NULL) {
+        PANIC("inode_sync: slab_alloc for sec_buf failed");
+    }
+    lock_acquire(&inode_table_lock);
+    if (inode_sector_build(part, inode, sec_buf)) {
+        bcache_write(part->my_disk, inode_pos.sec_lba, sec_buf, 1);
     } else {
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
-        memcpy((inode_buf + inode_pos.off_size), &pure_inode, sizeof(struct inode));
-        ide_write(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
+        inode_pack(inode, sec_buf);
+        bcache_write_bytes(part->my_disk, inode_pos.sec_lba, inode_pos.off_size, sec_buf, INODE_DISK_SLOT);
+    }
+    lock_release(&inode_table_lock);
+    slab_free(&sector_buf_slab, sec_buf);
+}
+
+
+static struct list inode_hash[INODE_HASH_SIZE]; // 按 (分区, inode 号) 散列的 inode 缓存
+static struct list inode_lru;                   // 无人打开的 inode, 队首是最久未用的
+static uint32_t inode_lru_cnt;                  // inode_lru 中的 inode 数
+static struct slab_cache inode_slab;            // 内存中的 inode 结构
+
+// 初始化 inode 缓存
+void inode_cache_init(void) {
+    ASSERT(INODE_DISK_SIZE <= INODE_DISK_SLOT);
+    uint32_t idx = 0;
+    while (idx < INODE_HASH_SIZE) {
+        list_init(&inode_hash[idx++]);
     }
+    list_init(&inode_lru);
+    inode_lru_cnt = 0;
+    lock_init(&inode_table_lock);
+    slab_cache_init(&inode_slab, "inode", sizeof(struct inode), NULL);
+}
+
+// 计算 (part, inode_no) 所在的哈希桶
+static struct list* inode_bucket(struct partition* part, uint32_t inode_no) {
+    return &inode_hash[(inode_no ^ ((uint32_t)part >> 4)) % INODE_HASH_SIZE];
+}
+
+// 在缓存中查找 part 上编号为 inode_no 的 inode, 找不到返回 NULL
+static struct inode* inode_lookup(struct partition* part, uint32_t inode_no) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    struct list* bucket = inode_bucket(part, inode_no);
+    struct list_elem* elem = bucket->head.next;
+    while (elem != &bucket->tail) {
+        struct inode* inode = elem2entry(struct inode, inode_tag, elem);
+        if (inode->i_no == inode_no && inode->i_part == part) {
+            return inode;
+        }
+        elem = elem->next;
+    }
+    return NULL;
+}
+
+// 为 inode 分配内存, inode 要被所有任务共享, slab 总是位于内核空间
+struct inode* inode_alloc(void) {
+    return (struct inode*)slab_alloc(&inode_slab);
+}
+
+// 释放 inode_alloc 分配的 inode
+void inode_free(struct inode* inode) {
+    slab_free(&inode_slab, inode);
 }
 
+// 判断 part 上编号为 inode_no 的 inode 是否正被打开
+// 文件表中的文件和进程按需加载所用的可执行文件都对 inode 持有打开次数
+bool inode_in_use(struct partition* part, uint32_t inode_no) {
+    enum intr_status old_status = intr_disable();
+    struct inode* inode = inode_lookup(part, inode_no);
+    bool in_use = inode != NULL && inode->i_open_cnts > 0;
+    intr_set_status(old_status);
+    return in_use;
+}
+
+// 将新建的 inode 加入缓存
+void inode_cache_add(struct partition* part, struct inode* inode) {
+    enum intr_status old_status = intr_disable();
+    ASSERT(inode_lookup(part, inode->i_no) == NULL);
+    inode->i_part = part;
+    inode->i_deleted = false;
+    list_push(inode_bucket(part, inode->i_no), &inode->inode_tag);
+    intr_set_status(old_status);
+}
 
 // 根据 i 结点号返回相应的 i 结点
 struct inode* inode_open(struct partition* part, uint32_t inode_no) {
-    // 先在已打开的 inode 链表中找 inode, 此链表是为提速创建的缓冲区
-    struct list_elem* elem = part->open_inodes.head.next;
-    struct inode* inode_found;
-    while (elem != &part->open_inodes.tail) {
-        inode_found = elem2entry(struct inode, inode_tag, elem);
-        if (inode_found->i_no == inode_no) {
-            inode_found->i_open_cnts++;
-            return inode_found;
+    // 先在 inode 缓存中找, 无人打开的 inode 被再次打开时从 lru 队列中取出
+    enum intr_status old_status = intr_disable();
+    struct inode* inode_found = inode_lookup(part, inode_no);
+    if (inode_found != NULL) {
+        if (inode_found->i_open_cnts++ == 0) {
+            list_remove(&inode_found->lru_tag);
+            inode_lru_cnt--;
         }
-        elem = elem->next;
+        intr_set_status(old_status);
+        return inode_found;
     }
+    intr_set_status(old_status);
 
-    // 由于 open_inodes 链表中找不到, 从硬盘读入此 inode 并加入此链表
+    // 缓存中找不到, 从硬盘读入此 inode
     struct inode_position inode_pos;
 
     // inode 位置信息会存入 inode_pos
     // 包括 inode 所在扇区地址和扇区内的字节偏移量
     inode_locate(part, inode_no, &inode_pos);
 
-    // 为使通过 sys_malloc 创建的新 inode 被所有任务共享
-    // 需要将 inode 置于内核空间, 故需要临时将 cur_pbc->pgdir 置为 NULL
-    struct task_struct* cur = running_thread();
-    uint32_t* cur_pagedir_bak = cur->pgdir;
-    cur->pgdir = NULL;
-    // 以上三行代码完成后下面分配的内存将位于内核区
-    inode_found = (struct inode*)sys_malloc(sizeof(struct inode));
-    // 恢复 pgdir
-    cur->pgdir = cur_pagedir_bak;
-
-    char* inode_buf;
-    if (inode_pos.two_sec) { // 跨扇区的情况
-        inode_buf = (char*)sys_malloc(1024);
-
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
-    } else { // 未跨扇区
-        inode_buf = (char*)sys_malloc(512);
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
-    }
-    memcpy(inode_found, inode_buf+inode_pos.off_size, sizeof(struct inode));
-    
-    list_push(&part->open_inodes, &inode_found->inode_tag);
-    inode_found->i_open_cnts = 1;
+    inode_found = inode_alloc();
+    bcache_read_bytes(part->my_disk, inode_pos.sec_lba, inode_pos.off_size, inode_found, INODE_DISK_SIZE);
 
-    sys_free(inode_buf);
+    // 读硬盘期间别的线程可能已将它读入缓存, 那就用别人的
+    old_status = intr_disable();
+    struct inode* inode_cached = inode_lookup(part, inode_no);
+    if (inode_cached != NULL) {
+        if (inode_cached->i_open_cnts++ == 0) {
+            list_remove(&inode_cached->lru_tag);
+            inode_lru_cnt--;
+        }
+        intr_set_status(old_status);
+        inode_free(inode_found);
+        return inode_cached;
+    }
+    inode_found->i_part = part;
+    inode_found->i_deleted = false;
+    inode_found->i_ext_cnt = INODE_EXT_CNT_UNKNOWN;
+    list_push(inode_bucket(part, inode_no), &inode_found->inode_tag);
+    inode_found->i_open_cnts = 1;
+    intr_set_status(old_status);
     return inode_found;
 }
 
 // 关闭 inode 或减少 inode 的打开数
+// 没有进程再打开此文件时, inode 仍留在缓存中以便再次打开时不必读硬盘,
+// 无人打开的 inode 超过 INODE_CACHE_MAX 个时释放最久未用的
 void inode_close(struct inode* inode) {
-    // 若没有进程再打开此文件, 将此 inode 去掉并释放空间
+    struct inode* victim = NULL;
     enum intr_status old_status = intr_disable();
-    if (--inode->i_open_cnts == 0) { 
-        // 将 inode 结点从 part->open_inodes 中去掉
-        list_remove(&inode->inode_tag);
-        // inode_open 时为实现 inode 被所有进程共享
-        // 已经在 sys_malloc 为 inode 分配了内核空间
-        // 释放 inode 时也要确保释放的是内核内存池
-        struct task_struct* cur = running_thread();
-        uint32_t* cur_pagedir_bak = cur->pgdir;
-        cur->pgdir = NULL;
-        sys_free(inode);
-        cur->pgdir = cur_pagedir_bak;
+    if (--inode->i_open_cnts == 0 && inode->i_deleted) {
+        victim = inode;
+    } else if (inode->i_open_cnts == 0) {
+        list_append(&inode_lru, &inode->lru_tag);
+        if (++inode_lru_cnt > INODE_CACHE_MAX) {
+            victim = elem2entry(struct inode, lru_tag, list_pop(&inode_lru));
+            inode_lru_cnt--;
+            list_remove(&victim->inode_tag);
+        }
+    }
+    intr_set_status(old_status);
+    if (victim != NULL) {
+        inode_free(victim);
     }
+}
+
+// inode 被删除后立即将其从缓存中去掉, 以免 inode 号被重用时取到旧内容,
+// 仍打开着它的进程关闭它时再释放
+static void inode_uncache(struct inode* inode) {
+    enum intr_status old_status = intr_disable();
+    ASSERT(inode->i_open_cnts > 0);
+    list_remove(&inode->inode_tag);
+    inode->i_deleted = true;
     intr_set_status(old_status);
 }
 
 // 将硬盘分区 part 上的 inode 清空
-void inode_delete(struct partition* part, uint32_t inode_no, void* io_buf) {
-    ASSERT(inode_no < 4096);
+void inode_delete(struct partition* part, uint32_t inode_no) {
+    ASSERT(inode_no < part->sb->inode_cnt);
     struct inode_position inode_pos;
     inode_locate(part, inode_no, &inode_pos); // inode 位置信息会存入 inode_pos
     ASSERT(inode_pos.sec_lba <= (part->start_lba + part->sec_cnt));
 
-    char* inode_buf = (char*)io_buf;
-    if (inode_pos.two_sec) { // inode 跨扇区, 读入 2 个扇区
-        // 将原硬盘上的内容先读出来
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
-        // 将 inode_buf 清 0
-        memset((inode_buf + inode_pos.off_size), 0, sizeof(struct inode));
-        // 用清 0 的内存数据覆盖磁盘
-        ide_write(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
-    } else { // 未跨扇区, 只读入 1 个扇区就好
-        // 将原硬盘上的内容先读出来
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
-        // 将 inode_buf 清 0
-        memset((inode_buf + inode_pos.off_size), 0, sizeof(struct inode));
-        // 用清 0 的内存数据覆盖磁盘
-        ide_write(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
+    // inode 不跨扇区, 只需在缓存中将其槽位清 0
+    uint8_t zero_slot[INODE_DISK_SLOT];
+    memset(zero_slot, 0, INODE_DISK_SLOT);
+    lock_acquire(&inode_table_lock);
+    bcache_write_bytes(part->my_disk, inode_pos.sec_lba, inode_pos.off_size, zero_slot, INODE_DISK_SLOT);
+    lock_release(&inode_table_lock);
+}
+
+// 用于清零新分配的间接块表
+static const uint8_t zero_block[MAX_BLOCK_SIZE];
+
+// 从块地址 block_lba 的块内偏移 off 处读出 len 个字节, 这些字节不能跨扇区
+static void block_read_bytes(struct partition* part, uint32_t block_lba, uint32_t off, void* buf, uint32_t len) {
+    bcache_read_bytes(part->my_disk, block_lba + off / SECTOR_SIZE, off % SECTOR_SIZE, buf, len);
+}
+
+// 将 buf 中的 len 个字节写到块地址 block_lba 的块内偏移 off 处, 这些字节不能跨扇区
+static void block_write_bytes(struct partition* part, uint32_t block_lba, uint32_t off, const void* buf, uint32_t len) {
+    bcache_write_bytes(part->my_disk, block_lba + off / SECTOR_SIZE, off % SECTOR_SIZE, buf, len);
+}
+
+// 分配一个清零的间接块表, 返回其块地址, 失败返回 0
+static uint32_t bmap_table_alloc(struct partition* part) {
+    int32_t block_lba = block_bitmap_alloc(part);
+    if (block_lba == -1) {
+        return 0;
     }
+    bcache_write(part->my_disk, block_lba, zero_block, BLOCK_SECS(part->sb));
+    return block_lba;
 }
 
-// 回收 inode 的数据块和 inode 本身
-void inode_release(struct partition* part, uint32_t inode_no) {
-    struct inode* inode_to_del = inode_open(part, inode_no);
-    ASSERT(inode_to_del->i_no == inode_no);
+// 单个文件最多占用的块数: 直接块 + 一级、二级、三级间接块, 块大小不超过 4KB 时不会溢出
+static uint32_t inode_max_blocks(struct partition* part) {
+    uint32_t ptrs = INODE_PTRS_PER_BLOCK(part);
+    return INODE_DIRECT_BLOCKS + ptrs + ptrs * ptrs + ptrs * ptrs * ptrs;
+}
+
+// 单个文件的最大字节数, 超出 i_size 的表示范围时以其为准
+uint32_t inode_max_bytes(struct partition* part) {
+    uint32_t max_blocks = inode_max_blocks(part);
+    if (max_blocks > 0xffffffff / part->sb->block_size) {
+        return 0xffffffff;
+    }
+    return max_blocks * part->sb->block_size;
+}
+
+// 求第 block_idx 块在块索引树中的位置: 返回其所在的 i_sectors 下标,
+// 沿途各级间接块表中的下标依次存入 offsets, 间接的级数存入 depth
+static uint32_t bmap_path(struct partition* part, uint32_t block_idx, uint32_t* offsets, uint32_t* depth) {
+    ASSERT(block_idx < inode_max_blocks(part));
+    if (block_idx < INODE_DIRECT_BLOCKS) {
+        *depth = 0;
+        return block_idx;
+    }
+    uint32_t ptrs = INODE_PTRS_PER_BLOCK(part);
+    block_idx -= INODE_DIRECT_BLOCKS;
+    uint32_t span = ptrs; // 当前级数的间接块表共能映射的块数
+    uint32_t level = 1;
+    while (block_idx >= span) {
+        block_idx -= span;
+        span *= ptrs;
+        level++;
+    }
+    *depth = level;
+    while (level > 0) {
+        offsets[--level] = block_idx % ptrs;
+        block_idx /= ptrs;
+    }
+    return INODE_DIRECT_BLOCKS + *depth - 1;
+}
+
+// 单个文件最多的 extent 数: inode 中的 + extent 索引块所指的各 extent 块中的
+static uint32_t extent_max(struct partition* part) {
+    return INODE_EXTENTS + INODE_PTRS_PER_BLOCK(part) * EXTENTS_PER_BLOCK(part);
+}
+
+// 返回第 idx 个 extent 所在 extent 块的地址, 不存在时返回 0.
+// create 为 true 时缺少的 extent 索引块和 extent 块随即分配, 分配失败返回 0
+static uint32_t extent_block_of(struct partition* part, struct inode* inode, uint32_t idx, bool create) {
+    uint32_t index_off = (idx - INODE_EXTENTS) / EXTENTS_PER_BLOCK(part) * 4;
+    if (inode->i_extent_block == 0) {
+        if (!create || (inode->i_extent_block = bmap_table_alloc(part)) == 0) {
+            return 0;
+        }
+    }
+    uint32_t block_lba;
+    block_read_bytes(part, inode->i_extent_block, index_off, &block_lba, 4);
+    if (block_lba == 0 && create) {
+        block_lba = bmap_table_alloc(part);
+        if (block_lba != 0) {
+            block_write_bytes(part, inode->i_extent_block, index_off, &block_lba, 4);
+        }
+    }
+    return block_lba;
+}
+
+// 读出第 idx 个 extent 存入 ext, 该 extent 未使用时返回 false
+static bool extent_get(struct partition* part, struct inode* inode, uint32_t idx, struct extent* ext) {
+    ext->start_lba = ext->len = ext->file_block = 0;
+    if (idx < INODE_EXTENTS) {
+        *ext = inode->i_extents[idx];
+    } else if (idx < extent_max(part)) {
+        uint32_t block_lba = extent_block_of(part, inode, idx, false);
+        if (block_lba != 0) {
+            uint32_t off = (idx - INODE_EXTENTS) % EXTENTS_PER_BLOCK(part) * sizeof(struct extent);
+            block_read_bytes(part, block_lba, off, ext, sizeof(struct extent));
+        }
+    }
+    return ext->len != 0;
+}
+
+// 将 ext 存为第 idx 个 extent, 分配 extent 块失败时返回 false
+static bool extent_put(struct partition* part, struct inode* inode, uint32_t idx, struct extent* ext) {
+    if (idx < INODE_EXTENTS) {
+        inode->i_extents[idx] = *ext;
+        return true;
+    }
+    uint32_t block_lba = extent_block_of(part, inode, idx, true);
+    if (block_lba == 0) {
+        return false;
+    }
+    uint32_t off = (idx - INODE_EXTENTS) % EXTENTS_PER_BLOCK(part) * sizeof(struct extent);
+    block_write_bytes(part, block_lba, off, ext, sizeof(struct extent));
+    return true;
+}
+
+// 统计按 extent 组织的 inode 的 extent 个数并读出最后一个, 存入 i_ext_cnt 和 i_ext_last.
+// 使用中的 extent 是从 0 起连续的一段, 二分查找第一个未使用的, 只在 inode 读入后第一次用到时进行
+static void extent_cache_load(struct partition* part, struct inode* inode) {
+    if (inode->i_ext_cnt != INODE_EXT_CNT_UNKNOWN) {
+        return;
+    }
+    struct extent ext;
+    uint32_t lo = 0, hi = extent_max(part);
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (extent_get(part, inode, mid, &ext)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    inode->i_ext_cnt = lo;
+    inode->i_ext_last.start_lba = inode->i_ext_last.len = inode->i_ext_last.file_block = 0;
+    if (lo > 0) {
+        extent_get(part, inode, lo - 1, &inode->i_ext_last);
+    }
+}
+
+// 按 extent 组织的 inode 已映射的块数
+static uint32_t extent_blocks(struct inode* inode) {
+    return inode->i_ext_cnt == 0 ? 0 : inode->i_ext_last.file_block + inode->i_ext_last.len;
+}
+
+// 在按 extent 组织的 inode 中找到第 block_idx 块, 其块地址存入 lba,
+// 返回所在 extent 中自该块起的块数, 该块未分配时返回 0.
+// 落在最后一个 extent 中时直接取缓存的, 否则按 file_block 二分查找
+static uint32_t extent_map(struct partition* part, struct inode* inode, uint32_t block_idx, uint32_t* lba) {
+    extent_cache_load(part, inode);
+    if (block_idx >= extent_blocks(inode)) {
+        *lba = 0;
+        return 0;
+    }
+    struct extent ext = inode->i_ext_last;
+    if (block_idx < ext.file_block) {
+        // 找最后一个 file_block 不超过 block_idx 的 extent, 它在 [0, i_ext_cnt - 2] 中
+        uint32_t lo = 0, hi = inode->i_ext_cnt - 2;
+        while (lo < hi) {
+            uint32_t mid = (lo + hi + 1) / 2;
+            extent_get(part, inode, mid, &ext);
+            if (ext.file_block <= block_idx) {
+                lo = mid;
+            } else {
+                hi = mid - 1;
+            }
+        }
+        extent_get(part, inode, lo, &ext);
+    }
+    *lba = ext.start_lba + (block_idx - ext.file_block) * BLOCK_SECS(part->sb);
+    return ext.file_block + ext.len - block_idx;
+}
+
+// 在按 extent 组织的 inode 末尾追加从 lba 起的 cnt 个块, 它们将是文件的第 block_idx 块起.
+// 与最后一个 extent 物理上相连时直接并入其中. 失败返回 false
+static bool extent_append(struct partition* part, struct inode* inode, uint32_t block_idx, uint32_t lba, uint32_t cnt) {
+    extent_cache_load(part, inode);
+    uint32_t ext_cnt = inode->i_ext_cnt;
+    struct extent last = inode->i_ext_last;
+    ASSERT(block_idx == extent_blocks(inode));
+    if (ext_cnt > 0 && last.start_lba + last.len * BLOCK_SECS(part->sb) == lba) {
+        last.len += cnt;
+        if (!extent_put(part, inode, ext_cnt - 1, &last)) {
+            return false;
+        }
+        inode->i_ext_last = last;
+        return true;
+    }
+    if (ext_cnt == extent_max(part)) {
+        printk("extent_append: file has too many extents\n");
+        return false;
+    }
+    last.start_lba = lba;
+    last.len = cnt;
+    last.file_block = block_idx;
+    if (!extent_put(part, inode, ext_cnt, &last)) {
+        return false;
+    }
+    inode->i_ext_cnt++;
+    inode->i_ext_last = last;
+    return true;
+}
 
-// 1 回收 inode 占用的所有块
-    uint8_t block_idx = 0, block_cnt = 12;
-    uint32_t block_bitmap_idx;
-    uint32_t all_blocks[140] = {0}; // 12 个直接块 + 128 个间接块
+// 从按 extent 组织的 inode 末尾去掉第 block_idx 块, 它须是文件的最后一块
+static void extent_truncate_last(struct partition* part, struct inode* inode, uint32_t block_idx) {
+    extent_cache_load(part, inode);
+    uint32_t ext_cnt = inode->i_ext_cnt;
+    struct extent last = inode->i_ext_last;
+    ASSERT(ext_cnt > 0 && block_idx + 1 == extent_blocks(inode));
+    if (--last.len > 0) {
+        extent_put(part, inode, ext_cnt - 1, &last);
+        inode->i_ext_last = last;
+        return;
+    }
+    // 最后一个 extent 空了, 前一个成为最后一个
+    last.start_lba = last.file_block = 0;
+    extent_put(part, inode, ext_cnt - 1, &last);
+    inode->i_ext_cnt = --ext_cnt;
+    inode->i_ext_last = last;
+    if (ext_cnt > 0) {
+        extent_get(part, inode, ext_cnt - 1, &inode->i_ext_last);
+    }
+}
+
+// 回收块地址 block_lba 起物理上连续的 cnt 个块
+static void blocks_free(struct partition* part, uint32_t block_lba, uint32_t cnt) {
+    while (cnt-- > 0) {
+        block_bitmap_free(part, block_lba);
+        block_lba += BLOCK_SECS(part->sb);
+    }
+}
+
+// 回收按 extent 组织的 inode 的所有数据块以及 extent 块和 extent 索引块
+static void extent_free_all(struct partition* part, struct inode* inode) {
+    struct extent ext;
+    uint32_t idx = 0;
+    while (extent_get(part, inode, idx, &ext)) {
+        blocks_free(part, ext.start_lba, ext.len);
+        idx++;
+    }
+    if (inode->i_extent_block != 0) {
+        uint32_t* index = (uint32_t*)sys_malloc(part->sb->block_size);
+        if (index == NULL) {
+            PANIC("extent_free_all: sys_malloc for index failed");
+        }
+        bcache_read(part->my_disk, inode->i_extent_block, index, BLOCK_SECS(part->sb));
+        idx = 0;
+        while (idx < INODE_PTRS_PER_BLOCK(part)) {
+            if (index[idx] != 0) {
+                blocks_free(part, index[idx], 1);
+            }
+            idx++;
+        }
+        sys_free(index);
+        blocks_free(part, inode->i_extent_block, 1);
+    }
+}
+
+// 返回 inode 第 block_idx 块的块地址, 尚未分配时返回 0
+// 只沿索引树逐级读出 1 个地址, 不必把整张块表读进来
+uint32_t inode_bmap(struct partition* part, struct inode* inode, uint32_t block_idx) {
+    if (inode->i_flags & INODE_FLAG_EXTENTS) {
+        uint32_t lba;
+        extent_map(part, inode, block_idx, &lba);
+        return lba;
+    }
+    uint32_t offsets[3], depth;
+    uint32_t lba = inode->i_sectors[bmap_path(part, block_idx, offsets, &depth)];
+    uint32_t level = 0;
+    while (lba != 0 && level < depth) {
+        block_read_bytes(part, lba, offsets[level] * 4, &lba, 4);
+        level++;
+    }
+    return lba;
+}
+
+// 返回 inode 从第 block_idx 块起最多 max_cnt 个块中物理地址连续的块数, 首块的块地址存入 lba
+uint32_t inode_bmap_run(struct partition* part, struct inode* inode, uint32_t block_idx, uint32_t max_cnt, uint32_t* lba) {
+    if (inode->i_flags & INODE_FLAG_EXTENTS) { // extent 本身就是连续的一段
+        uint32_t cnt = extent_map(part, inode, block_idx, lba);
+        ASSERT(cnt != 0);
+        return cnt < max_cnt ? cnt : max_cnt;
+    }
+    *lba = inode_bmap(part, inode, block_idx);
+    ASSERT(*lba != 0);
+    uint32_t cnt = 1;
+    while (cnt < max_cnt && inode_bmap(part, inode, block_idx + cnt) == *lba + cnt * BLOCK_SECS(part->sb)) {
+        cnt++;
+    }
+    return cnt;
+}
 
-    // a 先将前 12 个直接块存入 all_blocks
-    while (block_idx < 12) {
-        all_blocks[block_idx] = inode_to_del->i_sectors[block_idx];
-        block_idx++;
+// 将 inode 第 block_idx 块的块地址设为 lba, 沿途缺少的间接块表随即分配.
+// 按 extent 组织的 inode 只能在末尾追加块, 或以 lba 为 0 去掉最后一块.
+// i_sectors 可能被修改, 由调用者负责 inode_sync. 分配块表失败返回 false
+bool inode_bmap_set(struct partition* part, struct inode* inode, uint32_t block_idx, uint32_t lba) {
+    if (inode->i_flags & INODE_FLAG_EXTENTS) {
+        if (lba == 0) {
+            extent_truncate_last(part, inode, block_idx);
+            return true;
+        }
+        return extent_append(part, inode, block_idx, lba, 1);
+    }
+    uint32_t offsets[3], depth;
+    uint32_t* slot = &inode->i_sectors[bmap_path(part, block_idx, offsets, &depth)];
+    if (depth == 0) {
+        *slot = lba;
+        return true;
+    }
+    if (*slot == 0 && (*slot = bmap_table_alloc(part)) == 0) {
+        return false;
+    }
+    uint32_t table_lba = *slot;
+    uint32_t level = 0;
+    while (level + 1 < depth) {
+        uint32_t next_lba;
+        block_read_bytes(part, table_lba, offsets[level] * 4, &next_lba, 4);
+        if (next_lba == 0) {
+            next_lba = bmap_table_alloc(part);
+            if (next_lba == 0) {
+                return false;
+            }
+            block_write_bytes(part, table_lba, offsets[level] * 4, &next_lba, 4);
+        }
+        table_lba = next_lba;
+        level++;
     }
+    block_write_bytes(part, table_lba, offsets[depth - 1] * 4, &lba, 4);
+    return true;
+}
 
-    // b 如果一级间接块表存在, 将其 128 个间接块读到 all_blocks[12~], 并释放一级间接块表所占的扇区
-    if (inode_to_del->i_sectors[12] != 0) {
-        ide_read(part->my_disk, inode_to_del->i_sectors[12], all_blocks+12, 1);
-        block_cnt = 140;
+// 将 inode 从第 block_idx 块起的 cnt 个块依次映射到块地址 lba 起的连续 cnt 个块,
+// 按 extent 组织时只需追加或扩展 1 个 extent. 返回成功映射的块数
+uint32_t inode_bmap_set_run(struct partition* part, struct inode* inode, uint32_t block_idx, uint32_t lba, uint32_t cnt) {
+    if (inode->i_flags & INODE_FLAG_EXTENTS) {
+        return extent_append(part, inode, block_idx, lba, cnt) ? cnt : 0;
+    }
+    uint32_t done = 0;
+    while (done < cnt && inode_bmap_set(part, inode, block_idx + done, lba + done * BLOCK_SECS(part->sb))) {
+        done++;
+    }
+    return done;
+}
 
-        // 回收一级间接块表占用的扇区
-        block_bitmap_idx = inode_to_del->i_sectors[12] - part->sb->data_start_lba;
-        ASSERT(block_bitmap_idx > 0);
-        bitmap_set(&part->block_bitmap, block_bitmap_idx, 0);
-        bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
+// 回收块 block_lba, depth 不为 0 时它是 depth 级间接块表, 先回收其下所有的块
+static void bmap_free_tree(struct partition* part, uint32_t block_lba, uint32_t depth) {
+    if (depth > 0) {
+        uint32_t* table = (uint32_t*)sys_malloc(part->sb->block_size);
+        if (table == NULL) {
+            PANIC("bmap_free_tree: sys_malloc for table failed");
+        }
+        bcache_read(part->my_disk, block_lba, table, BLOCK_SECS(part->sb));
+        uint32_t idx = 0;
+        while (idx < INODE_PTRS_PER_BLOCK(part)) {
+            if (table[idx] != 0) {
+                bmap_free_tree(part, table[idx], depth - 1);
+            }
+            idx++;
+        }
+        sys_free(table);
     }
+    blocks_free(part, block_lba, 1);
+}
 
-    // c inode 所有的块地址已经收集到 all_blocks 中, 下面逐个回收
-    block_idx = 0;
-    while (block_idx < block_cnt) {
-        if (all_blocks[block_idx] != 0) {
-            block_bitmap_idx = 0;
-            block_bitmap_idx = all_blocks[block_idx] - part->sb->data_start_lba;
-            ASSERT(block_bitmap_idx > 0);
-            bitmap_set(&part->block_bitmap, block_bitmap_idx, 0);
-            bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
+// 回收 inode 的数据块和 inode 本身
+void inode_release(struct partition* part, uint32_t inode_no) {
+    struct inode* inode_to_del = inode_open(part, inode_no);
+    ASSERT(inode_to_del->i_no == inode_no);
+
+// 1 回收 inode 占用的所有块, 间接块表连同其下的块一并回收, 数据存放在 inode 中的文件没有块
+    if (inode_to_del->i_flags & INODE_FLAG_EXTENTS) {
+        extent_free_all(part, inode_to_del);
+    } else if (!(inode_to_del->i_flags & INODE_FLAG_INLINE)) {
+        uint32_t sec_idx = 0;
+        while (sec_idx < INODE_BLOCK_PTRS) {
+            if (inode_to_del->i_sectors[sec_idx] != 0) {
+                uint32_t depth = sec_idx < INODE_DIRECT_BLOCKS ? 0 : sec_idx - INODE_DIRECT_BLOCKS + 1;
+                bmap_free_tree(part, inode_to_del->i_sectors[sec_idx], depth);
+            }
+            sec_idx++;
         }
-        block_idx++;
     }
 
 // 2 回收该 inode 所占用的 inode
-    bitmap_set(&part->inode_bitmap, inode_no, 0);
-    bitmap_sync(cur_part, inode_no, INODE_BITMAP);
+    disk_bitmap_set(part, &part->inode_bitmap, inode_no, 0);
 
-    void* io_buf = sys_malloc(1024);
-    inode_delete(part, inode_no, io_buf);
-    sys_free(io_buf);
+    inode_delete(part, inode_no);
 
+    inode_uncache(inode_to_del);
     inode_close(inode_to_del);
 }
 
@@ -235,12 +673,10 @@ void inode_init(uint32_t inode_no, struct inode* new_inode) {
     new_inode->i_size = 0;
     new_inode->i_open_cnts = 0;
     new_inode->write_deny = false;
+    new_inode->i_flags = 0;
+    new_inode->i_deleted = false;
+    new_inode->i_ext_cnt = INODE_EXT_CNT_UNKNOWN;
 
-    // 初始化块索引数组 i_sector
-    uint8_t sec_idx = 0;
-    while (sec_idx < 13) {
-        // i_sectors[12] 为一级间接块地址
-        new_inode->i_sectors[sec_idx] = 0;
-        sec_idx++;
-    }
+    // 初始化块索引数组 i_sector, 与之共用空间的 extent 和内联数据随之清零
+    memset(new_inode->i_inline, 0, INODE_INLINE_SIZE);
 }
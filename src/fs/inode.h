@@ -4,23 +4,84 @@
 #include "list.h"
 #include "ide.h"
 
+#define INODE_DIRECT_BLOCKS 12   // 直接块数
+#define INODE_BLOCK_PTRS 15      // i_sectors 的元素个数
+// 间接块表、extent 块中的项数随分区的块大小而定, 4KB 的块中一个间接块表可记录 1024 个块地址
+#define INODE_PTRS_PER_BLOCK(part) ((part)->sb->block_size / 4)
+#define EXTENTS_PER_BLOCK(part) ((part)->sb->block_size / sizeof(struct extent))
+
+#define INODE_EXTENTS 7       // inode 中直接存放的 extent 数
+
+#define INODE_INLINE_SIZE 96   // inode 中最多能直接存放的文件字节数
+
+#define INODE_FLAG_EXTENTS 0x1 // 文件按 extent 组织, 而不是逐块映射
+#define INODE_FLAG_INLINE 0x2  // 文件数据直接存放在 inode 中, 不占用数据块
+
+// 文件中物理上连续的一段块
+struct extent {
+    uint32_t start_lba;  // 起始块地址
+    uint32_t len;        // 块数, 为 0 表示此项及其后都未使用
+    uint32_t file_block; // 首块在文件中的块号, 各 extent 按此递增, 可据此二分查找
+};
+
+#define INODE_EXT_CNT_UNKNOWN 0xffffffff // i_ext_cnt 尚未统计
+
 // inode 结构
 struct inode {
     uint32_t i_no; // inode 编号
     uint32_t i_size;
     uint32_t i_open_cnts; // 记录此文件被打开的次数
     bool write_deny; // 写文件不能并行, 进程写文件前检查此标识
+    uint32_t i_flags; // INODE_FLAG_*
+
+    union {
+        // i_sectors[0-11]是直接块, i_sectors[12] [13] [14] 依次是一级、二级、三级间接块表的地址
+        uint32_t i_sectors[INODE_BLOCK_PTRS];
+        // 设置了 INODE_FLAG_EXTENTS 时, 文件的块按顺序由各 extent 映射,
+        // 前 INODE_EXTENTS 个存放在 inode 中, 其余存放在 extent 块中, i_extent_block 是记录各 extent 块地址的索引块
+        struct {
+            struct extent i_extents[INODE_EXTENTS];
+            uint32_t i_extent_block;
+        };
+        // 设置了 INODE_FLAG_INLINE 时, 不超过 INODE_INLINE_SIZE 字节的文件内容就存放在这里
+        uint8_t i_inline[INODE_INLINE_SIZE];
+    };
+    struct list_elem inode_tag; // 用于加入 inode 缓存的哈希桶
 
-    // i_sectors[0-11]是直接块, i_sectors[13]用来存储一级间接块指针
-    uint32_t i_sectors[13];
-    struct list_elem inode_tag; // 用于加入已打开的 inode 队列
+    // 以下成员只存在于内存中, 不写入硬盘
+    struct partition* i_part;   // inode 所在的分区
+    struct list_elem lru_tag;   // 无人打开时用于加入 lru 队列
+    bool i_deleted;             // 已被删除, 已不在缓存中, 最后一次关闭时释放
+    // 按 extent 组织时 extent 的个数和最后一个 extent, 追加块时不必从头数一遍.
+    // 读入或新建 inode 时 i_ext_cnt 置为 INODE_EXT_CNT_UNKNOWN, 第一次用到时再统计
+    uint32_t i_ext_cnt;
+    struct extent i_ext_last;
 };
 
+// 硬盘上 inode 的大小, 不含只存在于内存中的成员
+#define INODE_DISK_SIZE ((uint32_t)offset(struct inode, i_part))
+// 硬盘上每个 inode 占用的字节数, 不足的部分补 0. 能整除扇区大小, inode 不会跨扇区
+#define INODE_DISK_SLOT 128
+#define INODES_PER_SECTOR (SECTOR_SIZE / INODE_DISK_SLOT)
+
+#define INODE_HASH_SIZE 64  // inode 缓存的哈希桶数
+#define INODE_CACHE_MAX 64  // 最多缓存多少个无人打开的 inode
+
 struct inode* inode_open(struct partition* part, uint32_t inode_no);
-void inode_sync(struct partition* part, struct inode* inode, void* io_buf);
+void inode_sync(struct partition* part, struct inode* inode);
 void inode_init(uint32_t inode_no, struct inode* new_inode);
 void inode_close(struct inode* inode);
+bool inode_in_use(struct partition* part, uint32_t inode_no);
 void inode_release(struct partition* part, uint32_t inode_no);
-void inode_delete(struct partition* part, uint32_t inode_no, void* io_buf);
+void inode_delete(struct partition* part, uint32_t inode_no);
+struct inode* inode_alloc(void);
+void inode_free(struct inode* inode);
+void inode_cache_add(struct partition* part, struct inode* inode);
+void inode_cache_init(void);
+uint32_t inode_bmap(struct partition* part, struct inode* inode, uint32_t block_idx);
+uint32_t inode_bmap_run(struct partition* part, struct inode* inode, uint32_t block_idx, uint32_t max_cnt, uint32_t* lba);
+bool inode_bmap_set(struct partition* part, struct inode* inode, uint32_t block_idx, uint32_t lba);
+uint32_t inode_bmap_set_run(struct partition* part, struct inode* inode, uint32_t block_idx, uint32_t lba, uint32_t cnt);
+uint32_t inode_max_bytes(struct partition* part);
 
 #endif
@@ -2,6 +2,15 @@
 #define __FS_SUPER_BLOCK_H
 #include "stdint.h"
 
+// 文件系统魔数, 硬盘上的格式改变时随之修改, 使旧格式的分区被重新格式化
+#define FS_MAGIC 0x1959031f
+
+#define FS_FEATURE_EXTENTS 0x1     // 新建的普通文件按 extent 组织
+#define FS_FEATURE_INLINE_DATA 0x2 // 新建的普通文件先把数据存放在 inode 中
+
+// 超级块 sb 所在分区每块的扇区数
+#define BLOCK_SECS(sb) ((sb)->block_size / SECTOR_SIZE)
+
 // 超级块
 struct super_block {
     uint32_t magic;         // 用来标识文件系统类型
@@ -11,9 +20,11 @@ struct super_block {
 
     uint32_t block_bitmap_lba;   // 块位图本身起始扇区地址
     uint32_t block_bitmap_sects; // 扇区位图本身占用的扇区数量
+    uint32_t block_summary_lba;  // 块位图汇总表起始扇区地址, 记录位图每个扇区中的空闲位数
 
     uint32_t inode_bitmap_lba; // inode位图起始扇区lba地址
     uint32_t inode_bitmap_sects; // inode位图占用的扇区数量
+    uint32_t inode_summary_lba;  // inode位图汇总表起始扇区地址
 
     uint32_t inode_table_lba;   // inode表起始扇区lba地址
     uint32_t inode_table_sects; // inode表占用的扇区数量
@@ -21,8 +32,10 @@ struct super_block {
     uint32_t data_start_lba; // 数据区开始的第一个扇区号
     uint32_t root_inode_no;  // 根目录所在的inode号
     uint32_t dir_entry_size; // 目录项大小
+    uint32_t features;       // FS_FEATURE_*
+    uint32_t block_size;     // 块字节大小, 数据区以块为单位分配, 块地址是块首扇区的 lba
 
-    uint8_t pad[460]; // 加上 460 字节, 凑够 512 字节 1 扇区大小
+    uint8_t pad[444]; // 加上 444 字节, 凑够 512 字节 1 扇区大小
 } __attribute__ ((packed));
 
 #endif
\ No newline at end of file
@@ -0,0 +1,147 @@
+#include "arena.h"
+#include "global.h"
+#include "debug.h"
+#include "string.h"
+#include "interrupt.h"
+
+/*
+ * sys_malloc 的小内存块: 每个 arena 占一页, 切分成同一规格的内存块挂在内存块描述符的 free_list 上.
+ * 任务在 arena 前面各有一组弹匣, 申请和释放先在弹匣中进行, 弹匣空或满时才持内存池的锁与 arena 成批交换.
+ * 页框只经 malloc_page 和 mfree_page 申请和归还, 不涉及页表
+ */
+
+// 返回 arena 中第 idx 个内存块的地址
+static struct mem_block* arena2block(struct arena* a, uint32_t idx) {
+    return (struct mem_block*)((uint32_t)a + sizeof(struct arena) + idx * a->desc->block_size);
+}
+
+// 返回内存块 b 所在的 arena 地址
+struct arena* block2arena(struct mem_block* b) {
+    return (struct arena*)((uint32_t)b & 0xfffff000);
+}
+
+// 从 desc 规格的 arena 中取出最多 MAG_BATCH 个内存块装入弹匣 mag, 调用者须持有内存池的锁
+// free_list 为空时新建 arena, 装入了至少一个内存块时返回 true
+static bool magazine_refill(enum pool_flags PF, struct mem_block_desc* desc, struct mem_magazine* mag) {
+    struct arena* a;
+    struct mem_block* b;
+    uint32_t round = 0;
+    while (round < MAG_BATCH) {
+        // 若 mem_block_desc 的 free_list 中已经没有可用的 mem_block
+        // 就创建新的 arena 提供 mem_block
+        if (list_empty(&desc->free_list)) {
+            a = malloc_page(PF, 1);
+            if (a == NULL) {
+                break;
+            }
+            memset(a, 0, PG_SIZE);
+
+            // 对于分配的小块内存, 将 desc 置为相应内存块描述符
+            // cnt 置为 arena 可用的内存块数, large 置为 false
+            a->desc = desc;
+            a->large = false;
+            a->cnt = desc->blocks_per_arena;
+            uint32_t block_idx;
+
+            enum intr_status old_status = intr_disable();
+
+            // 开始将 arena 拆分成内存块, 并添加到内存块描述符的 free_list 中
+            for (block_idx = 0; block_idx < desc->blocks_per_arena; block_idx++) {
+                b = arena2block(a, block_idx);
+                ASSERT(!elem_find(&a->desc->free_list, &b->free_elem));
+                list_append(&a->desc->free_list, &b->free_elem);
+            }
+            intr_set_status(old_status);
+        }
+
+        b = elem2entry(struct mem_block, free_elem, list_pop(&desc->free_list));
+        a = block2arena(b); // 获取内存块 b 所在的 arena
+        a->cnt--; // 将此 arena 中的空闲块数减 1, 弹匣中的块对 arena 而言是已分配的
+        *(struct mem_block**)b = mag->top;
+        mag->top = b;
+        mag->cnt++;
+        round++;
+    }
+    return mag->cnt > 0;
+}
+
+// 将小内存块 b 归还所在 arena 的 free_list, 调用者须持有内存池的锁
+static void arena_block_free(enum pool_flags PF, struct mem_block* b) {
+    struct arena* a = block2arena(b);
+    // 先将内存块回收到 free_list
+    list_append(&a->desc->free_list, &b->free_elem);
+    // 再判断此 arena 中的内存块是否都是空闲, 如果是就释放 arena
+    if (++a->cnt == a->desc->blocks_per_arena) {
+        uint32_t block_idx;
+        for (block_idx = 0; block_idx < a->desc->blocks_per_arena; block_idx++) {
+            struct mem_block* b = arena2block(a, block_idx);
+            ASSERT(elem_find(&a->desc->free_list, &b->free_elem));
+            list_remove(&b->free_elem);
+        }
+        mfree_page(PF, a, 1);
+    }
+}
+
+// 从弹匣 mag 中取出 cnt 个内存块归还 arena, 调用者须持有内存池的锁
+static void magazine_flush(enum pool_flags PF, struct mem_magazine* mag, uint32_t cnt) {
+    ASSERT(cnt <= mag->cnt);
+    while (cnt-- > 0) {
+        struct mem_block* b = mag->top;
+        mag->top = *(struct mem_block**)b;
+        mag->cnt--;
+        arena_block_free(PF, b);
+    }
+}
+
+// 从弹匣 mag 中取出一个 desc 规格的内存块并清零, 弹匣空了才持 pool_lock 从 arena 成批补充
+// 申请不到页框时返回 NULL. 弹匣只属于当前任务, 存取时不必加锁
+void* magazine_alloc(enum pool_flags PF, struct lock* pool_lock, struct mem_block_desc* desc, struct mem_magazine* mag) {
+    if (mag->cnt == 0) {
+        lock_acquire(pool_lock);
+        bool refilled = magazine_refill(PF, desc, mag);
+        lock_release(pool_lock);
+        if (!refilled) {
+            return NULL;
+        }
+    }
+
+    // 开始分配内存块
+    struct mem_block* b = mag->top;
+    mag->top = *(struct mem_block**)b;
+    mag->cnt--;
+    memset(b, 0, desc->block_size);
+    return (void*)b;
+}
+
+// 将内存块 b 放入弹匣 mag, 弹匣满了才持 pool_lock 成批归还 arena
+void magazine_free(enum pool_flags PF, struct lock* pool_lock, struct mem_magazine* mag, struct mem_block* b) {
+    if (mag->cnt == MAG_ROUNDS) {
+        lock_acquire(pool_lock);
+        magazine_flush(PF, mag, MAG_BATCH);
+        lock_release(pool_lock);
+    }
+    *(struct mem_block**)b = mag->top;
+    mag->top = b;
+    mag->cnt++;
+}
+
+// 将弹匣 mag 中的内存块全部归还 arena
+void magazine_drain(enum pool_flags PF, struct lock* pool_lock, struct mem_magazine* mag) {
+    lock_acquire(pool_lock);
+    magazine_flush(PF, mag, mag->cnt);
+    lock_release(pool_lock);
+}
+
+void block_desc_init(struct mem_block_desc* desc_array) {
+    uint16_t desc_idx, block_size = 16;
+
+    // 初始化每个 mem_block_desc 描述符
+    for (desc_idx = 0; desc_idx < DESC_CNT; desc_idx++) {
+        desc_array[desc_idx].block_size = block_size;
+
+        // 初始化 arena 中的内存块数量
+        desc_array[desc_idx].blocks_per_arena = (PG_SIZE - sizeof(struct arena)) / block_size;
+        list_init(&desc_array[desc_idx].free_list);
+        block_size *= 2; // 更新为下一个规格内存块
+    }
+}
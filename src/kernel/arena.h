@@ -0,0 +1,20 @@
+#ifndef __KERNEL_ARENA_H
+#define __KERNEL_ARENA_H
+#include "stdint.h"
+#include "memory.h"
+#include "sync.h"
+
+// 内存仓库 arena 元信息
+struct arena {
+    struct mem_block_desc* desc;
+    // large 为 true 时, cnt 表示的是页框数
+    // 否则 cnt 表示空闲 mem_block 数量
+    uint32_t cnt;
+    bool large;
+};
+
+struct arena* block2arena(struct mem_block* b);
+void* magazine_alloc(enum pool_flags PF, struct lock* pool_lock, struct mem_block_desc* desc, struct mem_magazine* mag);
+void magazine_free(enum pool_flags PF, struct lock* pool_lock, struct mem_magazine* mag, struct mem_block* b);
+void magazine_drain(enum pool_flags PF, struct lock* pool_lock, struct mem_magazine* mag);
+#endif
@@ -3,6 +3,8 @@
 #include "global.h"
 #include "io.h"
 #include "print.h"
+#include "memory.h"
+#include "exec.h"
 /*略*/
 #define PIC_M_CTRL 0x20		//主片
 #define PIC_M_DATA 0x21
@@ -114,6 +116,17 @@ static void general_intr_handler(uint8_t vec_nr){
     while(1);
 }
 
+/*缺页异常处理, 写时复制的页在此复制, 程序段中未载入的页在此从文件读入,
+ *处理后返回重新执行引发缺页的指令, 其余的缺页仍按异常处理*/
+static void page_fault_handler(uint8_t vec_nr){
+	uint32_t page_fault_vaddr = 0;
+	asm ("movl %%cr2, %0" : "=r" (page_fault_vaddr));
+	if(cow_page_fault(page_fault_vaddr) || exec_page_fault(page_fault_vaddr)){
+		return;
+	}
+	general_intr_handler(vec_nr);
+}
+
 /*完成一般中断处理函数注册及异常名称注册*/
 static void exception_init(void){
 	int i;
@@ -143,6 +156,8 @@ static void exception_init(void){
 	intr_name[17] = "#AC Alignment Check Exception"; 
 	intr_name[18] = "#MC Machine-Check Exception"; 
 	intr_name[19] = "#XF SIMD Floating-Point Exception";
+
+	idt_table[14] = page_fault_handler;
 }
 
 // 在中断处理程序数组第 vector_no 个元素中注册安装中断处理程序 function
@@ -8,6 +8,8 @@
 #include "thread.h"
 #include "sync.h"
 #include "interrupt.h"
+#include "slab.h"
+#include "arena.h"
 
 #define PG_SIZE 4096
 
@@ -22,27 +24,37 @@ int page_table_add_num = 0;
 //0xc0000000是内核从虚拟地址3G 起。0x100000意指跨过低端1MB内存，使虚拟地址在逻辑上连续
 #define K_HEAP_START 0xc0100000
 
+#define MAX_ORDER 10	//伙伴系统中最大块的阶, 2^10 页即 4MB
+
+//物理页框的元信息，每个页框一项
+struct frame{
+	struct list_elem free_elem;	//空闲块的首页框挂在所在阶的 free_area 链表上
+	uint16_t refs;			//页框被多少个页表项引用，用户页框在 fork 写时复制共享时大于 1
+	uint8_t order;			//空闲块首页框所在块的阶
+	uint8_t is_free;		//是否为空闲块的首页框
+};
+
 //内存池结构，生成两个实例用于管理内核内存池和用户内存池
 struct pool{
-	struct bitmap pool_bitmap;	//本内存池用到的位图结构， 用于管理物理内存
+	struct frame* frames;		//本内存池每个页框的元信息
+	struct list free_area[MAX_ORDER + 1];	//伙伴系统各阶的空闲块链表，第 k 条上是 2^k 页的块
+	uint32_t frame_cnt;		//本内存池的页框数
 	uint32_t phy_addr_start;	//本内存池所管理物理内存的起始地址
 	uint32_t pool_size;			//本内存池字节容量
 	struct lock lock; 			//申请内存时互斥
 };
 
-// 内存仓库 arena 元信息
-struct arena {
-    struct mem_block_desc* desc;
-    // large 为 true 时, cnt 表示的是页框数
-    // 否则 cnt 表示空闲 mem_block 数量
-    uint32_t cnt;
-    bool large;
-};
-
 struct mem_block_desc k_block_descs[DESC_CNT]; // 内核内存块描述符数组
 struct pool kernel_pool, user_pool;	//生成内核内存池和用户内存池
 struct virtual_addr kernel_vaddr; 	//此结构用来给内核分配虚拟地址
 
+//内核中借用的一个虚拟页, 持有 user_pool.lock 时临时映射到任意页框上, 用来读写尚未映射的页框
+static void* frame_window;
+
+static void* vaddr_get(enum pool_flags pf, uint32_t pg_cnt);
+static void page_table_add(void* _vaddr, void* _page_phyaddr);
+static void buddy_init(struct pool* m_pool, uint32_t reserved);
+
 //初始化内存池
 static void mem_pool_init(uint32_t all_mem) { 
 	put_str("mem_pool_init start\n");
@@ -58,9 +70,8 @@ static void mem_pool_init(uint32_t all_mem) {
 	uint16_t kernel_free_pages = all_free_pages / 2;
 	uint16_t user_free_pages = all_free_pages - kernel_free_pages;
 
-	//为简化位图操作，余数不处理，坏处是这样做会丢内存。好处是不用做内存的越界检查，因为位图表示的内存少于实际物理内存。
-	uint32_t kbm_length = kernel_free_pages / 8;			//Kernel Bitmap的长度，位图中的一位表示一页，以字节为单位，也就是8页表示1字节的位图
-	uint32_t ubm_length = user_free_pages /8;
+	//内核堆的虚拟页与内核内存池的页框一样多，位图中的一位表示一页，余数不处理
+	uint32_t kbm_length = kernel_free_pages / 8;
 
 	uint32_t kp_start = used_mem;					//kernel pool start,内核内存池起始地址
 	uint32_t up_start = kp_start + kernel_free_pages * PG_SIZE;	//内核已使用的+没使用的，就是分配给内核的全部内存，剩下给用户
@@ -71,51 +82,48 @@ static void mem_pool_init(uint32_t all_mem) {
 	kernel_pool.pool_size = kernel_free_pages * PG_SIZE;		//内存池里存放的是空闲的内存，所以用可用内存大小填充
 	user_pool.pool_size = user_free_pages * PG_SIZE;
 
-	kernel_pool.pool_bitmap.btmp_bytes_len = kbm_length;
-	user_pool.pool_bitmap.btmp_bytes_len = ubm_length;
+	kernel_pool.frame_cnt = kernel_free_pages;
+	user_pool.frame_cnt = user_free_pages;
 
-	//内核内存池和用户内存池位图
-	//位图是全局的数据，长度不固定。
-	//全局或静态的数组需要在编译时知道其长度，而我们需要根据总内存 大小算出需要多少字节，所以改为指定一块内存来生成位图。
-	//内核使用的最高地址是Oxc009f000, 这是主线程的栈地址，32MB内存占用的位图是2KB
-	//内核内存池的位图先定在 MEM_BITMAP_BASE(Oxc009a000)处
-	
-	kernel_pool.pool_bitmap.bits = (void*)MEM_BITMAP_BASE;
-	user_pool.pool_bitmap.bits = (void*)(MEM_BITMAP_BASE + kbm_length);
+	//内核虚拟地址的位图长度不固定，指定在 MEM_BITMAP_BASE(Oxc009a000)处，其汇总层紧随其后，按 4 字节对齐
+	//内核使用的最高地址是Oxc009f000, 这是主线程的栈地址
+	kernel_vaddr.vaddr_bitmap.btmp_bytes_len = kbm_length;
+	kernel_vaddr.vaddr_bitmap.bits = (void*)MEM_BITMAP_BASE;
+	kernel_vaddr.vaddr_bitmap.summary = (uint32_t*)(DIV_ROUND_UP(MEM_BITMAP_BASE + kbm_length, 4) * 4);
+	kernel_vaddr.vaddr_start = K_HEAP_START;
+	bitmap_init(&kernel_vaddr.vaddr_bitmap);
+
+	//两个内存池的页框元信息占用内核内存池开头的若干页框。此时伙伴系统还不能分配，
+	//直接把这些页框映射到内核堆上，内核页表在 loader 中已经建好，page_table_add 不会再申请页框
+	uint32_t meta_pg_cnt = DIV_ROUND_UP((kernel_free_pages + user_free_pages) * sizeof(struct frame), PG_SIZE);
+	struct frame* frames = vaddr_get(PF_KERNEL, meta_pg_cnt);
+	uint32_t pg_idx;
+	for(pg_idx = 0; pg_idx < meta_pg_cnt; pg_idx++){
+		page_table_add((uint8_t*)frames + pg_idx * PG_SIZE, (void*)(kp_start + pg_idx * PG_SIZE));
+	}
+	memset(frames, 0, meta_pg_cnt * PG_SIZE);
+	kernel_pool.frames = frames;
+	user_pool.frames = frames + kernel_free_pages;
+
+	buddy_init(&kernel_pool, meta_pg_cnt);
+	buddy_init(&user_pool, 0);
+
+	lock_init(&kernel_pool.lock);
+    lock_init(&user_pool.lock);
 
 	//输出内存池信息
-	put_str("   kernel_pool_bitmap_start:"); 
-	put_int((int)kernel_pool.pool_bitmap.bits); 
+	put_str("   pool_frames_start:"); 
+	put_int((int)frames); 
 
 	put_str("   kernel_pool_phy_addr_start: "); 
 	put_int(kernel_pool.phy_addr_start); 
 
 	put_str ("\n");
 
-	put_str ("    user_pool_bitmap_start: ");
-	put_int ((int) user_pool.pool_bitmap.bits);
-
 	put_str ("    user_pool_phy_addr_start: ");
 	put_int(user_pool.phy_addr_start);
 
 	put_str ("\n");
-
-	// 将位图置 0
-	bitmap_init(&kernel_pool.pool_bitmap);
-	bitmap_init(&user_pool.pool_bitmap);
-
-	lock_init(&kernel_pool.lock);
-    lock_init(&user_pool.lock);
-
-	//下面初始化内核虚拟地址的位图，按实际物理内存大小生成数组。
-	kernel_vaddr.vaddr_bitmap.btmp_bytes_len = kbm_length; 
-	//用干维护内核堆的虚拟地址，所以要和内核内存池大小一致
-	
-	//位图的数组指向一块没用的内存，目前定位在内核内存池和用户内存池之外
-	kernel_vaddr.vaddr_bitmap.bits = (void*)(MEM_BITMAP_BASE + kbm_length + ubm_length);
-
-	kernel_vaddr.vaddr_start = K_HEAP_START;
-	bitmap_init(&kernel_vaddr.vaddr_bitmap);
 	
 	put_str("    mem_pool_init done \n"); 
 }
@@ -170,15 +178,83 @@ uint32_t* pde_ptr(uint32_t vaddr){
 	return pde;
 }
 
+//把以 idx 号页框起始的 2^order 页空闲块挂到 m_pool 相应阶的空闲链表上
+static void free_area_add(struct pool* m_pool, uint32_t idx, uint8_t order){
+	struct frame* f = &m_pool->frames[idx];
+	f->order = order;
+	f->is_free = true;
+	list_push(&m_pool->free_area[order], &f->free_elem);
+}
+
+//初始化 m_pool 的伙伴系统，开头 reserved 个页框已被占用，其余页框按能对齐的最大块挂入空闲链表
+static void buddy_init(struct pool* m_pool, uint32_t reserved){
+	uint8_t order;
+	for(order = 0; order <= MAX_ORDER; order++){
+		list_init(&m_pool->free_area[order]);
+	}
+	uint32_t idx = reserved;
+	while(idx < m_pool->frame_cnt){
+		order = MAX_ORDER;
+		while(order > 0 && ((idx & ((1 << order) - 1)) != 0 || idx + (1 << order) > m_pool->frame_cnt)){
+			order--;
+		}
+		free_area_add(m_pool, idx, order);
+		idx += 1 << order;
+	}
+}
+
+//在 m_pool 中分配 2^order 个物理上连续的页框，成功返回首页框的下标，失败返回 -1
+//从够用的最小阶中取出一块，多出来的部分逐次对半拆开，后一半作为伙伴挂回低一阶的链表
+static int32_t buddy_alloc(struct pool* m_pool, uint8_t order){
+	enum intr_status old_status = intr_disable();
+	uint8_t cur_order = order;
+	while(cur_order <= MAX_ORDER && list_empty(&m_pool->free_area[cur_order])){
+		cur_order++;
+	}
+	if(cur_order > MAX_ORDER){
+		intr_set_status(old_status);
+		return -1;
+	}
+	struct frame* f = elem2entry(struct frame, free_elem, list_pop(&m_pool->free_area[cur_order]));
+	f->is_free = false;
+	uint32_t idx = f - m_pool->frames;
+	while(cur_order > order){
+		cur_order--;
+		free_area_add(m_pool, idx + (1 << cur_order), cur_order);
+	}
+	intr_set_status(old_status);
+	return idx;
+}
+
+//把以 idx 号页框起始的 2^order 页归还 m_pool，伙伴块同阶且空闲时合并成高一阶的块，直到不能合并为止
+static void buddy_free(struct pool* m_pool, uint32_t idx, uint8_t order){
+	enum intr_status old_status = intr_disable();
+	while(order < MAX_ORDER){
+		uint32_t buddy = idx ^ (1 << order);
+		if(buddy + (1 << order) > m_pool->frame_cnt){
+			break;
+		}
+		struct frame* bf = &m_pool->frames[buddy];
+		if(!bf->is_free || bf->order != order){
+			break;
+		}
+		list_remove(&bf->free_elem);
+		bf->is_free = false;
+		idx &= ~(1 << order);
+		order++;
+	}
+	free_area_add(m_pool, idx, order);
+	intr_set_status(old_status);
+}
+
 //在m_pool指向的物理内存池中分配1个物理页，成功则返回页框的物理地址，失败则返回NULL
 static void* palloc(struct pool* m_pool){
-	//扫描或设置位图要保证原子操作
-	int bit_idx = bitmap_scan(&m_pool->pool_bitmap, 1);	//找一个物理页面,位图中1位表示实际1页地址
-	if(bit_idx == -1){
+	int32_t idx = buddy_alloc(m_pool, 0);
+	if(idx == -1){
 		return NULL;
 	}
-	bitmap_set(&m_pool->pool_bitmap, bit_idx, 1);		//将此位的bit_idx置1
-	uint32_t page_phyaddr = ((bit_idx * PG_SIZE) + m_pool->phy_addr_start);	//物理内存池起始地址 + 页偏移 = 页地址
+	m_pool->frames[idx].refs = 1;		//新页框只被即将建立的这一个映射引用
+	uint32_t page_phyaddr = ((idx * PG_SIZE) + m_pool->phy_addr_start);	//物理内存池起始地址 + 页偏移 = 页地址
 	return (void*)page_phyaddr;
 }
 
@@ -238,8 +314,29 @@ void* malloc_page(enum pool_flags pf, uint32_t pg_cnt){
 	uint32_t vaddr = (uint32_t)vaddr_start;
 	uint32_t cnt = pg_cnt;
 	struct pool* mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
+
+	//先从伙伴系统整块分配物理上连续的页框，2^order 页中多出的尾部立即归还
+	uint8_t order = 0;
+	while((1u << order) < pg_cnt){
+		order++;
+	}
+	int32_t frame_idx = order <= MAX_ORDER ? buddy_alloc(mem_pool, order) : -1;
+	if(frame_idx != -1){
+		uint32_t tail_idx;
+		for(tail_idx = frame_idx + pg_cnt; tail_idx < (uint32_t)frame_idx + (1u << order); tail_idx++){
+			buddy_free(mem_pool, tail_idx, 0);
+		}
+		uint32_t page_phyaddr = frame_idx * PG_SIZE + mem_pool->phy_addr_start;
+		while(cnt-- > 0){
+			mem_pool->frames[frame_idx++].refs = 1;
+			page_table_add((void*)vaddr, (void*)page_phyaddr);
+			vaddr += PG_SIZE;
+			page_phyaddr += PG_SIZE;
+		}
+		return vaddr_start;
+	}
 	
-	//因为虚拟地址是连续的，但物理地址不连续，所以逐个映射
+	//没有足够大的连续块时，物理地址不连续，逐个映射
 	while(cnt-- > 0){
 		void* page_phyaddr = palloc(mem_pool);
 		if(page_phyaddr == NULL){
@@ -325,17 +422,8 @@ uint32_t addr_v2p(uint32_t vaddr) {
 }
 
 
-// 返回 arena 中第 idx 个内存块的地址
-static struct mem_block* arena2block(struct arena* a, uint32_t idx) {
-    return (struct mem_block*)((uint32_t)a + sizeof(struct arena) + idx * a->desc->block_size);
-}
-
-// 返回内存块 b 所在的 arena 地址
-static struct arena* block2arena(struct mem_block* b) {
-    return (struct arena*)((uint32_t)b & 0xfffff000);
-}
-
 // 在堆中申请 size 字节内存
+// 不超过 1024 字节的内存块先从当前任务的弹匣中取, 弹匣空了才持内存池的锁成批补充
 void* sys_malloc(uint32_t size) {	// size 申请的内存字节数
     enum pool_flags PF;
     struct pool* mem_pool;
@@ -360,28 +448,24 @@ void* sys_malloc(uint32_t size) {	// size 申请的内存字节数
     if (!(size > 0 && size < pool_size)) {
         return NULL;
     }
-    struct arena* a;
-    struct mem_block* b;
-    lock_acquire(&mem_pool->lock);
 
     // 超过最大内存块 1024, 就分配页框
     if (size > 1024) {
         uint32_t page_cnt = DIV_ROUND_UP(size + sizeof(struct arena), PG_SIZE);
 
-        a = malloc_page(PF, page_cnt);
+        lock_acquire(&mem_pool->lock);
+        struct arena* a = malloc_page(PF, page_cnt);
+        lock_release(&mem_pool->lock);
 
-        if (a != NULL) {
-            memset(a, 0, page_cnt*PG_SIZE); // 将分配的内存清零
-            // 对于分配的大块页框, 将 desc 置为 NULL, cnt 置为页框数, large 置为 true
-            a->desc = NULL;
-            a->cnt = page_cnt;
-            a->large = true;
-            lock_release(&mem_pool->lock);
-            return (void*)(a + 1); // 跨过 arena 大小, 把剩下的内存返回
-        } else {
-            lock_release(&mem_pool->lock);
+        if (a == NULL) {
             return NULL;
         }
+        memset(a, 0, page_cnt*PG_SIZE); // 将分配的内存清零
+        // 对于分配的大块页框, 将 desc 置为 NULL, cnt 置为页框数, large 置为 true
+        a->desc = NULL;
+        a->cnt = page_cnt;
+        a->large = true;
+        return (void*)(a + 1); // 跨过 arena 大小, 把剩下的内存返回
     } else { // 若申请的内存小于等于 1024, 可在各种规格的 mem_block_desc 中去适配
         uint8_t desc_idx;
         // 从内存块描述符中匹配合适的内存块规格
@@ -391,57 +475,23 @@ void* sys_malloc(uint32_t size) {	// size 申请的内存字节数
             }
         }
 
-        // 若 mem_block_desc 的 free_list 中已经没有可用的 mem_block
-        // 就创建新的 arena 提供 mem_block
-        if (list_empty(&descs[desc_idx].free_list)) {
-            a = malloc_page(PF, 1);
-            if (a == NULL) {
-                lock_release(&mem_pool->lock);
-                return NULL;
-            }
-            memset(a, 0, PG_SIZE);
-
-            // 对于分配的小块内存, 将 desc 置为相应内存块描述符
-            // cnt 置为 arena 可用的内存块数, large 置为 false
-            a->desc = &descs[desc_idx];
-            a->large = false;
-            a->cnt = descs[desc_idx].blocks_per_arena;
-            uint32_t block_idx;
-
-            enum intr_status old_status = intr_disable();
-
-            // 开始将 arena 拆分成内存块, 并添加到内存块描述符的 free_list 中
-            for (block_idx = 0; block_idx < descs[desc_idx].blocks_per_arena; block_idx++) {
-                b = arena2block(a, block_idx);
-                ASSERT(!elem_find(&a->desc->free_list, &b->free_elem));
-                list_append(&a->desc->free_list, &b->free_elem);
-            }
-            intr_set_status(old_status);
-        }
-
-        // 开始分配内存块
-        b = elem2entry(struct mem_block, free_elem, list_pop(&(descs[desc_idx].free_list)));
-        memset(b, 0, descs[desc_idx].block_size);
-
-        a = block2arena(b); // 获取内存块 b 所在的 arena
-        a->cnt--; // 将此 arena 中的空闲块数减 1
-        lock_release(&mem_pool->lock);
-        return (void*)b;
+        return magazine_alloc(PF, &mem_pool->lock, &descs[desc_idx], &cur_thread->mags[desc_idx]);
     }
 }
 
 // 将物理地址 pg_phy_addr 回收到物理内存池
 void pfree(uint32_t pg_phy_addr) {
-    struct pool* mem_pool;
-    uint32_t bit_idx = 0;
-    if (pg_phy_addr >= user_pool.phy_addr_start) { // 用户物理内存池
-        mem_pool = &user_pool;
-        bit_idx = (pg_phy_addr - user_pool.phy_addr_start) / PG_SIZE;
-    } else { // 内核内存池
-        mem_pool = &kernel_pool;
-        bit_idx = (pg_phy_addr - kernel_pool.phy_addr_start) / PG_SIZE;
+    struct pool* mem_pool = pg_phy_addr >= user_pool.phy_addr_start ? &user_pool : &kernel_pool;
+    uint32_t idx = (pg_phy_addr - mem_pool->phy_addr_start) / PG_SIZE;
+    struct frame* f = &mem_pool->frames[idx];
+    ASSERT(!f->is_free && f->refs > 0);
+    enum intr_status old_status = intr_disable();
+    uint16_t refs = --f->refs;
+    intr_set_status(old_status);
+    if (refs > 0) { // 页框仍被其他进程共享, 只去掉这一个引用
+        return;
     }
-    bitmap_set(&mem_pool->pool_bitmap, bit_idx, 0); // 将位图中该位清 0
+    buddy_free(mem_pool, idx, 0); // 归还伙伴系统, 与空闲的伙伴合并
 }
 
 // 去掉页表中虚拟地址 vaddr 的映射, 只去掉 vaddr 对应的 pte
@@ -516,14 +566,16 @@ void mfree_page(enum pool_flags pf, void* _vaddr, uint32_t pg_cnt) {
 }
 
 // 回收内存 ptr
+// 小内存块先放入当前任务的弹匣, 弹匣满了才持内存池的锁成批归还 arena
 void sys_free(void* ptr) {
     ASSERT(ptr != NULL);
     if (ptr != NULL) {
         enum pool_flags PF;
         struct pool* mem_pool;
+        struct task_struct* cur_thread = running_thread();
 
         // 判断是线程, 还是进程
-        if (running_thread()->pgdir == NULL) {
+        if (cur_thread->pgdir == NULL) {
             ASSERT((uint32_t)ptr >= K_HEAP_START);
             PF = PF_KERNEL;
             mem_pool = &kernel_pool;
@@ -532,56 +584,158 @@ void sys_free(void* ptr) {
             mem_pool = &user_pool;
         }
 
-        lock_acquire(&mem_pool->lock);
         struct mem_block* b = ptr;
         struct arena* a = block2arena(b); // 把 mem_block 转换成 arena, 获取元信息
         ASSERT(a->large == 0 || a->large == 1);
         if (a->desc == NULL && a->large ==true) { // 大于 1024 的内存
+            lock_acquire(&mem_pool->lock);
             mfree_page(PF, a, a->cnt);
+            lock_release(&mem_pool->lock);
         } else { // 小于等于 1024 的内存块
-            // 先将内存块回收到 free_list
-            list_append(&a->desc->free_list, &b->free_elem);
-            // 再判断此 arena 中的内存块是否都是空闲, 如果是就释放 arena
-            if (++a->cnt == a->desc->blocks_per_arena) {
-                uint32_t block_idx;
-                for (block_idx = 0; block_idx < a->desc->blocks_per_arena; block_idx++) {
-                    struct mem_block* b = arena2block(a, block_idx);
-                    ASSERT(elem_find(&a->desc->free_list, &b->free_elem));
-                    list_remove(&b->free_elem);
-                }
-                mfree_page(PF, a, 1);
+            // 由块大小得出规格下标, 最小的规格是 16 字节
+            uint8_t desc_idx = 0;
+            while ((16u << desc_idx) < a->desc->block_size) {
+                desc_idx++;
             }
+            ASSERT(desc_idx < DESC_CNT);
+            magazine_free(PF, &mem_pool->lock, &cur_thread->mags[desc_idx], b);
         }
-        lock_release(&mem_pool->lock);
     }
 }
 
-void block_desc_init(struct mem_block_desc* desc_array) {
-    uint16_t desc_idx, block_size = 16;
+// 将任务 pthread 弹匣中的内存块全部归还 arena, 在任务退出时调用
+// 用户进程的内存块随进程的地址空间一同回收, 只需清空弹匣
+void mem_magazines_drain(struct task_struct* pthread) {
+    uint8_t desc_idx;
+    if (pthread->pgdir == NULL) {
+        for (desc_idx = 0; desc_idx < DESC_CNT; desc_idx++) {
+            magazine_drain(PF_KERNEL, &kernel_pool.lock, &pthread->mags[desc_idx]);
+        }
+    } else {
+        memset(pthread->mags, 0, sizeof(pthread->mags));
+    }
+}
+
+// 根据物理页框地址 pg_phy_addr 将其归还相应的内存池, 不改动页表
+void free_a_phy_page(uint32_t pg_phy_addr) {
+    pfree(pg_phy_addr);
+}
 
-    // 初始化每个 mem_block_desc 描述符
-    for (desc_idx = 0; desc_idx < DESC_CNT; desc_idx++) {
-        desc_array[desc_idx].block_size = block_size;
+// 将虚拟页 vaddr 的页表项替换为 new_pte 并刷新其 tlb, 返回原来的页表项, vaddr 所在的页表必须已存在
+static uint32_t pte_swap(uint32_t vaddr, uint32_t new_pte) {
+    uint32_t* pte = pte_ptr(vaddr);
+    uint32_t old_pte = *pte;
+    *pte = new_pte;
+    asm volatile ("invlpg %0" : : "m" (*(uint8_t*)vaddr) : "memory");
+    return old_pte;
+}
 
-        // 初始化 arena 中的内存块数量
-        desc_array[desc_idx].blocks_per_arena = (PG_SIZE - sizeof(struct arena)) / block_size;
-        list_init(&desc_array[desc_idx].free_list);
-        block_size *= 2; // 更新为下一个规格内存块
+// 为当前进程的子进程 child_pgdir 复制用户空间的页表, 页框本身不复制而是共享:
+// 可写页在父子两边都改为只读并置 PG_COW, 谁先写谁在缺页时复制一份, 失败返回 -1
+int32_t user_pages_share(uint32_t* child_pgdir) {
+    uint32_t win = (uint32_t)frame_window;
+    uint32_t pde_idx;
+    int32_t ret = 0;
+    lock_acquire(&user_pool.lock);
+    uint32_t win_pte = *pte_ptr(win);
+    for (pde_idx = 0; pde_idx < 768; pde_idx++) {
+        if (!(*pde_ptr(pde_idx * 0x400000) & PG_P_1)) {
+            continue;
+        }
+        // 子进程的页表同 page_table_add 一样从内核内存池分配, 经 frame_window 填写
+        lock_acquire(&kernel_pool.lock);
+        void* pt_phyaddr = palloc(&kernel_pool);
+        lock_release(&kernel_pool.lock);
+        if (pt_phyaddr == NULL) {
+            ret = -1;
+            break;
+        }
+        pte_swap(win, (uint32_t)pt_phyaddr | PG_US_S | PG_RW_W | PG_P_1);
+        uint32_t* parent_pt = pte_ptr(pde_idx * 0x400000);
+        uint32_t* child_pt = frame_window;
+        uint32_t pte_idx;
+        for (pte_idx = 0; pte_idx < 1024; pte_idx++) {
+            uint32_t pte = parent_pt[pte_idx];
+            if (!(pte & PG_P_1)) {
+                child_pt[pte_idx] = 0;
+                continue;
+            }
+            if (pte & PG_RW_W) {
+                pte = (pte & ~PG_RW_W) | PG_COW;
+                parent_pt[pte_idx] = pte;
+            }
+            ASSERT((pte & 0xfffff000) >= user_pool.phy_addr_start);
+            user_pool.frames[((pte & 0xfffff000) - user_pool.phy_addr_start) / PG_SIZE].refs++;
+            child_pt[pte_idx] = pte;
+        }
+        child_pgdir[pde_idx] = (uint32_t)pt_phyaddr | PG_US_U | PG_RW_W | PG_P_1;
     }
+    pte_swap(win, win_pte);
+    // 父进程的页表项改成了只读, 重新加载 cr3 使整个 tlb 失效
+    uint32_t pgdir_phyaddr;
+    asm volatile ("movl %%cr3, %0; movl %0, %%cr3" : "=r" (pgdir_phyaddr) : : "memory");
+    lock_release(&user_pool.lock);
+    return ret;
 }
 
-// 根据物理页框地址 pg_phy_addr 在相应的内存池的位图清 0, 不改动页表
-void free_a_phy_page(uint32_t pg_phy_addr) {
-    struct pool* mem_pool;
-    uint32_t bit_idx = 0;
-    if (pg_phy_addr >= user_pool.phy_addr_start) {
-        mem_pool = &user_pool;
-        bit_idx = (pg_phy_addr - user_pool.phy_addr_start) / PG_SIZE;
+// 解除当前进程用户页 vaddr 的映射并释放其页框, 虚拟地址位图不变, vaddr 未映射时什么也不做
+void user_page_unmap(uint32_t vaddr) {
+    if (!(*pde_ptr(vaddr) & PG_P_1) || !(*pte_ptr(vaddr) & PG_P_1)) {
+        return;
+    }
+    lock_acquire(&user_pool.lock);
+    pfree(*pte_ptr(vaddr) & 0xfffff000);
+    pte_swap(vaddr, 0);
+    lock_release(&user_pool.lock);
+}
+
+// 在当前进程中逐页访问用户缓冲区 buf, 让其中的缺页和写时复制提前处理掉.
+// 硬盘 DMA 以及 ide 工作线程中的 PIO 直接读写物理页, 不会经过当前进程的缺页异常
+void user_buf_prefault(const void* buf, uint32_t size, bool write) {
+    uint32_t vaddr = (uint32_t)buf;
+    uint32_t end = vaddr + size;
+    while (vaddr < end && vaddr < 0xc0000000) {
+        volatile uint8_t* p = (volatile uint8_t*)vaddr;
+        if (write) {
+            *p = *p;
+        } else {
+            (void)*p;
+        }
+        vaddr = (vaddr & 0xfffff000) + PG_SIZE;
+    }
+}
+
+// 处理对写时复制页 vaddr 的写入: 页框已无他人共享就直接改回可写, 否则复制到新页框
+// vaddr 不是写时复制页或内存不足时返回 false, 交由通用异常处理
+bool cow_page_fault(uint32_t vaddr) {
+    if (vaddr >= 0xc0000000 || !(*pde_ptr(vaddr) & PG_P_1)) {
+        return false;
+    }
+    uint32_t* pte = pte_ptr(vaddr);
+    if ((*pte & (PG_P_1 | PG_COW)) != (PG_P_1 | PG_COW)) {
+        return false;
+    }
+    uint32_t page_vaddr = vaddr & 0xfffff000;
+    lock_acquire(&user_pool.lock);
+    uint32_t old_phyaddr = *pte & 0xfffff000;
+    struct frame* old_frame = &user_pool.frames[(old_phyaddr - user_pool.phy_addr_start) / PG_SIZE];
+    uint32_t flags = (*pte & 0x00000fff & ~PG_COW) | PG_RW_W;
+    if (old_frame->refs == 1) {
+        pte_swap(page_vaddr, old_phyaddr | flags);
     } else {
-        mem_pool = &kernel_pool;
-        bit_idx = (pg_phy_addr - kernel_pool.phy_addr_start) / PG_SIZE;
+        void* new_phyaddr = palloc(&user_pool);
+        if (new_phyaddr == NULL) {
+            lock_release(&user_pool.lock);
+            return false;
+        }
+        uint32_t win_pte = pte_swap((uint32_t)frame_window, (uint32_t)new_phyaddr | PG_US_S | PG_RW_W | PG_P_1);
+        memcpy(frame_window, (void*)page_vaddr, PG_SIZE);
+        pte_swap((uint32_t)frame_window, win_pte);
+        old_frame->refs--;
+        pte_swap(page_vaddr, (uint32_t)new_phyaddr | flags);
     }
-    bitmap_set(&mem_pool->pool_bitmap, bit_idx, 0);
+    lock_release(&user_pool.lock);
+    return true;
 }
 
 //内存管理部分初始化入口
@@ -592,5 +746,14 @@ void mem_init(){
 	mem_pool_init(mem_bytes_total);
     // 初始化 mem_block_desc 数组 descs, 为 malloc 做准备
     block_desc_init(k_block_descs);
+
+    // 此时还没有线程, 不经过内存池的锁直接分配
+    frame_window = malloc_page(PF_KERNEL, 1);
+    if (frame_window == NULL) {
+        PANIC("mem_init: alloc frame_window failed");
+    }
+    // 置 cr0 的 WP 位, 内核代用户进程写只读页时也触发缺页, 否则会越过写时复制直接改写共享页框
+    asm volatile ("movl %%cr0, %%eax; orl $0x10000, %%eax; movl %%eax, %%cr0" : : : "eax", "memory");
+    slab_init();
 	put_str("mem_init done\n"); 
 }
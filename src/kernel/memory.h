@@ -3,6 +3,7 @@
 #include "stdint.h"
 #include "bitmap.h"
 #include "list.h"
+#include "global.h"
 /*内存池标记， 用于判断用哪个内存池*/
 enum pool_flags{
 	PF_KERNEL = 1,	//内核内存池
@@ -15,6 +16,7 @@ enum pool_flags{
 #define PG_RW_W	2	//R/W 属性位值，读/写/执行
 #define PG_US_S	0	//U/S 属性位值，系统级
 #define PG_US_U 4	//U/S 属性位值，用户级
+#define PG_COW	0x200	//页表项中供软件使用的 AVL 位，表示该只读页是 fork 后写时复制共享的
 
 /*虚拟地址池， 用于虚拟地址管理*/
 struct virtual_addr{
@@ -23,6 +25,16 @@ struct virtual_addr{
 };
 
 
+// exec 记录的程序段, 段中的页在第一次访问时才分配并从可执行文件读入
+struct vm_seg {
+    uint32_t vaddr_start;   // 段的起始虚拟地址
+    uint32_t file_end;      // 段中来自文件的内容的结束地址, 即 vaddr_start + p_filesz
+    uint32_t vaddr_end;     // 段的结束地址, 即 vaddr_start + p_memsz, file_end 之后填 0
+    uint32_t file_offset;   // vaddr_start 处的内容在文件中的偏移
+};
+
+#define MAX_VM_SEGS 8 // 每个进程最多记录的程序段数
+
 // 内存块
 struct mem_block {
     struct list_elem free_elem;
@@ -37,6 +49,15 @@ struct mem_block_desc {
 
 #define DESC_CNT 7 // 内存块描述符个数
 
+#define MAG_ROUNDS 8               // 每个弹匣最多缓存的内存块数
+#define MAG_BATCH (MAG_ROUNDS / 2) // 弹匣空或满时与 arena 成批交换的内存块数
+
+// 弹匣, 任务私有的某一规格的空闲内存块, 块的头 4 字节串成单链表
+struct mem_magazine {
+    struct mem_block* top; // 最近放入的内存块
+    uint32_t cnt;          // 弹匣中的内存块数
+};
+
 extern int page_table_add_num;
 extern struct pool kernel_pool, user_pool;
 void mem_init(void);
@@ -53,7 +74,13 @@ void* sys_malloc(uint32_t size);
 void mfree_page(enum pool_flags pf, void* _vaddr, uint32_t pg_cnt);
 void pfree(uint32_t pg_phy_addr);
 void sys_free(void* ptr);
+struct task_struct;
+void mem_magazines_drain(struct task_struct* pthread);
 void* get_a_page_without_opvaddrbitmap(enum pool_flags pf, uint32_t vaddr);
 void free_a_phy_page(uint32_t pg_phy_addr);
+int32_t user_pages_share(uint32_t* child_pgdir);
+bool cow_page_fault(uint32_t vaddr);
+void user_page_unmap(uint32_t vaddr);
+void user_buf_prefault(const void* buf, uint32_t size, bool write);
 #endif
 
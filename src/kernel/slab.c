@@ -0,0 +1,121 @@
+#include "slab.h"
+#include "memory.h"
+#include "interrupt.h"
+#include "debug.h"
+#include "global.h"
+#include "stdio-kernel.h"
+
+/*
+ * 固定大小内核对象的 slab 分配器.
+ * 每个缓存从内核内存池整页申请 slab 并切分成对象, 分配和释放都只是空闲链表的出入栈,
+ * 不像 sys_malloc 那样逐个匹配内存块规格, 也不在每次分配时清零.
+ * slab 不退还给内存池, 缓存的大小停在对象使用数的峰值上
+ */
+
+#define SLAB_MAX_PG_CNT 8 // 每个 slab 最多占用的页数
+
+static struct list slab_cache_list; // 全部缓存, 用于输出统计信息
+
+// 初始化 slab 分配器, 须在创建任何缓存之前调用
+void slab_init(void) {
+    list_init(&slab_cache_list);
+}
+
+// 初始化对象大小为 obj_size 的缓存 cache, name 须是常量字符串, ctor 可以为 NULL
+void slab_cache_init(struct slab_cache* cache, const char* name, uint32_t obj_size, slab_ctor* ctor) {
+    obj_size = DIV_ROUND_UP(obj_size, 4) * 4;
+    ASSERT(obj_size >= 4 && obj_size <= SLAB_MAX_PG_CNT * PG_SIZE);
+
+    // 选取最少的页数, 使切分对象后剩余的零头不超过 slab 的 1/8
+    uint32_t pg_cnt = 1;
+    while (pg_cnt < SLAB_MAX_PG_CNT &&
+           (pg_cnt * PG_SIZE < obj_size || (pg_cnt * PG_SIZE % obj_size) * 8 > pg_cnt * PG_SIZE)) {
+        pg_cnt++;
+    }
+    cache->name = name;
+    cache->obj_size = obj_size;
+    cache->slab_pg_cnt = pg_cnt;
+    cache->objs_per_slab = pg_cnt * PG_SIZE / obj_size;
+    cache->ctor = ctor;
+    cache->free_obj = NULL;
+    cache->slab_cnt = 0;
+    cache->in_use = 0;
+    cache->peak_in_use = 0;
+    cache->alloc_cnt = 0;
+    cache->fail_cnt = 0;
+
+    list_append(&slab_cache_list, &cache->cache_tag);
+}
+
+// 为 cache 新建一个 slab, 构造其中的对象后挂到空闲链表上
+static bool slab_grow(struct slab_cache* cache) {
+    uint8_t* slab = get_kernel_pages(cache->slab_pg_cnt);
+    if (slab == NULL) {
+        return false;
+    }
+    uint32_t obj_idx;
+    if (cache->ctor != NULL) {
+        for (obj_idx = 0; obj_idx < cache->objs_per_slab; obj_idx++) {
+            cache->ctor(slab + obj_idx * cache->obj_size);
+        }
+    }
+
+    // 倒序入栈, 分配时按地址从低到高取出
+    enum intr_status old_status = intr_disable();
+    obj_idx = cache->objs_per_slab;
+    while (obj_idx-- > 0) {
+        void** obj = (void**)(slab + obj_idx * cache->obj_size);
+        *obj = cache->free_obj;
+        cache->free_obj = obj;
+    }
+    cache->slab_cnt++;
+    intr_set_status(old_status);
+    return true;
+}
+
+// 从 cache 中分配一个对象, 失败时返回 NULL
+void* slab_alloc(struct slab_cache* cache) {
+    enum intr_status old_status = intr_disable();
+    while (cache->free_obj == NULL) {
+        // 申请页框时可能要等内存池的锁, 不能关着中断
+        intr_set_status(old_status);
+        bool grown = slab_grow(cache);
+        old_status = intr_disable();
+        if (!grown) {
+            cache->fail_cnt++;
+            intr_set_status(old_status);
+            return NULL;
+        }
+    }
+    void** obj = cache->free_obj;
+    cache->free_obj = *obj;
+    cache->alloc_cnt++;
+    if (++cache->in_use > cache->peak_in_use) {
+        cache->peak_in_use = cache->in_use;
+    }
+    intr_set_status(old_status);
+    return obj;
+}
+
+// 将 obj 归还 cache
+void slab_free(struct slab_cache* cache, void* obj) {
+    ASSERT(obj != NULL && cache->in_use > 0);
+    enum intr_status old_status = intr_disable();
+    *(void**)obj = cache->free_obj;
+    cache->free_obj = obj;
+    cache->in_use--;
+    intr_set_status(old_status);
+}
+
+// 输出各缓存的统计信息
+void slab_stats_print(void) {
+    struct list_elem* elem = slab_cache_list.head.next;
+    while (elem != &slab_cache_list.tail) {
+        struct slab_cache* cache = elem2entry(struct slab_cache, cache_tag, elem);
+        printk("%s: size %d, %d pages per slab, %d slabs, %d objs, in use %d, peak %d, allocs %d, fails %d\n",
+               cache->name, cache->obj_size, cache->slab_pg_cnt, cache->slab_cnt,
+               cache->slab_cnt * cache->objs_per_slab, cache->in_use, cache->peak_in_use,
+               cache->alloc_cnt, cache->fail_cnt);
+        elem = elem->next;
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef __KERNEL_SLAB_H
+#define __KERNEL_SLAB_H
+#include "stdint.h"
+#include "list.h"
+
+// 对象构造函数, 在 slab 新建时对其中的每个对象调用一次
+typedef void (slab_ctor) (void* obj);
+
+// 固定大小内核对象的缓存
+// 空闲对象串成单链表, 对象的头 4 字节存放链表指针, 所以构造出的状态不能依赖这 4 字节.
+// 释放的对象应恢复到构造后的状态, 下次分配时不再构造也不清零
+struct slab_cache {
+    const char* name;        // 缓存名称, 用于输出统计信息
+    uint32_t obj_size;       // 对象大小, 按 4 字节对齐
+    uint32_t slab_pg_cnt;    // 每个 slab 占用的页数
+    uint32_t objs_per_slab;  // 每个 slab 可容纳的对象数
+    slab_ctor* ctor;         // 对象构造函数, 可以为 NULL
+    void* free_obj;          // 空闲对象链表
+
+    // 统计信息
+    uint32_t slab_cnt;       // 已创建的 slab 数
+    uint32_t in_use;         // 正在使用的对象数
+    uint32_t peak_in_use;    // 正在使用的对象数的峰值
+    uint32_t alloc_cnt;      // 累计分配次数
+    uint32_t fail_cnt;       // 因申请不到页框而分配失败的次数
+
+    struct list_elem cache_tag; // 用于挂在全部缓存链表上
+};
+
+void slab_init(void);
+void slab_cache_init(struct slab_cache* cache, const char* name, uint32_t obj_size, slab_ctor* ctor);
+void* slab_alloc(struct slab_cache* cache);
+void slab_free(struct slab_cache* cache, void* obj);
+void slab_stats_print(void);
+#endif
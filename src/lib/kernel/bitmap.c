@@ -5,9 +5,66 @@
 #include "interrupt.h" 
 #include "debug.h" 
 
+/*以字为单位访问位图, 位图的字节数组不一定按字对齐*/
+typedef uint32_t __attribute__((may_alias)) bitmap_word_t;
+
+/*返回 word 中最低的 1 位的下标, word 不能为 0*/
+static inline uint32_t bit_first_set(uint32_t word) {
+	uint32_t idx;
+	asm volatile ("bsf %1, %0" : "=r" (idx) : "rm" (word));
+	return idx;
+}
+
+/*位图中的字数, 最后一个字可能不完整*/
+static uint32_t bitmap_words(struct bitmap* btmp) {
+	return DIV_ROUND_UP(btmp->btmp_bytes_len, 4);
+}
+
+/*读出位图的第 word_idx 个字, 超出位图长度的字节视为全部占用*/
+static uint32_t bitmap_word(struct bitmap* btmp, uint32_t word_idx) {
+	uint32_t byte_idx = word_idx * 4;
+	if (byte_idx + 4 <= btmp->btmp_bytes_len) {
+		return *(bitmap_word_t*)&btmp->bits[byte_idx];
+	}
+	uint32_t word = 0xffffffff;
+	uint32_t off = 0;
+	while (byte_idx + off < btmp->btmp_bytes_len) {
+		word &= ~(0xffu << (off * 8));
+		word |= (uint32_t)btmp->bits[byte_idx + off] << (off * 8);
+		off++;
+	}
+	return word;
+}
+
+/*从第 word_idx 个字起, 借助汇总层跳过全满的字, 返回第一个未满的字的下标, 没有则返回字数*/
+static uint32_t bitmap_next_word(struct bitmap* btmp, uint32_t word_idx) {
+	uint32_t word_cnt = bitmap_words(btmp);
+	if (btmp->summary == NULL) {
+		while (word_idx < word_cnt && bitmap_word(btmp, word_idx) == 0xffffffff) {
+			word_idx++;
+		}
+		return word_idx;
+	}
+	while (word_idx < word_cnt) {
+		/*汇总层中本字及其后同一汇总字内各位取反, 为 1 的即是未满的字*/
+		uint32_t not_full = ~btmp->summary[word_idx / 32] & (0xffffffff << (word_idx % 32));
+		if (not_full != 0) {
+			word_idx = word_idx / 32 * 32 + bit_first_set(not_full);
+			return word_idx < word_cnt ? word_idx : word_cnt;
+		}
+		word_idx = (word_idx / 32 + 1) * 32;
+	}
+	return word_cnt;
+}
+
 /*将位图btmp初始化*/
 void bitmap_init(struct bitmap* btmp) {
 	memset(btmp->bits, 0, btmp->btmp_bytes_len);
+	btmp->run_hint = 0;
+	btmp->run_hint_cnt = 0;
+	if (btmp->summary != NULL) {
+		memset(btmp->summary, 0, BITMAP_SUMMARY_BYTES(btmp->btmp_bytes_len));
+	}
 }
 
 /*判断bit_idx位是否为 1 ,若为 1,则返回true, 否则返回false */
@@ -19,51 +76,96 @@ int bitmap_scan_test(struct bitmap* btmp, uint32_t bit_idx) {
 
 /*在位图中申清连续 cnt 个位， 成功， 则返回其起始位下标，失败， 返回 -1 */
 int bitmap_scan(struct bitmap* btmp, uint32_t cnt) {
-	uint32_t idx_byte = 0; 			//用于记录空闲位所在的字节
-	/*先逐字节比较，蛮力法 */
-	//put_int(idx_byte);
-	while ((0xff == btmp->bits[idx_byte]) && (idx_byte < btmp->btmp_bytes_len)) { 
-		idx_byte++;	
-	}
-	//put_str("idx_byte=");put_int(idx_byte);put_str("-----");
-	//put_str("bytes_len=");put_int(btmp->btmp_bytes_len);put_str("\n\n");
-	/*如果找不到可用空间就返回 -1*/
-	ASSERT(idx_byte <= btmp->btmp_bytes_len);
-	if(idx_byte == btmp->btmp_bytes_len){
-		return -1;
+	ASSERT(cnt > 0);
+	uint32_t word_cnt = bitmap_words(btmp);
+	if (cnt == 1) {
+		/*第一个未满的字中最低的空闲位就是结果*/
+		uint32_t word_idx = bitmap_next_word(btmp, 0);
+		if (word_idx == word_cnt) {
+			return -1;
+		}
+		return word_idx * 32 + bit_first_set(~bitmap_word(btmp, word_idx));
 	}
 
-	/*若在位图数组范围内的某字节内找到了空闲位，在该字节内逐位比对， 返回空闲位的索引。*/
-	int idx_bit = 0;
-	while ((uint8_t)(BITMAP_MASK << idx_bit) & btmp->bits[idx_byte]) {
-		idx_bit++;
-	} 
-
-	
-	int bit_idx_start = idx_byte * 8 + idx_bit;	//空闲位在位图中的下标
-       	if (cnt == 1) {
-		return bit_idx_start;
+	/*零散的短空闲段凑不成 cnt 个位, 提示的长度不超过 cnt 时从 run_hint 处开始查找, 否则从头查找.
+	* 查找中记下第一段长度达到 hint_cnt 的空闲段所在的字, 作为新的提示*/
+	uint32_t start_word = 0;
+	uint32_t hint_cnt = cnt;
+	if (btmp->run_hint_cnt != 0 && btmp->run_hint_cnt <= cnt) {
+		start_word = btmp->run_hint;
+		hint_cnt = btmp->run_hint_cnt;
 	}
+	uint32_t word_idx = bitmap_next_word(btmp, start_word);
+	uint32_t hint = word_cnt;
+	int ret = -1;
 
-	uint32_t bit_left = (btmp->btmp_bytes_len * 8 - bit_idx_start);		//记录还有多少位可以判断
-	uint32_t next_bit = bit_idx_start + 1; 
-	uint32_t count = 1;	//记录找到空闲位的个数
-	
-	bit_idx_start = -1;
-	while(bit_left-- >0){
-		if(!(bitmap_scan_test(btmp, next_bit))){
-			//若next_bit为0
-			count++;
-		}else{
-			count=0;
+	/*逐字累计连续空闲位的长度, 全满的字使累计清零, 全空的字整字累加*/
+	uint32_t run_start = 0;
+	uint32_t run_len = 0;
+	while (ret == -1 && word_idx < word_cnt) {
+		uint32_t free_bits = ~bitmap_word(btmp, word_idx);
+		uint32_t pos = 0;
+		while (pos < 32) {
+			uint32_t rest = free_bits >> pos;
+			if (rest == 0) {
+				/*本字余下的位都已占用*/
+				run_len = 0;
+				break;
+			}
+			uint32_t skip = bit_first_set(rest);
+			if (skip > 0) {
+				run_len = 0;
+				pos += skip;
+				rest >>= skip;
+			}
+			/*从 pos 起连续空闲位的个数*/
+			uint32_t seg = ~rest == 0 ? 32 - pos : bit_first_set(~rest);
+			if (run_len == 0) {
+				run_start = word_idx * 32 + pos;
+			}
+			run_len += seg;
+			if (run_len >= hint_cnt && hint == word_cnt) {
+				hint = run_start / 32;
+			}
+			if (run_len >= cnt) {
+				ret = run_start;
+				break;
+			}
+			pos += seg;
 		}
-		if(count == cnt){
-			bit_idx_start = next_bit - cnt +1;
+		if (ret != -1) {
 			break;
 		}
-		next_bit++;
+		/*紧邻的字未满时直接接着累计, 遇到全满的字累计中断, 才借助汇总层跳到下一个未满的字*/
+		word_idx++;
+		if (word_idx < word_cnt && bitmap_word(btmp, word_idx) == 0xffffffff) {
+			run_len = 0;
+			word_idx = bitmap_next_word(btmp, word_idx + 1);
+		}
+	}
+	btmp->run_hint = hint;
+	btmp->run_hint_cnt = hint_cnt;
+	return ret;
+}
+
+/*在位图 [start_idx, end_idx) 范围内查找第一个空闲位， 成功则返回其下标，失败返回 -1 */
+int bitmap_scan_from(struct bitmap* btmp, uint32_t start_idx, uint32_t end_idx) {
+	ASSERT(end_idx <= btmp->btmp_bytes_len * 8);
+	if (start_idx >= end_idx) {
+		return -1;
+	}
+	uint32_t word_idx = start_idx / 32;
+	/*第一个字中 start_idx 之前的位不参与查找*/
+	uint32_t free_bits = ~bitmap_word(btmp, word_idx) & (0xffffffff << (start_idx % 32));
+	while (free_bits == 0) {
+		word_idx = bitmap_next_word(btmp, word_idx + 1);
+		if (word_idx * 32 >= end_idx) {
+			return -1;
+		}
+		free_bits = ~bitmap_word(btmp, word_idx);
 	}
-	return bit_idx_start;
+	uint32_t bit_idx = word_idx * 32 + bit_first_set(free_bits);
+	return bit_idx < end_idx ? (int)bit_idx : -1;
 }
 
 /*将位图 btmp 的 bit_idx 位设置为 value*/
@@ -73,9 +175,20 @@ void bitmap_set(struct bitmap* btmp, uint32_t bit_idx, int8_t value) {
 	uint32_t bit_odd = bit_idx % 8;
 	if(value){
 		btmp->bits[byte_idx] |= (BITMAP_MASK << bit_odd);
+		/*更新汇总层中所在字的位, 所在字节也满了整字才可能变满*/
+		if (btmp->summary != NULL && btmp->bits[byte_idx] == 0xff && bitmap_word(btmp, bit_idx / 32) == 0xffffffff) {
+			btmp->summary[bit_idx / 1024] |= BITMAP_MASK << (bit_idx / 32 % 32);
+		}
 	}else{
 		btmp->bits[byte_idx] &= ~(BITMAP_MASK << bit_odd);
+		if (btmp->summary != NULL) {
+			btmp->summary[bit_idx / 1024] &= ~(BITMAP_MASK << (bit_idx / 32 % 32));
+		}
+		/*新的空闲位可能与前面不足 run_hint_cnt 个的空闲位连成够长的一段, run_hint 退到这一段可能的起点*/
+		uint32_t hint_cnt = btmp->run_hint_cnt;
+		uint32_t hint_idx = bit_idx + 1 >= hint_cnt ? (bit_idx + 1 - hint_cnt) / 32 : 0;
+		if (hint_cnt != 0 && hint_idx < btmp->run_hint) {
+			btmp->run_hint = hint_idx;
+		}
 	}
 }
-
-
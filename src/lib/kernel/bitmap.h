@@ -3,15 +3,23 @@
 #include "global.h" 
 #define BITMAP_MASK 1 
 
+/* 位图 bytes_len 字节时汇总层所需的字节数: 位图每 32 位一个字, 每字在汇总层中占 1 位 */
+#define BITMAP_SUMMARY_BYTES(bytes_len) (DIV_ROUND_UP(DIV_ROUND_UP(bytes_len, 4), 32) * 4)
+
 struct bitmap {
 	uint32_t btmp_bytes_len;
 	/* 在遍历位图时， 整体上以字节为单位， 细节上是以位为单位，所以此处位图的指针必须是单字节 */
 	uint8_t* bits;
+	/* 汇总层, 第 i 位为 1 表示位图的第 i 个字已全部占用, 查找时整字跳过; 为 NULL 时不使用汇总层 */
+	uint32_t* summary;
+	/* 多位查找的提示: run_hint 字之前不存在起始的连续 run_hint_cnt 个空闲位, run_hint_cnt 为 0 时无提示 */
+	uint32_t run_hint;
+	uint32_t run_hint_cnt;
 };
 
 void bitmap_init (struct bitmap* btmp);
 int bitmap_scan_test(struct bitmap* btmp, uint32_t bit_idx);
 int bitmap_scan(struct bitmap* btmp, uint32_t cnt);
+int bitmap_scan_from(struct bitmap* btmp, uint32_t start_idx, uint32_t end_idx);
 void bitmap_set(struct bitmap* btmp, uint32_t bit_idx, int8_t value); 
 #endif
-
@@ -35,6 +35,11 @@ static inline void outsw(uint16_t port, const void* addr, uint32_t word_cnt) {
 	// 					rep outsw
 }
 
+/* 向端口 port 写入一个双字 */
+static inline void outl(uint16_t port, uint32_t data) {
+	asm volatile ("outl %0, %w1" : : "a" (data), "Nd" (port));
+}
+
 /* 将从端口 port 读入一个字节返回 */
 static inline uint8_t inb(uint16_t port){
 	uint8_t data;
@@ -46,6 +51,13 @@ static inline uint8_t inb(uint16_t port){
 	return data;
 } 
 
+/* 将从端口 port 读入一个双字返回 */
+static inline uint32_t inl(uint16_t port) {
+	uint32_t data;
+	asm volatile ("inl %w1, %0" : "=a" (data) : "Nd" (port));
+	return data;
+}
+
 /* 将从端口 port 读入的 word_cnt 个字写入 addr */
 static inline void insw(uint16_t port, void* addr, uint32_t word_cnt){
 	/*********************************************************
@@ -2,30 +2,79 @@
 #include "global.h"
 #include "debug.h"
 #include "assert.h"
-/*将 dst_ 起始的 size 个字节设置为 value*/
+#define MEMCPY_SHORT 64 // 短于此长度的复制或填充不值得付出 rep 串指令的启动开销
+
+/*将 dst_ 起始的 size 个字节设置为 value
+* 短填充 (目录项、小结构体) 直接按字循环再补齐尾部字节;
+* 长填充先逐字节填到 4 字节对齐处, 中间用 rep stosl 按双字填充, 最后补齐不足 4 字节的尾部
+* 热路径上不再断言, 调用者保证 dst_ 有效*/
 void memset(void* dst_, uint8_t value, uint32_t size){
-	assert(dst_ != NULL);
 	uint8_t* dst = (uint8_t*)dst_;
-	while(size-- >0){
+	if(size < MEMCPY_SHORT){
+		uint32_t fill = value * 0x01010101u;
+		while(size >= 4){
+			*(uint32_t __attribute__((may_alias))*)dst = fill;
+			dst += 4;
+			size -= 4;
+		}
+		while(size-- > 0){
+			*dst++ = value;
+		}
+		return;
+	}
+	while(size > 0 && ((uint32_t)dst & 3) != 0){
+		*dst++ = value;
+		size--;
+	}
+	uint32_t dwords = size / 4;
+	if(dwords > 0){
+		uint32_t fill = value * 0x01010101u;
+		asm volatile ("cld; rep stosl" : "+D" (dst), "+c" (dwords) : "a" (fill) : "memory");
+	}
+	size &= 3;
+	while(size-- > 0){
 		*dst++ = value;
 	}
 }
 
-/*将 src_ 起始的 size 个字节复制到 dst_*/
+/*将 src_ 起始的 size 个字节复制到 dst_
+* 短复制 (文件名、目录项、小结构体) 直接按字循环再补齐尾部字节;
+* 长复制按 dst_ 对齐头部后用 rep movsl 按双字复制, 再用 rep movsb 复制剩余的尾部*/
 void memcpy(void* dst_, const void* src_, uint32_t size){
-	assert(dst_ != NULL && src_ != NULL); 
 	uint8_t* dst = dst_; 
 	const uint8_t* src = src_; 
-	while(size-- > 0){
+	if(size < MEMCPY_SHORT){
+		while(size >= 4){
+			*(uint32_t __attribute__((may_alias))*)dst = *(const uint32_t __attribute__((may_alias))*)src;
+			dst += 4;
+			src += 4;
+			size -= 4;
+		}
+		while(size-- > 0){
+			*dst++ = *src++;
+		}
+		return;
+	}
+	while(size > 0 && ((uint32_t)dst & 3) != 0){
 		*dst++ = *src++;
+		size--;
 	}
+	uint32_t dwords = size / 4;
+	uint32_t tail = size & 3;
+	asm volatile ("cld; rep movsl; movl %3, %%ecx; rep movsb" \
+		: "+D" (dst), "+S" (src), "+c" (dwords) : "r" (tail) : "memory");
 }
 
-/*连续比较以地址 a_ 和地址 b_ 开头的 size 个字节，若相等则返回 0,若 a_ 大于 b_， 返回 +1,否则返回 -1 */
+/*连续比较以地址 a_ 和地址 b_ 开头的 size 个字节，若相等则返回 0,若 a_ 大于 b_， 返回 +1,否则返回 -1 
+* 先按 4 字节整字比较跳过相同的部分, 遇到不同的字或剩余不足 4 字节时再逐字节比较*/
 int memcmp(const void* a_, const void* b_, uint32_t size) {
 	const char* a = a_;
 	const char* b = b_;
-	assert( *a != NULL || *b != NULL);
+	while(size >= 4 && *(const uint32_t __attribute__((may_alias))*)a == *(const uint32_t __attribute__((may_alias))*)b){
+		a += 4;
+		b += 4;
+		size -= 4;
+	}
 	while(size-- >0){
 		if(*a != *b){
 			return *a > *b ? 1: -1;
@@ -44,12 +93,26 @@ char* strcpy(char* dst_, const char* src_) {
 	return r;
 }
 
-/*返回字符串长度*/
+/*返回字符串长度
+* 逐字节走到 4 字节对齐处后按字检查, 对齐的字不会跨页, 读到结束符之后的字节也不会越界*/
 uint32_t strlen(const char* str) {
-	assert(str != NULL); 
 	const char* p = str; 
-	while (*p++); 
-	return (p - str - 1); 
+	while (((uint32_t)p & 3) != 0) {
+		if (*p == 0) {
+			return p - str;
+		}
+		p++;
+	}
+	/*(w - 0x01010101) & ~w & 0x80808080 非 0 当且仅当 w 中有 0 字节*/
+	const uint32_t __attribute__((may_alias))* w = (const uint32_t*)p;
+	while (((*w - 0x01010101u) & ~*w & 0x80808080u) == 0) {
+		w++;
+	}
+	p = (const char*)w;
+	while (*p) {
+		p++;
+	}
+	return (p - str); 
 }
 
 /*比较两个字符串，若 a_ 中的字符大于 b_ 中的字符返回 1,相等时返回0, 否则返回-1．*/
@@ -4,6 +4,14 @@
 #include "file.h"
 #include "ioqueue.h"
 #include "thread.h"
+#include "slab.h"
+
+static struct slab_cache pipe_slab; // 管道的环形缓冲区
+
+/* 创建管道环形缓冲区的对象缓存 */
+void pipe_init(void) {
+	slab_cache_init(&pipe_slab, "pipe", sizeof(struct ioqueue), NULL);
+}
 
 /* 判断文件描述符local_fd是否是管道 */
 bool is_pipe(uint32_t local_fd) {
@@ -15,14 +23,14 @@ bool is_pipe(uint32_t local_fd) {
 int32_t sys_pipe(int32_t pipefd[2]) {
 	int32_t global_fd = get_free_slot_in_global();
 
-	/* 申请一页内核内存做环形缓冲区 */
-	file_table[global_fd].fd_inode = get_kernel_pages(1); 
-
-	/* 初始化环形缓冲区 */
-	ioqueue_init((struct ioqueue*)file_table[global_fd].fd_inode);
+	/* 从管道缓存中申请环形缓冲区 */
+	file_table[global_fd].fd_inode = slab_alloc(&pipe_slab);
 	if (file_table[global_fd].fd_inode == NULL) {
 		return -1;
 	}
+
+	/* 初始化环形缓冲区 */
+	ioqueue_init((struct ioqueue*)file_table[global_fd].fd_inode);
 	
 	/* 将fd_flag复用为管道标志 */
 	file_table[global_fd].fd_flag = PIPE_FLAG;
@@ -34,6 +42,14 @@ int32_t sys_pipe(int32_t pipefd[2]) {
 	return 0;
 }
 
+/* 关闭管道的一个描述符,如果此管道上的描述符都被关闭,释放管道的环形缓冲区 */
+void pipe_release(uint32_t global_fd) {
+	if (--file_table[global_fd].fd_pos == 0) {
+		slab_free(&pipe_slab, file_table[global_fd].fd_inode);
+		file_table[global_fd].fd_inode = NULL;
+	}
+}
+
 /* 从管道中读数据 */
 uint32_t pipe_read(int32_t fd, void* buf, uint32_t count) {
 	char* buffer = buf;
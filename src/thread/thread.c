@@ -14,6 +14,8 @@
 
 // pid 的位图, 最大支持 1024 个 pid
 uint8_t pid_bitmap_bits[128] = {0};
+// pid 位图的汇总层
+static uint32_t pid_bitmap_summary[BITMAP_SUMMARY_BYTES(128) / 4];
 
 // pid 池
 struct pid_pool {
@@ -26,6 +28,7 @@ struct task_struct* main_thread; // 主线程 PCB
 struct task_struct* idle_thread;        // idle 线程
 struct list thread_ready_list; // 就绪队列
 struct list thread_all_list; // 所有任务队列
+struct slab_cache task_slab; // 任务的 pcb, 每个占一页, 页的高端是任务的内核栈
 struct lock pid_lock;                   // 分配 pid 锁
 static struct list_elem* thread_tag; // 用于保存队列中的线程结点
 
@@ -62,6 +65,7 @@ static void pid_pool_init(void) {
     pid_pool.pid_start = 1;
     pid_pool.pid_bitmap.bits = pid_bitmap_bits;
     pid_pool.pid_bitmap.btmp_bytes_len = 128;
+    pid_pool.pid_bitmap.summary = pid_bitmap_summary;
     bitmap_init(&pid_pool.pid_bitmap);
     lock_init(&pid_pool.pid_lock);
 }
@@ -153,7 +157,7 @@ struct task_struct* thread_start(char* name,            //线程名
                                  void* func_arg)        //函数的参数
 {
     // PCB 都位于内核空间, 包括用户进程的 PCB 也是在内核空间
-    struct task_struct* thread = get_kernel_pages(1);   //申请一页内核空间存放PCB
+    struct task_struct* thread = slab_alloc(&task_slab);   //申请一页内核空间存放PCB
 
     init_thread(thread, name, prio);                    //初始化线程
     thread_create(thread, function, func_arg);          //创建线程
@@ -292,6 +296,9 @@ void sys_ps(void) {
 
 // 回收 thread_over 的 pcb 和页表, 并将其从调度队列中去除
 void thread_exit(struct task_struct* thread_over, bool need_schedule) {
+    // 归还弹匣中的内存块, 可能要等内存池的锁, 须在关中断和置为 TASK_DIED 之前
+    mem_magazines_drain(thread_over);
+
     // 要保证 schedule 在关中断情况下调用
     intr_disable();
     thread_over->status = TASK_DIED;
@@ -307,14 +314,17 @@ void thread_exit(struct task_struct* thread_over, bool need_schedule) {
     // 从 all_thread_list 中去掉此任务
     list_remove(&thread_over->all_list_tag);
 
+    // 归还 pid
+    release_pid(thread_over->pid);
+
     // 回收 pcb 所在的页, 主线程的 pcb 不在堆中, 跨过
+    // 回收后 pcb 的头 4 字节被用作 slab 的空闲链表指针, 不能再访问 thread_over.
+    // 任务切换会把栈指针存入 pcb 的头 4 字节, 所以堆中的任务不能回收自己的 pcb
     if (thread_over != main_thread) {
-        mfree_page(PF_KERNEL, thread_over, 1);
+        ASSERT(thread_over != running_thread());
+        slab_free(&task_slab, thread_over);
     }
 
-    // 归还 pid
-    release_pid(thread_over->pid);
-
     // 如果需要下一轮调度则主动调用 schedule
     if (need_schedule) {
         schedule();
@@ -344,6 +354,7 @@ void thread_init(void) {
 
     list_init(&thread_ready_list);
     list_init(&thread_all_list);
+    slab_cache_init(&task_slab, "task_struct", PG_SIZE, NULL);
     pid_pool_init();
 
     // 先创建第一个用户进程 init
@@ -4,6 +4,7 @@
 #include "list.h"
 #include "memory.h"
 #include "bitmap.h"
+#include "slab.h"
 #define TASK_NAME_LEN 16
 
 #define MAX_FILES_OPEN_PER_PROC 8
@@ -88,6 +89,14 @@ struct task_struct {
     uint32_t* pgdir;                // 进程自己页表的虚拟地址
     struct virtual_addr userprog_vaddr; // 用户进程的虚拟地址
     struct mem_block_desc u_block_desc[DESC_CNT];   //用户进程内存块描述符
+    struct mem_magazine mags[DESC_CNT]; // sys_malloc 各规格内存块的弹匣, 内核线程和用户进程各用各的内存池
+    struct vm_seg vm_segs[MAX_VM_SEGS]; // exec 加载的程序段, 缺页时按此从文件读入
+    uint8_t vm_seg_cnt;             // vm_segs 中的段数
+    struct inode* exec_inode;       // 程序段所在的可执行文件, 进程对其持有一次打开
+    // 缺页时读 exec_inode 的预读状态, 与 struct file 中的同名成员含义相同, 使顺序的缺页也能逐次加大预读
+    uint32_t exec_ra_pos;
+    uint32_t exec_ra_size;
+    uint32_t exec_ra_end;
     uint32_t cwd_inode_nr;          // 进程所在工作目录的inode编号
     int16_t parent_pid;             // 父进程 pid
     int8_t exit_status;             // 进程结束时自己调用 exit 传入的参数
@@ -95,6 +104,7 @@ struct task_struct {
 };
 extern struct list thread_ready_list;
 extern struct list thread_all_list;
+extern struct slab_cache task_slab;
 
 void thread_create(struct task_struct* pthread, thread_func function, void* func_arg);
 void init_thread(struct task_struct* pthread, char* name, int prio);
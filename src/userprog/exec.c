@@ -5,6 +5,9 @@
 #include "string.h"
 #include "global.h"
 #include "memory.h"
+#include "process.h"
+#include "file.h"
+#include "inode.h"
 
 extern void intr_exit(void);
 typedef uint32_t Elf32_Word, Elf32_Addr, Elf32_Off;
@@ -51,45 +54,91 @@ enum segment_type {
    PT_PHDR             // 程序头表
 };
 
-/* 将文件描述符fd指向的文件中,偏移为offset,大小为filesz的段加载到虚拟地址为vaddr的内存 */
-static bool segment_load(int32_t fd, uint32_t offset, uint32_t filesz, uint32_t vaddr) {
-   uint32_t vaddr_first_page = vaddr & 0xfffff000;    // vaddr地址所在的页框
-   uint32_t size_in_first_page = PG_SIZE - (vaddr & 0x00000fff);     // 加载到内存后,文件在第一个页框中占用的字节大小
-   uint32_t occupy_pages = 0;
-   /* 若一个页框容不下该段 */
-   if (filesz > size_in_first_page) {
-      uint32_t left_size = filesz - size_in_first_page;
-      occupy_pages = DIV_ROUND_UP(left_size, PG_SIZE) + 1;	     // 1是指vaddr_first_page
-   } else {
-      occupy_pages = 1;
-   }
-
-   /* 为进程分配内存 */
-   uint32_t page_idx = 0;
-   uint32_t vaddr_page = vaddr_first_page;
-   while (page_idx < occupy_pages) {
-      uint32_t* pde = pde_ptr(vaddr_page);
-      uint32_t* pte = pte_ptr(vaddr_page);
-
-      /* 如果pde不存在,或者pte不存在就分配内存.
-       * pde的判断要在pte之前,否则pde若不存在会导致
-       * 判断pte时缺页异常 */
-      if (!(*pde & 0x00000001) || !(*pte & 0x00000001)) {
-	 if (get_a_page(PF_USER, vaddr_page) == NULL) {
-	    return false;
-	 }
-      } // 如果原进程的页表已经分配了,利用现有的物理页,直接覆盖进程体
+/* 记录程序段prog_header,段中的页不在此分配,等第一次访问时由缺页处理从文件读入.
+ * 原进程在该段范围内已有的页一律解除映射,以免新程序读到旧进程体 */
+static bool segment_map(struct task_struct* cur, struct Elf32_Phdr* prog_header) {
+   if (cur->vm_seg_cnt == MAX_VM_SEGS || prog_header->p_filesz > prog_header->p_memsz || \
+       prog_header->p_vaddr < USER_VADDR_START || \
+       prog_header->p_vaddr + prog_header->p_memsz > USER_STACK3_VADDR) {
+      return false;
+   }
+   struct vm_seg* seg = &cur->vm_segs[cur->vm_seg_cnt++];
+   seg->vaddr_start = prog_header->p_vaddr;
+   seg->file_end = prog_header->p_vaddr + prog_header->p_filesz;
+   seg->vaddr_end = prog_header->p_vaddr + prog_header->p_memsz;
+   seg->file_offset = prog_header->p_offset;
+
+   /* 段所占的虚拟页在位图中预先占用,避免被malloc分走 */
+   uint32_t vaddr_page = seg->vaddr_start & 0xfffff000;
+   while (vaddr_page < seg->vaddr_end) {
+      bitmap_set(&cur->userprog_vaddr.vaddr_bitmap, (vaddr_page - cur->userprog_vaddr.vaddr_start) / PG_SIZE, 1);
+      user_page_unmap(vaddr_page);
       vaddr_page += PG_SIZE;
-      page_idx++;
    }
-   sys_lseek(fd, offset, SEEK_SET);
-   sys_read(fd, (void*)vaddr, filesz);
+   return true;
+}
+
+/* 处理当前进程对程序段中尚未载入的页vaddr的访问:分配页框,读入文件中的内容,其余部分填0.
+ * vaddr不在任何程序段中或已经映射时返回false, 可执行文件中读不出该有的内容时同样返回false */
+bool exec_page_fault(uint32_t vaddr) {
+   struct task_struct* cur = running_thread();
+   uint32_t vaddr_page = vaddr & 0xfffff000;
+   if (cur->pgdir == NULL || cur->exec_inode == NULL || vaddr >= 0xc0000000) {
+      return false;
+   }
+   if ((*pde_ptr(vaddr_page) & PG_P_1) && (*pte_ptr(vaddr_page) & PG_P_1)) {
+      return false;
+   }
+   uint8_t seg_idx;
+   for (seg_idx = 0; seg_idx < cur->vm_seg_cnt; seg_idx++) {
+      struct vm_seg* seg = &cur->vm_segs[seg_idx];
+      if (vaddr_page < seg->vaddr_end && vaddr_page + PG_SIZE > seg->vaddr_start) {
+	 break;
+      }
+   }
+   if (seg_idx == cur->vm_seg_cnt) {
+      return false;
+   }
+
+   /* 虚拟页在exec时已在位图中占用 */
+   if (get_a_page_without_opvaddrbitmap(PF_USER, vaddr_page) == NULL) {
+      return false;
+   }
+   memset((void*)vaddr_page, 0, PG_SIZE);
+
+   /* 相邻的段可能落在同一页中,逐段读入与本页重叠的文件内容 */
+   for (seg_idx = 0; seg_idx < cur->vm_seg_cnt; seg_idx++) {
+      struct vm_seg* seg = &cur->vm_segs[seg_idx];
+      uint32_t start = seg->vaddr_start > vaddr_page ? seg->vaddr_start : vaddr_page;
+      uint32_t end = seg->file_end < vaddr_page + PG_SIZE ? seg->file_end : vaddr_page + PG_SIZE;
+      if (start >= end) {
+	 continue;
+      }
+      struct file exec_file;
+      memset(&exec_file, 0, sizeof(struct file));
+      exec_file.fd_inode = cur->exec_inode;
+      exec_file.fd_pos = seg->file_offset + (start - seg->vaddr_start);
+      exec_file.ra_pos = cur->exec_ra_pos;
+      exec_file.ra_size = cur->exec_ra_size;
+      exec_file.ra_end = cur->exec_ra_end;
+      int32_t bytes_read = file_read(&exec_file, (void*)start, end - start);
+      cur->exec_ra_pos = exec_file.ra_pos;
+      cur->exec_ra_size = exec_file.ra_size;
+      cur->exec_ra_end = exec_file.ra_end;
+      /* 可执行文件比程序头所说的短,不能用 0 冒充缺少的内容 */
+      if (bytes_read != (int32_t)(end - start)) {
+	 user_page_unmap(vaddr_page);
+	 return false;
+      }
+   }
    return true;
 }
 
 /* 从文件系统上加载用户程序pathname,成功则返回程序的起始地址,否则返回-1 */
 static int32_t load(const char* pathname) {
    int32_t ret = -1;
+   struct task_struct* cur = running_thread();
+   bool segs_replaced = false;     // 原进程的程序段记录是否已被清掉
    struct Elf32_Ehdr elf_header;
    struct Elf32_Phdr prog_header;
    memset(&elf_header, 0, sizeof(struct Elf32_Ehdr));
@@ -119,6 +168,8 @@ static int32_t load(const char* pathname) {
    Elf32_Half prog_header_size = elf_header.e_phentsize;
 
    /* 遍历所有程序头 */
+   cur->vm_seg_cnt = 0;
+   segs_replaced = true;
    uint32_t prog_idx = 0;
    while (prog_idx < elf_header.e_phnum) {
       memset(&prog_header, 0, prog_header_size);
@@ -132,9 +183,9 @@ static int32_t load(const char* pathname) {
 	 goto done;
       }
 
-      /* 如果是可加载段就调用segment_load加载到内存 */
+      /* 如果是可加载段就调用segment_map记录下来 */
       if (PT_LOAD == prog_header.p_type) {
-	 if (!segment_load(fd, prog_header.p_offset, prog_header.p_filesz, prog_header.p_vaddr)) {
+	 if (!segment_map(cur, &prog_header)) {
 	    ret = -1;
 	    goto done;
 	 }
@@ -145,7 +196,19 @@ static int32_t load(const char* pathname) {
       prog_idx++;
    }
    ret = elf_header.e_entry;
+
+   /* 缺页时还要从文件读入程序段,因此进程对可执行文件另外持有一次打开,
+    * 原先的可执行文件不再需要 */
+   if (cur->exec_inode != NULL) {
+      inode_close(cur->exec_inode);
+   }
+   cur->exec_inode = inode_open(cur_part, file_table[fd_local2global(fd)].fd_inode->i_no);
+   cur->exec_ra_pos = cur->exec_ra_size = cur->exec_ra_end = 0;
 done:
+   /* 已记录的段属于加载失败的新程序,不能再按它们从原可执行文件读入 */
+   if (ret == -1 && segs_replaced) {
+      cur->vm_seg_cnt = 0;
+   }
    sys_close(fd);
    return ret;
 }
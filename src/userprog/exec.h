@@ -1,5 +1,7 @@
 #ifndef __USERPROG_EXEC_H
 #define __USERPROG_EXEC_H
 #include "stdint.h"
+#include "global.h"
 int32_t sys_execv(const char* path, const char*  argv[]);
+bool exec_page_fault(uint32_t vaddr);
 #endif
\ No newline at end of file
@@ -22,60 +22,25 @@ static int32_t copy_pcb_vaddrbitmap_stack0(struct task_struct* child_thread, str
    child_thread->general_tag.prev = child_thread->general_tag.next = NULL;
    child_thread->all_list_tag.prev = child_thread->all_list_tag.next = NULL;
    block_desc_init(child_thread->u_block_desc);
+   /* 弹匣中的块所在 arena 的 desc 仍指向父进程 pcb 中的 u_block_desc, 子进程归还它们会链入父进程的 free_list.
+    * 所以子进程的弹匣从空开始, 这些块在子进程中不再使用, 随子进程的地址空间一同回收 */
+   memset(child_thread->mags, 0, sizeof(child_thread->mags));
 /* b 复制父进程的虚拟地址池的位图 */
-   uint32_t bitmap_pg_cnt = DIV_ROUND_UP((0xc0000000 - USER_VADDR_START) / PG_SIZE / 8 , PG_SIZE);
+   uint32_t bitmap_pg_cnt = USER_VADDR_BITMAP_PG_CNT;
    void* vaddr_btmp = get_kernel_pages(bitmap_pg_cnt);
    if (vaddr_btmp == NULL) return -1;
    /* 此时child_thread->userprog_vaddr.vaddr_bitmap.bits还是指向父进程虚拟地址的位图地址
     * 下面将child_thread->userprog_vaddr.vaddr_bitmap.bits指向自己的位图vaddr_btmp */
    memcpy(vaddr_btmp, child_thread->userprog_vaddr.vaddr_bitmap.bits, bitmap_pg_cnt * PG_SIZE);
    child_thread->userprog_vaddr.vaddr_bitmap.bits = vaddr_btmp;
+   /* 汇总层与位图一同复制过来了, 同样指向自己的副本 */
+   child_thread->userprog_vaddr.vaddr_bitmap.summary = (uint32_t*)((uint8_t*)vaddr_btmp + USER_VADDR_SUMMARY_OFFSET);
    /* 调试用 */
 //   ASSERT(strlen(child_thread->name) < 11);	// pcb.name的长度是16,为避免下面strcat越界
 //   strcat(child_thread->name,"_fork");
    return 0;
 }
 
-/* 复制子进程的进程体(代码和数据)及用户栈 */
-static void copy_body_stack3(struct task_struct* child_thread, struct task_struct* parent_thread, void* buf_page) {
-   uint8_t* vaddr_btmp = parent_thread->userprog_vaddr.vaddr_bitmap.bits;
-   uint32_t btmp_bytes_len = parent_thread->userprog_vaddr.vaddr_bitmap.btmp_bytes_len;
-   uint32_t vaddr_start = parent_thread->userprog_vaddr.vaddr_start;
-   uint32_t idx_byte = 0;
-   uint32_t idx_bit = 0;
-   uint32_t prog_vaddr = 0;
-
-   /* 在父进程的用户空间中查找已有数据的页 */
-   while (idx_byte < btmp_bytes_len) {
-      if (vaddr_btmp[idx_byte]) {
-	 idx_bit = 0;
-	 while (idx_bit < 8) {
-	    if ((BITMAP_MASK << idx_bit) & vaddr_btmp[idx_byte]) {
-	       prog_vaddr = (idx_byte * 8 + idx_bit) * PG_SIZE + vaddr_start;
-	 /* 下面的操作是将父进程用户空间中的数据通过内核空间做中转,最终复制到子进程的用户空间 */
-
-	       /* a 将父进程在用户空间中的数据复制到内核缓冲区buf_page,
-	       目的是下面切换到子进程的页表后,还能访问到父进程的数据*/
-	       memcpy(buf_page, (void*)prog_vaddr, PG_SIZE);
-
-	       /* b 将页表切换到子进程,目的是避免下面申请内存的函数将pte及pde安装在父进程的页表中 */
-	       page_dir_activate(child_thread);
-	       /* c 申请虚拟地址prog_vaddr */
-	       get_a_page_without_opvaddrbitmap(PF_USER, prog_vaddr);
-
-	       /* d 从内核缓冲区中将父进程数据复制到子进程的用户空间 */
-	       memcpy((void*)prog_vaddr, buf_page, PG_SIZE);
-
-	       /* e 恢复父进程页表 */
-	       page_dir_activate(parent_thread);
-	    }
-	    idx_bit++;
-	 }
-      }
-      idx_byte++;
-   }
-}
-
 /* 为子进程构建thread_stack和修改返回值 */
 static int32_t build_child_stack(struct task_struct* child_thread) {
 /* a 使子进程pid返回值为0 */
@@ -126,16 +91,14 @@ static void update_inode_open_cnts(struct task_struct* thread) {
       }
       local_fd++;
    }
+   /* 子进程同样要从可执行文件读入尚未载入的程序段 */
+   if (thread->exec_inode != NULL) {
+      thread->exec_inode->i_open_cnts++;
+   }
 }
 
 /* 拷贝父进程本身所占资源给子进程 */
 static int32_t copy_process(struct task_struct* child_thread, struct task_struct* parent_thread) {
-   /* 内核缓冲区,作为父进程用户空间的数据复制到子进程用户空间的中转 */
-   void* buf_page = get_kernel_pages(1);
-   if (buf_page == NULL) {
-      return -1;
-   }
-
    /* a 复制父进程的pcb、虚拟地址位图、内核栈到子进程 */
    if (copy_pcb_vaddrbitmap_stack0(child_thread, parent_thread) == -1) {
       return -1;
@@ -147,23 +110,23 @@ static int32_t copy_process(struct task_struct* child_thread, struct task_struct
       return -1;
    }
 
-   /* c 复制父进程进程体及用户栈给子进程 */
-   copy_body_stack3(child_thread, parent_thread, buf_page);
+   /* c 复制父进程用户空间的页表给子进程,进程体及用户栈的页框写时复制 */
+   if (user_pages_share(child_thread->pgdir) == -1) {
+      return -1;
+   }
 
    /* d 构建子进程thread_stack和修改返回值pid */
    build_child_stack(child_thread);
 
    /* e 更新文件inode的打开数 */
    update_inode_open_cnts(child_thread);
-
-   mfree_page(PF_KERNEL, buf_page, 1);
    return 0;
 }
 
 /* fork子进程,内核线程不可直接调用 */
 pid_t sys_fork(void) {
    struct task_struct* parent_thread = running_thread();
-   struct task_struct* child_thread = get_kernel_pages(1);    // 为子进程创建pcb(task_struct结构)
+   struct task_struct* child_thread = slab_alloc(&task_slab);    // 为子进程创建pcb(task_struct结构)
    if (child_thread == NULL) {
       return -1;
    }
@@ -89,16 +89,17 @@ uint32_t* create_page_dir(void) {
 /* 创建用户进程虚拟地址位图 */
 void create_user_vaddr_bitmap(struct task_struct* user_prog) {
    user_prog->userprog_vaddr.vaddr_start = USER_VADDR_START;
-   uint32_t bitmap_pg_cnt = DIV_ROUND_UP((0xc0000000 - USER_VADDR_START) / PG_SIZE / 8 , PG_SIZE);
-   user_prog->userprog_vaddr.vaddr_bitmap.bits = get_kernel_pages(bitmap_pg_cnt);
-   user_prog->userprog_vaddr.vaddr_bitmap.btmp_bytes_len = (0xc0000000 - USER_VADDR_START) / PG_SIZE / 8;
+   user_prog->userprog_vaddr.vaddr_bitmap.bits = get_kernel_pages(USER_VADDR_BITMAP_PG_CNT);
+   user_prog->userprog_vaddr.vaddr_bitmap.btmp_bytes_len = USER_VADDR_BITMAP_BYTES;
+   user_prog->userprog_vaddr.vaddr_bitmap.summary = \
+      (uint32_t*)(user_prog->userprog_vaddr.vaddr_bitmap.bits + USER_VADDR_SUMMARY_OFFSET);
    bitmap_init(&user_prog->userprog_vaddr.vaddr_bitmap);
 }
 
 /* 创建用户进程 */
 void process_execute(void* filename, char* name) { 
    /* pcb内核的数据结构,由内核来维护进程信息,因此要在内核内存池中申请 */
-   struct task_struct* thread = get_kernel_pages(1);
+   struct task_struct* thread = slab_alloc(&task_slab);
    init_thread(thread, name, default_prio); 
    create_user_vaddr_bitmap(thread);
    thread_create(thread, start_process, filename);
@@ -2,9 +2,16 @@
 #define __USERPROG_PROCESS_H
 #include "thread.h"
 #include "stdint.h"
+#include "global.h"
+#include "bitmap.h"
 #define default_prio 31
 #define USER_STACK3_VADDR  (0xc0000000 - 0x1000)
 #define USER_VADDR_START 0x8048000
+/* 用户虚拟地址位图的字节数, 其汇总层紧随位图之后, 与位图共用 USER_VADDR_BITMAP_PG_CNT 个页 */
+#define USER_VADDR_BITMAP_BYTES ((0xc0000000 - USER_VADDR_START) / PG_SIZE / 8)
+#define USER_VADDR_SUMMARY_OFFSET (DIV_ROUND_UP(USER_VADDR_BITMAP_BYTES, 4) * 4)
+#define USER_VADDR_BITMAP_PG_CNT \
+   DIV_ROUND_UP(USER_VADDR_SUMMARY_OFFSET + BITMAP_SUMMARY_BYTES(USER_VADDR_BITMAP_BYTES), PG_SIZE)
 void process_execute(void* filename, char* name);
 void start_process(void* filename_);
 void process_activate(struct task_struct* p_thread);
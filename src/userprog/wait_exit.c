@@ -9,6 +9,7 @@
 #include "fs.h"
 #include "file.h"
 #include "pipe.h"
+#include "process.h"
 
 /* 释放用户进程资源: 
  * 1 页表中对应的物理页
@@ -52,20 +53,22 @@ static void release_prog_resource(struct task_struct* release_thread) {
 	}
 
 	/* 回收用户虚拟地址池所占的物理内存*/
-	uint32_t bitmap_pg_cnt = (release_thread->userprog_vaddr.vaddr_bitmap.btmp_bytes_len) / PG_SIZE;
+	uint32_t bitmap_pg_cnt = USER_VADDR_BITMAP_PG_CNT;
 	uint8_t* user_vaddr_pool_bitmap = release_thread->userprog_vaddr.vaddr_bitmap.bits;
 	mfree_page(PF_KERNEL, user_vaddr_pool_bitmap, bitmap_pg_cnt);
 
+	/* 关闭按需加载程序段所用的可执行文件 */
+	if (release_thread->exec_inode != NULL) {
+		inode_close(release_thread->exec_inode);
+		release_thread->exec_inode = NULL;
+	}
+
 	/* 关闭进程打开的文件 */
 	uint8_t local_fd = 3;
 	while(local_fd < MAX_FILES_OPEN_PER_PROC) {
 		if (release_thread->fd_table[local_fd] != -1) {
 			if (is_pipe(local_fd)) {
-				uint32_t global_fd = fd_local2global(local_fd);  
-				if (--file_table[global_fd].fd_pos == 0) {
-					mfree_page(PF_KERNEL, file_table[global_fd].fd_inode, 1);
-					file_table[global_fd].fd_inode = NULL;
-				}
+				pipe_release(fd_local2global(local_fd));
 			} else {
 				sys_close(local_fd);
 			}